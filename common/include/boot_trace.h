@@ -0,0 +1,221 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef __BOOT_TRACE_H
+#define __BOOT_TRACE_H
+
+/*
+ * Boot timeline trace.
+ *
+ * The buffer is allocated by the EFI preload as reserved memory (so it
+ * survives the OS boot), and its address is passed on through
+ * ikgt_platform_info_t -> xmon_desc_t -> startap -> xmon entry. Every
+ * stage appends TSC stamped records to it.
+ *
+ * NOTE: uefi_bootloader/preload.c has its own copy of these definitions,
+ *       keep them in sync.
+ */
+#define BOOT_TRACE_MAGIC            0x4543415254474B49ULL /* "IKGTRACE" */
+#define BOOT_TRACE_VERSION          2
+#define BOOT_TRACE_SIZE             0x10000 /* 64KB, including the header */
+#define BOOT_TRACE_MAX_ARGS         4
+
+/* tsc_flags */
+#define BOOT_TRACE_TSC_INVARIANT        0x1 /* CPUID.80000007H:EDX[8] */
+#define BOOT_TRACE_TSC_FROM_CPUID       0x2 /* CPUID leaf 0x15, or 0x16 */
+#define BOOT_TRACE_TSC_FROM_PM_TIMER    0x4 /* measured with the ACPI PM timer */
+
+/*
+ * Events and how pre_os/tools/boot_trace_decode prints their arguments,
+ * X(name, format). The decoder is built from this list, so a record costs
+ * the loader a few stores and no formatting.
+ * The position is part of the buffer format, only append new ones.
+ */
+#define BOOT_TRACE_EVENT_LIST(X) \
+	X(NONE,                     "") \
+	/* preload */ \
+	X(PRELOAD_ENTRY,            "") \
+	X(PRELOAD_IMAGE_READ,       "package size 0x%llx") \
+	X(PRELOAD_MEM_ALLOCATED,    "") \
+	X(PRELOAD_CALL_LOADER,      "") \
+	X(PRELOAD_RESUME,           "back in preload, as guest") \
+	/* starter */ \
+	X(STARTER_ENTRY,            "") \
+	X(STARTER_RUN_LOADER,       "") \
+	X(STARTER_LOADER_RELOCATED, "load size 0x%llx") \
+	/* xmon_loader */ \
+	X(LOADER_ENTRY,             "") \
+	X(LOADER_HEAP_INIT,         "heap size 0x%llx") \
+	X(LOADER_XMON_LOADED,       "load size 0x%llx base 0x%llx entry 0x%llx") \
+	X(LOADER_STARTAP_LOADED,    "load size 0x%llx base 0x%llx entry 0x%llx") \
+	X(LOADER_SETUP_ENV,         "") \
+	X(LOADER_CALL_STARTAP,      "") \
+	/* startap */ \
+	X(STARTAP_ENTRY,            "") \
+	X(STARTAP_INIT_SIPI_SENT,   "") \
+	X(STARTAP_APS_ENUMERATED,   "%llu APs") \
+	X(STARTAP_APS_RUN,          "%llu APs") \
+	X(STARTAP_CALL_XMON_ENTRY,  "") \
+	/* xmon_loader heap usage, recorded before calling startap */ \
+	X(LOADER_HEAP_HIGH_WATER,   "peak 0x%llx bytes") \
+	X(LOADER_HEAP_ALLOCS,       "%llu allocations, %llu frees") \
+	/* ELF loader, one per program header */ \
+	X(ELF_SEGMENT,              "type 0x%llx addr 0x%llx memsz 0x%llx filesz 0x%llx") \
+	/* startap, INIT and the first SIPI sent, before xmon is loaded */ \
+	X(STARTAP_APS_KICKED,       "%llu CPUs listed by the ACPI MADT, INIT-SIPI %llu usec, SIPI-SIPI %llu usec") \
+	/* startap, see tsc_hz in boot_trace_header_t */ \
+	X(STARTAP_TSC_CALIBRATED,   "%llu Hz, flags 0x%llx")
+
+#define BOOT_TRACE_ENUM(name, format) BOOT_TRACE_##name,
+
+typedef enum {
+	BOOT_TRACE_EVENT_LIST(BOOT_TRACE_ENUM)
+	BOOT_TRACE_EVENT_COUNT
+} boot_trace_event_t;
+
+#undef BOOT_TRACE_ENUM
+
+typedef struct {
+	uint64_t tsc;
+	uint16_t event;
+	uint16_t cpu;
+	uint32_t reserved;
+	uint64_t args[BOOT_TRACE_MAX_ARGS];
+} boot_trace_record_t;
+
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	/* size of the whole buffer, including this header */
+	uint32_t size;
+	uint32_t max_records;
+	/* index of the next free record, may exceed max_records
+	 * when records were dropped */
+	volatile uint32_t next;
+	/* TSC frequency calibrated by startap, 0 if unknown. xmon gets this
+	 * buffer as the last argument of its entry point, it can use them
+	 * instead of calibrating again */
+	uint64_t tsc_hz;
+	uint64_t tsc_flags;             /* BOOT_TRACE_TSC_xxx */
+
+	boot_trace_record_t records[0];
+} boot_trace_header_t;
+
+static inline uint64_t boot_trace_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void boot_trace_init(boot_trace_header_t *bt, uint32_t size)
+{
+	bt->magic = BOOT_TRACE_MAGIC;
+	bt->version = BOOT_TRACE_VERSION;
+	bt->size = size;
+	bt->max_records = (size - sizeof(boot_trace_header_t)) /
+			  sizeof(boot_trace_record_t);
+	bt->next = 0;
+	bt->tsc_hz = 0;
+	bt->tsc_flags = 0;
+}
+
+static inline boot_trace_header_t *boot_trace_get(uint64_t addr)
+{
+	boot_trace_header_t *bt = (boot_trace_header_t *)addr;
+
+	if ((bt == NULL) || (bt->magic != BOOT_TRACE_MAGIC) ||
+	    (bt->version != BOOT_TRACE_VERSION)) {
+		return NULL;
+	}
+
+	return bt;
+}
+
+/*
+ * may be called on any cpu, the slot is reserved with a locked xadd.
+ * Records are kept in order of arrival, the ones that do not fit are
+ * dropped so the start of the boot is never lost.
+ */
+static inline void boot_trace_record4_at(boot_trace_header_t *bt,
+					 uint64_t tsc,
+					 uint16_t event,
+					 uint16_t cpu,
+					 uint64_t arg0,
+					 uint64_t arg1,
+					 uint64_t arg2,
+					 uint64_t arg3)
+{
+	boot_trace_record_t *rec;
+	uint32_t idx = 1;
+
+	if (bt == NULL) {
+		return;
+	}
+
+	__asm__ __volatile__ (
+		"lock; xaddl %0, %1"
+		: "+r" (idx), "+m" (bt->next)
+		:
+		: "memory"
+		);
+
+	if (idx >= bt->max_records) {
+		return;
+	}
+
+	rec = &bt->records[idx];
+	rec->tsc = tsc;
+	rec->cpu = cpu;
+	rec->args[0] = arg0;
+	rec->args[1] = arg1;
+	rec->args[2] = arg2;
+	rec->args[3] = arg3;
+	/* written last, a record with an event is complete */
+	rec->event = event;
+}
+
+static inline void boot_trace_record_at(boot_trace_header_t *bt,
+					uint64_t tsc,
+					uint16_t event,
+					uint16_t cpu,
+					uint64_t arg)
+{
+	boot_trace_record4_at(bt, tsc, event, cpu, arg, 0, 0, 0);
+}
+
+static inline void boot_trace_record(boot_trace_header_t *bt,
+				     uint16_t event,
+				     uint16_t cpu,
+				     uint64_t arg)
+{
+	boot_trace_record4_at(bt, boot_trace_rdtsc(), event, cpu, arg, 0, 0, 0);
+}
+
+static inline void boot_trace_record4(boot_trace_header_t *bt,
+				      uint16_t event,
+				      uint16_t cpu,
+				      uint64_t arg0,
+				      uint64_t arg1,
+				      uint64_t arg2,
+				      uint64_t arg3)
+{
+	boot_trace_record4_at(bt, boot_trace_rdtsc(), event, cpu,
+		arg0, arg1, arg2, arg3);
+}
+
+#endif
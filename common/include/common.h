@@ -16,8 +16,8 @@
 #ifndef _COMMON_H
 #define _COMMON_H
 
-void *mon_memset(void *dest, char val, unsigned int count);
-void *mon_memcpy(void *dest, const void *src, unsigned int count);
+void *mon_memset(void *dest, uint8_t val, uint64_t count);
+void *mon_memcpy(void *dest, const void *src, uint64_t count);
 int mon_strlen(const char *string);
 
 #endif
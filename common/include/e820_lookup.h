@@ -0,0 +1,80 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef __E820_LOOKUP_H
+#define __E820_LOOKUP_H
+
+/*
+ * Range lookup in the E820 table built by xmon_loader (e820.c) and
+ * passed on to xmon in mon_startup_struct_t.physical_memory_layout_E820.
+ *
+ * The loader guarantees the entries are sorted by base address, do not
+ * overlap, and adjacent entries of the same type are merged, so a range
+ * is found with a binary search.
+ *
+ * mon_startup.h must be included before this file.
+ */
+
+static inline uint32_t e820_entry_count(const int15_e820_memory_map_t *e820)
+{
+	return e820->memory_map_size / sizeof(int15_e820_memory_map_entry_ext_t);
+}
+
+/* the entry containing addr, NULL if addr is in a hole */
+static inline const int15_e820_memory_map_entry_ext_t *
+e820_lookup(const int15_e820_memory_map_t *e820, uint64_t addr)
+{
+	const int15_e820_memory_map_entry_ext_t *entry;
+	uint32_t lo = 0;
+	uint32_t hi = e820_entry_count(e820);
+	uint32_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		entry = &e820->memory_map_entry[mid];
+		if (addr < entry->basic_entry.base_address) {
+			hi = mid;
+		} else if (addr - entry->basic_entry.base_address >=
+			   entry->basic_entry.length) {
+			lo = mid + 1;
+		} else {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* whether [addr, addr + size) is entirely covered by entries of type */
+static inline boolean_t e820_range_is_type(const int15_e820_memory_map_t *e820,
+					   uint64_t addr,
+					   uint64_t size,
+					   uint32_t type)
+{
+	const int15_e820_memory_map_entry_ext_t *entry;
+	uint64_t end;
+
+	/* same type neighbours are merged, one entry must cover it all */
+	entry = e820_lookup(e820, addr);
+	if ((entry == NULL) || (entry->basic_entry.address_range_type != type)) {
+		return FALSE;
+	}
+
+	end = entry->basic_entry.base_address + entry->basic_entry.length;
+
+	return (size <= end - addr) ? TRUE : FALSE;
+}
+
+#endif
@@ -54,6 +54,8 @@
 #define XMON_LOADER_NO_VALID_AP_WAKEUP_CODE_ADDRESS      0xC008DEAD
 #define XMON_LOADER_FAILED_TO_INIT_PROTOCOL_OPS          0xC00DDEAD
 #define XMON_LOADER_FAILED_TO_INIT_INIT32                0xC00EDEAD
+#define XMON_LOADER_FAILED_TO_DECOMPRESS_STARTAP         0xC00FDEAD
+#define XMON_LOADER_RUNTIME_MEM_TOO_SMALL                0xC010DEAD
 
 #define XMON_FAILED_TO_SETUP_PRIMARY_GUEST_ENV     0xC009DEAD
 #define XMON_FAILED_TO_SETUP_SECONDARY_GUESTS_ENV  0xC00ADEAD
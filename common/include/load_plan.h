@@ -0,0 +1,81 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef __LOAD_PLAN_H
+#define __LOAD_PLAN_H
+
+/*
+ * Load plan of an ELF64 module, computed by xmon_packer and stored in the
+ * file mapping header, so the loader can load the module with a flat
+ * copy/zero loop instead of parsing the ELF headers again.
+ *
+ * All the offsets are from the load address unless noted otherwise, the
+ * loader falls back to the ELF parser if the plan is not valid.
+ */
+#define LOAD_PLAN_MAGIC             0x4E414C50  /* "PLAN" */
+#define LOAD_PLAN_VERSION           1
+#define LOAD_PLAN_MAX_SEGMENTS      6
+
+typedef struct {
+	/* offset in the (decompressed) module file */
+	uint32_t src_offset;
+	uint32_t dst_offset;
+	uint32_t copy_size;
+	/* bytes zeroed right after the copied ones (.bss) */
+	uint32_t zero_size;
+} load_plan_segment_t;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	/* size of this structure */
+	uint16_t size;
+
+	/* memory footprint, and entry point */
+	uint32_t total_size;
+	uint32_t entry_offset;
+
+	/* link address of the load address, the relocation offset is
+	 * the load address minus link_base
+	 */
+	uint64_t link_base;
+
+	/* relocation tables, 0 size if none */
+	uint32_t rela_offset;
+	uint32_t rela_size;
+	uint32_t relr_offset;
+	uint32_t relr_size;
+	uint32_t symtab_offset;
+
+	/* program headers in the loaded image, moved to the load address
+	 * as the ELF loader does
+	 */
+	uint32_t phdr_offset;
+	uint16_t phdr_count;
+
+	uint16_t segment_count;
+	load_plan_segment_t segments[LOAD_PLAN_MAX_SEGMENTS];
+} load_plan_t;
+
+static inline int load_plan_is_valid(const load_plan_t *plan)
+{
+	return (plan != NULL) &&
+	       (plan->magic == LOAD_PLAN_MAGIC) &&
+	       (plan->version == LOAD_PLAN_VERSION) &&
+	       (plan->size == sizeof(load_plan_t)) &&
+	       (plan->segment_count <= LOAD_PLAN_MAX_SEGMENTS);
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef __LOADER_LOG_H
+#define __LOADER_LOG_H
+
+/*
+ * Leveled logging for the starter, xmon_loader and startap.
+ *
+ * A message is printed when its level is not above both
+ * - LOG_LEVEL_MAX, fixed at build time (make log_max=N). Calls above it
+ *   are compiled out, arguments included.
+ * - loader_log.level, set at run time ("loglevel=" in the cmdline).
+ * and its subsystem bit is set in loader_log.mask ("logmask=").
+ *
+ * Each image routes the output to its own sink with loader_log_init(),
+ * nothing is printed until then.
+ *
+ * LOG_EVENT() appends a binary record to the boot trace instead, it is
+ * not filtered and costs a few stores, see boot_trace.h.
+ *
+ * NOTE: uefi_bootloader/preload.c has its own copy of the levels, keep
+ *       them in sync.
+ */
+#include "boot_trace.h"
+
+#define LOG_LEVEL_NONE          0
+#define LOG_LEVEL_ERROR         1
+#define LOG_LEVEL_WARN          2
+#define LOG_LEVEL_INFO          3
+#define LOG_LEVEL_DEBUG         4
+#define LOG_LEVEL_TRACE         5
+
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX           LOG_LEVEL_TRACE
+#endif
+
+/* run time level when the cmdline does not set one */
+#ifdef DEBUG
+#define LOG_LEVEL_DEFAULT       LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL_DEFAULT       LOG_LEVEL_WARN
+#endif
+
+/* subsystems */
+#define LOG_SS_PRELOAD          (1 << 0)
+#define LOG_SS_STARTER          (1 << 1)
+#define LOG_SS_LOADER           (1 << 2)
+#define LOG_SS_ELF              (1 << 3)
+#define LOG_SS_MEMORY           (1 << 4)
+#define LOG_SS_GUEST            (1 << 5)
+#define LOG_SS_STARTAP          (1 << 6)
+#define LOG_SS_ALL              0xFFFFFFFF
+
+typedef void (*loader_log_string_t)(uint8_t *string);
+typedef void (*loader_log_value_t)(uint32_t value);
+
+typedef struct {
+	uint32_t level;
+	uint32_t mask;
+	loader_log_string_t put_string;
+	loader_log_value_t put_value;
+	boot_trace_header_t *trace;
+} loader_log_t;
+
+extern loader_log_t loader_log;
+
+void loader_log_init(uint32_t level, uint32_t mask,
+		     loader_log_string_t put_string,
+		     loader_log_value_t put_value,
+		     boot_trace_header_t *trace);
+void loader_log_string(const char *string);
+void loader_log_value(uint64_t value);
+
+#define LOG_ON(lvl, ss) \
+	(((lvl) <= LOG_LEVEL_MAX) && \
+	 ((lvl) <= loader_log.level) && \
+	 ((loader_log.mask & (ss)) != 0))
+
+#define LOG_STRING(lvl, ss, str) do { \
+	if (LOG_ON(lvl, ss)) { \
+		loader_log_string(str); \
+	} \
+} while (0)
+
+#define LOG_VALUE(lvl, ss, val) do { \
+	if (LOG_ON(lvl, ss)) { \
+		loader_log_value((uint64_t)(val)); \
+	} \
+} while (0)
+
+#define LOG_STRING_VALUE(lvl, ss, str, val) do { \
+	if (LOG_ON(lvl, ss)) { \
+		loader_log_string(str); \
+		loader_log_value((uint64_t)(val)); \
+		loader_log_string("\n"); \
+	} \
+} while (0)
+
+#define LOG_EVENT(event, arg0, arg1, arg2, arg3) \
+	boot_trace_record4(loader_log.trace, event, 0, \
+		(uint64_t)(arg0), (uint64_t)(arg1), \
+		(uint64_t)(arg2), (uint64_t)(arg3))
+
+#endif
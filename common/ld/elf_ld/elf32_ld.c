@@ -68,8 +68,8 @@ elf32_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
 	}
 
 	if (ehdr->e_type != ET_EXEC && ehdr->e_type != ET_DYN) {
-		ELF_PRINT_STRING("ELF file type not executable. Type = 0x");
-		ELF_PRINTLN_VALUE(ehdr->e_type);
+		ELF_PRINT_ERROR("ELF file type not executable. Type = 0x");
+		ELF_PRINTLN_ERROR_VALUE(ehdr->e_type);
 		status = MON_ERROR;
 		goto quit;
 	}
@@ -102,6 +102,7 @@ elf32_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
 		ELF_PRINT_VALUE(memsz);
 		ELF_PRINT_VALUE(memsz - phdr->p_filesz);
 		ELF_PRINT_VALUE(phdr->p_type);
+		ELF_TRACE_SEGMENT(phdr->p_type, addr, memsz, phdr->p_filesz);
 
 		if (PT_LOAD != phdr->p_type || 0 == phdr->p_memsz) {
 			continue;
@@ -115,9 +116,9 @@ elf32_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
 	}
 
 	if (0 != (low_addr & PAGE_4KB_MASK)) {
-		ELF_PRINT_STRING(
+		ELF_PRINT_ERROR(
 			"Failed because kernel low address is not page aligned, low_addr = 0x");
-		ELF_PRINTLN_VALUE(low_addr);
+		ELF_PRINTLN_ERROR_VALUE(low_addr);
 		status = MON_ERROR;
 		goto quit;
 	}
@@ -249,7 +250,7 @@ elf32_load_executable(gen_image_access_t *image, elf_load_info_t *p_info)
 			    (void *)(size_t)(addr + p_info->relocation_offset),
 			    (size_t)phdr->p_offset, (size_t)filesz) != filesz) {
 			status = MON_ERROR;
-			ELF_PRINT_STRING("failed to read segment from file.\n");
+			ELF_PRINT_ERROR("failed to read segment from file.\n");
 			goto quit;
 		}
 
@@ -316,7 +317,7 @@ elf32_do_relocation(gen_image_access_t *image,
 	if (mem_image_map_to_mem
 		    (image, (void **)&dyn_section, (size_t)phdr_dyn->p_offset,
 		    (size_t)dyn_section_sz) != dyn_section_sz) {
-		ELF_PRINT_STRING("failed to read dynamic section from file.\n");
+		ELF_PRINT_ERROR("failed to read dynamic section from file.\n");
 		return MON_ERROR;
 	}
 
@@ -384,9 +385,9 @@ elf32_do_relocation(gen_image_access_t *image,
 			case 0: /* do nothing */
 				break;
 			default:
-				ELF_PRINT_STRING(
+				ELF_PRINT_ERROR(
 					"Unsupported Relocation. rlea.r_info = 0x");
-				ELF_PRINTLN_VALUE(rela[i].r_info & 0xFF);
+				ELF_PRINTLN_ERROR_VALUE(rela[i].r_info & 0xFF);
 				return MON_ERROR;
 			}
 		}
@@ -424,9 +425,9 @@ elf32_do_relocation(gen_image_access_t *image,
 				break;
 
 			default:
-				ELF_PRINT_STRING(
+				ELF_PRINT_ERROR(
 					"Unsupported Relocation, rel.r_info = 0x");
-				ELF_PRINTLN_VALUE(rel[i].r_info & 0xFF);
+				ELF_PRINTLN_ERROR_VALUE(rel[i].r_info & 0xFF);
 				return MON_ERROR;
 			}
 		}
@@ -462,7 +463,7 @@ elf32_copy_section_header_table(gen_image_access_t *image,
 	 * program will not be able to find the section table in any event, and
 	 * abort this copying of the section header table. */
 	if (TRUE != elf32_header_is_valid(ehdr)) {
-		ELF_PRINT_STRING("ELF header not present in target\n");
+		ELF_PRINT_ERROR("ELF header not present in target\n");
 		return MON_ERROR;
 	}
 
@@ -471,7 +472,7 @@ elf32_copy_section_header_table(gen_image_access_t *image,
 	if (mem_image_read
 		    (image, (void *)shdrtab, (size_t)ehdr->e_shoff,
 		    (size_t)section_hdr_tabsiz) != section_hdr_tabsiz) {
-		ELF_PRINT_STRING("failed to copy section header table\n");
+		ELF_PRINT_ERROR("failed to copy section header table\n");
 		return MON_ERROR;
 	}
 
@@ -525,7 +526,7 @@ elf32_copy_sections(gen_image_access_t *image, elf_load_info_t *p_info)
 			    (image, (void *)(size_t)curr_addr,
 			    (size_t)shdr->sh_offset,
 			    (size_t)shdr->sh_size) != shdr->sh_size) {
-			ELF_PRINT_STRING("failed to read section from file\n");
+			ELF_PRINT_ERROR("failed to read section from file\n");
 			return MON_ERROR;
 		}
 		/* update section address */
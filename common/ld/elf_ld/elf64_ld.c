@@ -27,14 +27,44 @@ typedef struct {
 
 #define STINGS_ARE_EQUAL(__s1, __s2) (0 == strcmp(__s1, __s2))
 
+/* packed relative relocations, not known by older elf headers */
+#ifndef DT_RELRSZ
+#define DT_RELRSZ       35
+#endif
+#ifndef DT_RELR
+#define DT_RELR         36
+#endif
+#ifndef DT_RELRENT
+#define DT_RELRENT      37
+#endif
+
+/* number of words covered by one DT_RELR bitmap entry */
+#define RELR_BITMAP_WORDS       (sizeof(elf64_xword_t) * 8 - 1)
+
 void *mon_memset(void *dest, int val, size_t count);
+void *mon_memcpy(void *dest, const void *src, size_t count);
+
+static void elf64_default_copy(void *dest, const void *src, size_t count)
+{
+	mon_memcpy(dest, src, count);
+}
+
+static void elf64_default_zero(void *dest, size_t count)
+{
+	mon_memset(dest, 0, count);
+}
+
+/* see elf64_set_load_plan_mem_ops() */
+static elf64_copy_func_t elf64_plan_copy = elf64_default_copy;
+static elf64_zero_func_t elf64_plan_zero = elf64_default_zero;
 
 /* prototypes of the real elf parsing functions */
 static mon_status_t elf64_copy_sections(gen_image_access_t *image,
 					elf_load_info_t *p_info);
 static mon_status_t elf64_do_relocation(gen_image_access_t *image,
 					elf_load_info_t *p_info,
-					elf64_phdr_t *phdr_dyn);
+					elf64_phdr_t *phdr_dyn,
+					elf64_addr_t prelink_base);
 static mon_status_t elf64_copy_section_header_table(gen_image_access_t *image,
 						    elf_load_info_t *p_info);
 
@@ -70,8 +100,8 @@ elf64_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
 	}
 
 	if (ehdr->e_type != ET_EXEC && ehdr->e_type != ET_DYN) {
-		ELF_PRINT_STRING("ELF file type not executable, type = 0x");
-		ELF_PRINTLN_VALUE(ehdr->e_type);
+		ELF_PRINT_ERROR("ELF file type not executable, type = 0x");
+		ELF_PRINTLN_ERROR_VALUE(ehdr->e_type);
 		status = MON_ERROR;
 		goto quit;
 	}
@@ -102,6 +132,7 @@ elf64_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
 		ELF_PRINT_VALUE(memsz);
 		ELF_PRINT_VALUE(memsz - phdr->p_filesz);
 		ELF_PRINTLN_VALUE(phdr->p_type);
+		ELF_TRACE_SEGMENT(phdr->p_type, addr, memsz, phdr->p_filesz);
 
 		if (PT_LOAD != phdr->p_type || 0 == phdr->p_memsz) {
 			continue;
@@ -115,9 +146,9 @@ elf64_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
 	}
 
 	if (0 != (low_addr & PAGE_4KB_MASK)) {
-		ELF_PRINT_STRING ("failed because kernel low address "
+		ELF_PRINT_ERROR("failed because kernel low address "
 			"not page aligned, low_addr = 0x");
-		ELF_PRINTLN_VALUE(low_addr);
+		ELF_PRINTLN_ERROR_VALUE(low_addr);
 		status = MON_ERROR;
 		goto quit;
 	}
@@ -179,6 +210,8 @@ quit:
  *  PURPOSE   : Load and relocate ELF x86-64 executable to memory
  *  ARGUMENTS : gen_image_access_t *image - describes image to load
  *            : elf_load_info_t *p_info - contains load-related data
+ *            : uint64_t prelink_base - load address the packer
+ *            :     already applied the relocations for, 0 if none
  *  RETURNS   :
  *  NOTES     : Load map (addresses grow from up to bottom)
  *            :        elf header
@@ -187,7 +220,8 @@ quit:
  *            :        loaded sections        (optional)
  */
 mon_status_t
-elf64_load_executable(gen_image_access_t *image, elf_load_info_t *p_info)
+elf64_load_executable(gen_image_access_t *image, elf_load_info_t *p_info,
+		      uint64_t prelink_base)
 {
 	mon_status_t status = MON_OK;
 	elf64_ehdr_t *ehdr;
@@ -257,7 +291,7 @@ elf64_load_executable(gen_image_access_t *image, elf_load_info_t *p_info)
 			    (size_t)phdr->p_offset, (size_t)filesz)
 		    != (size_t)filesz) {
 			status = MON_ERROR;
-			ELF_PRINT_STRING("failed to read segment from file\n");
+			ELF_PRINT_ERROR("failed to read segment from file\n");
 			goto quit;
 		}
 
@@ -283,7 +317,8 @@ elf64_load_executable(gen_image_access_t *image, elf_load_info_t *p_info)
 	}
 
 	if (NULL != phdr_dyn) {
-		status = elf64_do_relocation(image, p_info, phdr_dyn);
+		status = elf64_do_relocation(image, p_info, phdr_dyn,
+			prelink_base);
 		if (MON_OK != status) {
 			goto quit;
 		}
@@ -302,28 +337,177 @@ quit:
 	return status;
 }
 
+/*
+ *  FUNCTION  : elf64_do_relr
+ *  PURPOSE   : Apply DT_RELR packed relative relocations
+ *  ARGUMENTS : relr - RELR table, already relocated to its load address
+ *            : relr_sz - size of the table in bytes
+ *            : relocation_offset - load address minus link address, to
+ *            :                locate the words
+ *            : delta - value added to each word: relocation_offset, or
+ *            :                the distance to prelink_base when the words
+ *            :                were prelinked
+ *  NOTES     : An even entry is the link address of a word to relocate,
+ *            : the next word follows it. An odd entry is a bitmap, bit N
+ *            : (N >= 1) relocates the (N-1)th word after the current one,
+ *            : then the current word moves on by 63 words.
+ */
+static void elf64_do_relr(const elf64_xword_t *relr,
+			  elf64_xword_t relr_sz,
+			  elf64_off_t relocation_offset,
+			  elf64_off_t delta)
+{
+	const elf64_xword_t *relr_end =
+		(const elf64_xword_t *)((const uint8_t *)relr + relr_sz);
+	elf64_addr_t *where = NULL;
+	elf64_addr_t *p;
+	elf64_xword_t bitmap;
+
+	for (; relr < relr_end; ++relr) {
+		if (0 == (*relr & 1)) {
+			where = (elf64_addr_t *)(size_t)(*relr + relocation_offset);
+			*where++ += delta;
+			continue;
+		}
+
+		for (p = where, bitmap = *relr >> 1; bitmap; ++p, bitmap >>= 1) {
+			if (bitmap & 1) {
+				*p += delta;
+			}
+		}
+		where += RELR_BITMAP_WORDS;
+	}
+}
+
+/*
+ *  FUNCTION  : elf64_do_rela
+ *  PURPOSE   : Apply RELA relocations
+ *  ARGUMENTS : rela - RELA table, already relocated to its load address
+ *            : rela_sz - size of the table in bytes
+ *            : symtab - symbol table, already relocated to its load address
+ *            : relocation_offset - load address minus link address
+ */
+static mon_status_t elf64_do_rela(const elf64_rela_t *rela,
+				  elf64_xword_t rela_sz,
+				  const elf64_sym_t *symtab,
+				  elf64_off_t relocation_offset)
+{
+	const elf64_rela_t *rela_end = rela + rela_sz / sizeof(elf64_rela_t);
+
+	while (rela < rela_end) {
+		elf64_addr_t *target_addr;
+		elf64_sword_t symtab_idx;
+
+		/* fast path: the linker sorts R_X86_64_RELATIVE first, and
+		 * they are almost all of the table */
+		while (rela < rela_end &&
+		       R_X86_64_RELATIVE == (rela->r_info & 0xFF)) {
+			*(elf64_addr_t *)(size_t)(rela->r_offset +
+						  relocation_offset) =
+				rela->r_addend + relocation_offset;
+			++rela;
+		}
+		if (rela == rela_end) {
+			break;
+		}
+
+		target_addr = (elf64_addr_t *)(size_t)(rela->r_offset +
+						       relocation_offset);
+
+		switch (rela->r_info & 0xFF) {
+		case R_X86_64_32:
+			*target_addr = rela->r_addend + relocation_offset;
+			symtab_idx = ((const u64_t *)&rela->r_info)->hi;
+			*target_addr += symtab[symtab_idx].st_value;
+			break;
+		case 0:        /* do nothing */
+			break;
+		default:
+			ELF_PRINT_ERROR("Unsupported Relocation 0x");
+			ELF_PRINTLN_ERROR_VALUE(rela->r_info & 0xFF);
+			return MON_ERROR;
+		}
+		++rela;
+	}
+
+	return MON_OK;
+}
+
+/*
+ *  FUNCTION  : elf64_relocate
+ *  PURPOSE   : Apply the RELR and RELA relocations of a loaded image
+ *  ARGUMENTS : start_addr - load address of the image
+ *            : relocation_offset - load address minus link address
+ *            : prelink_base - load address the packer already applied
+ *            :                the relocations for, 0 if none
+ *            : rela, relr, symtab - tables, already relocated to their
+ *            :                load address, NULL if none
+ *  NOTES     : A prelinked image already holds the values for
+ *            : prelink_base: nothing is left to do if it was loaded
+ *            : there. Otherwise RELA entries are simply applied again
+ *            : (they overwrite the target), and RELR entries only add
+ *            : the distance to prelink_base.
+ */
+static mon_status_t elf64_relocate(elf64_addr_t start_addr,
+				   elf64_off_t relocation_offset,
+				   elf64_addr_t prelink_base,
+				   const elf64_rela_t *rela,
+				   elf64_xword_t rela_sz,
+				   const elf64_xword_t *relr,
+				   elf64_xword_t relr_sz,
+				   const elf64_sym_t *symtab)
+{
+	elf64_off_t relr_delta = relocation_offset;
+
+	if (0 != prelink_base) {
+		if (start_addr == prelink_base) {
+			return MON_OK;
+		}
+		relr_delta = start_addr - prelink_base;
+	}
+
+	if (NULL != relr && 0 != relr_sz) {
+		elf64_do_relr(relr, relr_sz, relocation_offset, relr_delta);
+	}
+
+	/* the packer may have moved every relocation to DT_RELR */
+	if (NULL == rela || 0 == rela_sz) {
+		return MON_OK;
+	}
+
+	return elf64_do_rela(rela, rela_sz, symtab, relocation_offset);
+}
+
 mon_status_t
 elf64_do_relocation(gen_image_access_t *image,
-		    elf_load_info_t *p_info, elf64_phdr_t *phdr_dyn)
+		    elf_load_info_t *p_info, elf64_phdr_t *phdr_dyn,
+		    elf64_addr_t prelink_base)
 {
 	elf64_dyn_t *dyn_section;
 	elf64_sword_t dyn_section_sz = (elf64_sword_t)phdr_dyn->p_filesz;
 	elf64_rela_t *rela = NULL;
 	elf64_sword_t rela_sz = 0;
 	elf64_sword_t rela_entsz = 0;
+	elf64_xword_t *relr = NULL;
+	elf64_xword_t relr_sz = 0;
+	elf64_xword_t relr_entsz = 0;
 	elf64_sym_t *symtab = NULL;
 	elf64_sword_t symtab_entsz = 0;
 	elf64_sword_t i;
-	elf64_off_t relocation_offset = p_info->relocation_offset;
+
+	/* nothing to parse if the packer already did it all */
+	if (0 != prelink_base && p_info->start_addr == prelink_base) {
+		return MON_OK;
+	}
 
 	if (mem_image_map_to_mem
 		    (image, (void **)&dyn_section, (size_t)phdr_dyn->p_offset,
 		    (size_t)dyn_section_sz) != dyn_section_sz) {
-		ELF_PRINT_STRING("failed to read dynamic section from file\n");
+		ELF_PRINT_ERROR("failed to read dynamic section from file\n");
 		return MON_ERROR;
 	}
 
-	/* locate rela address, size, entry size */
+	/* locate rela/relr address, size, entry size */
 	for (i = 0; i < dyn_section_sz / sizeof(elf64_dyn_t); ++i) {
 		switch (dyn_section[i].d_tag) {
 		case DT_RELA:
@@ -337,6 +521,17 @@ elf64_do_relocation(gen_image_access_t *image,
 		case DT_RELAENT:
 			rela_entsz = (elf64_sword_t)dyn_section[i].d_un.d_val;
 			break;
+		case DT_RELR:
+			relr =
+				(elf64_xword_t *)(size_t)(dyn_section[i].d_un.d_ptr +
+							  p_info->start_addr);
+			break;
+		case DT_RELRSZ:
+			relr_sz = dyn_section[i].d_un.d_val;
+			break;
+		case DT_RELRENT:
+			relr_entsz = dyn_section[i].d_un.d_val;
+			break;
 		case DT_SYMTAB:
 			symtab =
 				(elf64_sym_t *)(size_t)(dyn_section[i].d_un.d_ptr +
@@ -355,35 +550,97 @@ elf64_do_relocation(gen_image_access_t *image,
 	    || NULL == symtab
 	    || sizeof(elf64_rela_t) != rela_entsz
 	    || sizeof(elf64_sym_t) != symtab_entsz) {
-		ELF_PRINT_STRING("missed mandatory dynamic information\n");
+		ELF_PRINT_ERROR("missed mandatory dynamic information\n");
 		return MON_ERROR;
 	}
 #endif
-	for (i = 0; i < rela_sz / rela_entsz; ++i) {
-		elf64_addr_t *target_addr =
-			(elf64_addr_t *)(size_t)(rela[i].r_offset +
-						 relocation_offset);
-		elf64_sword_t symtab_idx;
 
-		switch (rela[i].r_info & 0xFF) {
-		case R_X86_64_32:
-			*target_addr = rela[i].r_addend + relocation_offset;
-			symtab_idx = ((u64_t *)&rela[i].r_info)->hi;
-			*target_addr += symtab[symtab_idx].st_value;
-			break;
-		case R_X86_64_RELATIVE:
-			*target_addr = rela[i].r_addend + relocation_offset;
-			break;
-		case 0:        /* do nothing */
-			break;
-		default:
-			ELF_PRINT_STRING("Unsupported Relocation 0x");
-			ELF_PRINTLN_VALUE(rela[i].r_info & 0xFF);
+	if (NULL != relr && 0 != relr_sz &&
+	    sizeof(elf64_xword_t) != relr_entsz) {
+		ELF_PRINT_ERROR("unsupported DT_RELRENT\n");
+		return MON_ERROR;
+	}
+	if (NULL != rela && 0 != rela_sz &&
+	    sizeof(elf64_rela_t) != rela_entsz) {
+		ELF_PRINT_ERROR("unsupported DT_RELAENT\n");
+		return MON_ERROR;
+	}
+
+	return elf64_relocate(p_info->start_addr, p_info->relocation_offset,
+		prelink_base, rela, (elf64_xword_t)rela_sz, relr, relr_sz,
+		symtab);
+}
+
+/*
+ *  FUNCTION  : elf64_set_load_plan_mem_ops
+ *  PURPOSE   : Set how elf64_load_plan() copies and zeroes the segments
+ *  ARGUMENTS : elf64_copy_func_t copy - NULL for mon_memcpy()
+ *            : elf64_zero_func_t zero - NULL for mon_memset()
+ *  RETURNS   : void
+ */
+void elf64_set_load_plan_mem_ops(elf64_copy_func_t copy,
+				 elf64_zero_func_t zero)
+{
+	elf64_plan_copy = (copy != NULL) ? copy : elf64_default_copy;
+	elf64_plan_zero = (zero != NULL) ? zero : elf64_default_zero;
+}
+
+/*
+ *  FUNCTION  : elf64_load_plan
+ *  PURPOSE   : Load and relocate an ELF x86-64 executable following the
+ *            : load plan the packer computed for it
+ *  ARGUMENTS : const load_plan_t *plan - valid load plan of the image
+ *            : const uint8_t *file - image file in memory
+ *            : uint8_t *p_dest - where to load, plan->total_size bytes
+ *            : uint64_t prelink_base - see elf64_load_executable()
+ *            : uint64_t *p_entry_point_address - returns the entry point
+ *  RETURNS   : MON_OK if success
+ */
+mon_status_t
+elf64_load_plan(const load_plan_t *plan, const uint8_t *file,
+		uint8_t *p_dest, uint64_t prelink_base,
+		uint64_t *p_entry_point_address)
+{
+	const load_plan_segment_t *seg = plan->segments;
+	const load_plan_segment_t *seg_end = seg + plan->segment_count;
+	elf64_off_t relocation_offset =
+		(elf64_off_t)((uint64_t)(size_t)p_dest - plan->link_base);
+	elf64_phdr_t *phdr;
+	uint16_t i;
+
+	for (; seg < seg_end; ++seg) {
+		if ((uint64_t)seg->dst_offset + seg->copy_size + seg->zero_size >
+		    plan->total_size) {
 			return MON_ERROR;
 		}
+		elf64_plan_copy(p_dest + seg->dst_offset, file + seg->src_offset,
+			seg->copy_size);
+		if (0 != seg->zero_size) {
+			elf64_plan_zero(p_dest + seg->dst_offset + seg->copy_size,
+				seg->zero_size);
+		}
 	}
 
-	return MON_OK;
+	/* update copied segments addresses, as elf64_load_executable() */
+	phdr = (elf64_phdr_t *)(p_dest + plan->phdr_offset);
+	for (i = 0; i < plan->phdr_count; ++i, ++phdr) {
+		if (0 != phdr->p_memsz) {
+			phdr->p_paddr += relocation_offset;
+			phdr->p_vaddr += relocation_offset;
+		}
+	}
+
+	*p_entry_point_address = (uint64_t)(size_t)p_dest + plan->entry_offset;
+
+	return elf64_relocate((elf64_addr_t)(size_t)p_dest, relocation_offset,
+		prelink_base,
+		plan->rela_size ?
+		(const elf64_rela_t *)(p_dest + plan->rela_offset) : NULL,
+		plan->rela_size,
+		plan->relr_size ?
+		(const elf64_xword_t *)(p_dest + plan->relr_offset) : NULL,
+		plan->relr_size,
+		(const elf64_sym_t *)(p_dest + plan->symtab_offset));
 }
 
 /*
@@ -409,7 +666,7 @@ elf64_copy_section_header_table(gen_image_access_t *image,
 	 * program will not be able to find the section table in any event, and
 	 * abort this copying of the section header table. */
 	if (TRUE != elf64_header_is_valid(ehdr)) {
-		ELF_PRINT_STRING("ELF header not present in target\n");
+		ELF_PRINT_ERROR("ELF header not present in target\n");
 		return MON_ERROR;
 	}
 
@@ -417,7 +674,7 @@ elf64_copy_section_header_table(gen_image_access_t *image,
 	 * segments) */
 	if (mem_image_read(image, (void *)shdrtab, (size_t)ehdr->e_shoff,
 		    (size_t)section_hdr_tabsiz) != section_hdr_tabsiz) {
-		ELF_PRINT_STRING("failed to copy section header table\n");
+		ELF_PRINT_ERROR("failed to copy section header table\n");
 		return MON_ERROR;
 	}
 
@@ -470,7 +727,7 @@ elf64_copy_sections(gen_image_access_t *image, elf_load_info_t *p_info)
 			    (image, (void *)(size_t)curr_addr,
 			    (size_t)shdr->sh_offset,
 			    (size_t)shdr->sh_size) != shdr->sh_size) {
-			ELF_PRINT_STRING("failed to read section from file\n");
+			ELF_PRINT_ERROR("failed to read section from file\n");
 			return MON_ERROR;
 		}
 		/* update section address */
@@ -18,10 +18,40 @@
 #define _ELF64_LD_H_
 
 #include "elf_ld.h"
+#include "image_loader.h"
+#include "load_plan.h"
 
 mon_status_t elf64_load_executable(gen_image_access_t *image,
-				   elf_load_info_t *p_info);
+				   elf_load_info_t *p_info,
+				   uint64_t prelink_base);
 mon_status_t elf64_get_load_info(gen_image_access_t *image,
 				 elf_load_info_t *p_info);
 
+mon_status_t elf64_load_plan(const load_plan_t *plan,
+			     const uint8_t *file,
+			     uint8_t *p_dest,
+			     uint64_t prelink_base,
+			     uint64_t *p_entry_point_address);
+
+/* copy and zero used by elf64_load_plan() for the segments, so the loader
+ * can spread them over the cpus. NULL sets back mon_memcpy()/mon_memset() */
+typedef void (*elf64_copy_func_t)(void *dest, const void *src, size_t count);
+typedef void (*elf64_zero_func_t)(void *dest, size_t count);
+
+void elf64_set_load_plan_mem_ops(elf64_copy_func_t copy,
+				 elf64_zero_func_t zero);
+
+/* load_image()/get_image_info() for a module the packer prelinked for
+ * prelink_base and/or computed a load plan for, see elf_ld.c */
+boolean_t load_planned_image(const void *file_mapped_into_memory,
+			     void *image_base_address,
+			     uint32_t allocated_size,
+			     const load_plan_t *plan,
+			     uint64_t prelink_base,
+			     uint64_t *p_entry_point_address);
+image_info_status_t get_planned_image_info(const void *file_mapped_into_memory,
+					   uint32_t allocated_size,
+					   const load_plan_t *plan,
+					   image_info_t *p_image_info);
+
 #endif                          /* _ELF64_LD_H_ */
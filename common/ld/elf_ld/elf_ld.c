@@ -40,7 +40,7 @@ elf_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
 	if (sizeof(elf64_ehdr_t) !=
 	    mem_image_map_to_mem(image, (void **)&p_buffer, 0,
 		    sizeof(elf64_ehdr_t))) {
-		ELF_PRINT_STRING("failed to read file's header\n");
+		ELF_PRINT_ERROR("failed to read file's header\n");
 		return MON_ERROR;
 	}
 
@@ -63,6 +63,8 @@ elf_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
  *  ARGUMENTS : gen_image_access_t *image - describes image to load
  *            : elf_load_info_t *p_info - contains load-related data
  *            : uint8_t    *p_dest    - where to load
+ *            : uint64_t prelink_base - address the packer prelinked
+ *            :                         the image for, 0 if none
  *  RETURNS   :
  *  NOTES     : elf_get_load_info() must be called prior this function
  *            : p_dest assumed is pointing on preallocated memory buffer,
@@ -70,7 +72,8 @@ elf_get_load_info(gen_image_access_t *image, elf_load_info_t *p_info)
  */
 static mon_status_t
 elf_load_executable(gen_image_access_t *image,
-		    elf_load_info_t *p_info, uint8_t *p_dest)
+		    elf_load_info_t *p_info, uint8_t *p_dest,
+		    uint64_t prelink_base)
 {
 	mon_status_t status;
 
@@ -89,7 +92,7 @@ elf_load_executable(gen_image_access_t *image,
 		status = elf32_load_executable(image, p_info);
 		break;
 	case EM_X86_64:
-		status = elf64_load_executable(image, p_info);
+		status = elf64_load_executable(image, p_info, prelink_base);
 		break;
 	default:
 		status = MON_ERROR;
@@ -102,7 +105,9 @@ elf_load_executable(gen_image_access_t *image,
 static boolean_t
 load_elf_image(char *p_image,
 	       char *p_target,
-	       size_t image_size, uint64_t *p_entry_point_address)
+	       size_t image_size,
+	       uint64_t prelink_base,
+	       uint64_t *p_entry_point_address)
 {
 	mon_status_t status;
 	gen_image_access_t *image = NULL;
@@ -120,7 +125,8 @@ load_elf_image(char *p_image,
 			return FALSE;
 		}
 
-		status = elf_load_executable(image, &load_info, p_target);
+		status = elf_load_executable(image, &load_info, p_target,
+			prelink_base);
 		if (MON_OK != status) {
 			print_string("elf_load_executable() failed\n");
 			return FALSE;
@@ -208,5 +214,70 @@ load_image(const void *file_mapped_into_memory,
 {
 	return load_elf_image((char *)file_mapped_into_memory,
 		(char *)image_base_address, (size_t)allocated_size,
-		p_entry_point_address);
+		0, p_entry_point_address);
+}
+
+/*----------------------------------------------------------------------
+ *
+ * get_image_info() for a module the packer computed a load plan for
+ *
+ * The ELF headers are only parsed when plan is NULL or not valid.
+ *---------------------------------------------------------------------- */
+image_info_status_t get_planned_image_info(const void *file_mapped_into_memory,
+					   uint32_t allocated_size,
+					   const load_plan_t *plan,
+					   image_info_t *p_image_info)
+{
+	if (!load_plan_is_valid(plan)) {
+		return get_image_info(file_mapped_into_memory, allocated_size,
+			p_image_info);
+	}
+
+	/* plans are only computed for x86-64 images */
+	p_image_info->load_size = plan->total_size;
+	p_image_info->machine_type = IMAGE_MACHINE_EM64T;
+
+	return IMAGE_INFO_OK;
+}
+
+/*----------------------------------------------------------------------
+ *
+ * load image prepared by the packer into memory
+ *
+ * Same as load_image(), for an image the packer may have
+ * 1) computed a load plan for: the segments are copied/zeroed following
+ *    the plan, the ELF headers are only parsed when plan is NULL or not
+ *    valid.
+ * 2) prelinked for the load address prelink_base: the relocation pass is
+ *    skipped if image_base_address is prelink_base, otherwise only the
+ *    delta is applied. prelink_base 0 means not prelinked.
+ *---------------------------------------------------------------------- */
+boolean_t
+load_planned_image(const void *file_mapped_into_memory,
+		   void *image_base_address,
+		   uint32_t allocated_size,
+		   const load_plan_t *plan,
+		   uint64_t prelink_base,
+		   uint64_t *p_entry_point_address)
+{
+	if (!load_plan_is_valid(plan)) {
+		return load_elf_image((char *)file_mapped_into_memory,
+			(char *)image_base_address, (size_t)allocated_size,
+			prelink_base, p_entry_point_address);
+	}
+
+	if (plan->total_size > allocated_size) {
+		print_string("load plan exceeds the allocated size\n");
+		return FALSE;
+	}
+
+	if (MON_OK != elf64_load_plan(plan,
+			(const uint8_t *)file_mapped_into_memory,
+			(uint8_t *)image_base_address, prelink_base,
+			p_entry_point_address)) {
+		print_string("elf64_load_plan() failed\n");
+		return FALSE;
+	}
+
+	return TRUE;
 }
@@ -21,13 +21,30 @@
 #include "elf32_ld.h"
 #include "elf_info.h"
 #include "image_access_mem.h"
+#include "loader_log.h"
 
-/* Screen print functions do not work on Trails*/
-/* TODO: cleanup the screen print functions to VGA */
+/* per segment dumps, only printed with loglevel=5 */
 #define ELF_CLEAR_SCREEN()
-#define ELF_PRINT_STRING(arg)
-#define ELF_PRINT_VALUE(arg)
-#define ELF_PRINTLN_VALUE(arg)
+#define ELF_PRINT_STRING(arg) \
+	LOG_STRING(LOG_LEVEL_TRACE, LOG_SS_ELF, arg)
+#define ELF_PRINT_VALUE(arg) do { \
+	LOG_VALUE(LOG_LEVEL_TRACE, LOG_SS_ELF, arg); \
+	LOG_STRING(LOG_LEVEL_TRACE, LOG_SS_ELF, " "); \
+} while (0)
+#define ELF_PRINTLN_VALUE(arg) do { \
+	LOG_VALUE(LOG_LEVEL_TRACE, LOG_SS_ELF, arg); \
+	LOG_STRING(LOG_LEVEL_TRACE, LOG_SS_ELF, "\n"); \
+} while (0)
+
+/* binary record of a program header, always on */
+#define ELF_TRACE_SEGMENT(type, addr, memsz, filesz) \
+	LOG_EVENT(BOOT_TRACE_ELF_SEGMENT, type, addr, memsz, filesz)
+
+/* reasons for failing a load */
+#define ELF_PRINT_ERROR(arg) \
+	LOG_STRING(LOG_LEVEL_ERROR, LOG_SS_ELF, arg)
+#define ELF_PRINTLN_ERROR_VALUE(arg) \
+	LOG_STRING_VALUE(LOG_LEVEL_ERROR, LOG_SS_ELF, "", arg)
 
 #define UINT16_TO_UINT64(x) (((uint64_t)(x)) & 0x000000000000FFFF)
 
@@ -14,32 +14,237 @@
 * limitations under the License.
 *******************************************************************************/
 #include "common_types.h"
-void *mon_memset(void *dest, uint8_t val, uint64_t count)
+
+/*
+ * Memory primitives shared by the starter, xmon_loader and startap.
+ *
+ * The string instructions are dispatched on the CPUID leaf 7 features:
+ * - FSRM (fast short rep movsb): rep movsb is the best choice for any
+ *   size, including short copies.
+ * - ERMS (enhanced rep movsb/stosb): rep movsb/stosb is the best choice
+ *   once the startup cost is amortized.
+ * Otherwise the bulk is moved with rep movsq/stosq to an 8 bytes aligned
+ * destination, and the unaligned head and tail are covered with single
+ * (possibly overlapping) 64-bit accesses.
+ *
+ * Fills of several MB (the loader zeroes the runtime image and its heap)
+ * are done with non-temporal stores, so they do not flush the cache.
+ *
+ * NOTE: mon_memcpy() does not support overlapping buffers.
+ */
+#define MEM_FEATURE_DETECTED    0x1
+#define MEM_FEATURE_ERMS        0x2
+#define MEM_FEATURE_FSRM        0x4
+
+#define CPUID_7_EBX_ERMS        (1 << 9)
+#define CPUID_7_EDX_FSRM        (1 << 4)
+
+/* below this, rep movsb/stosb do not pay off even with ERMS */
+#define MEM_ERMS_THRESHOLD      256
+#define MEM_NT_THRESHOLD        (2 * 1024 * 1024)
+
+typedef uint64_t __attribute__((__may_alias__, aligned(1))) mem_u64_t;
+typedef uint32_t __attribute__((__may_alias__, aligned(1))) mem_u32_t;
+typedef uint16_t __attribute__((__may_alias__, aligned(1))) mem_u16_t;
+
+static uint32_t mem_features;
+
+static uint32_t mem_get_features(void)
 {
-	__asm__ __volatile__ (
-		"mov %0, %%rdi\n"
-		"movb %1, %%al\n"
-		"mov %2, %%rcx\n"
-		"cld; rep; stosb"
+	uint32_t eax, ebx, ecx, edx;
+	uint32_t features = MEM_FEATURE_DETECTED;
+
+	if (mem_features & MEM_FEATURE_DETECTED) {
+		return mem_features;
+	}
+
+	__asm__ __volatile__ ("cpuid"
+		: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		: "a" (0), "c" (0));
+
+	if (eax >= 7) {
+		__asm__ __volatile__ ("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (7), "c" (0));
+
+		if (ebx & CPUID_7_EBX_ERMS) {
+			features |= MEM_FEATURE_ERMS;
+		}
+		if (edx & CPUID_7_EDX_FSRM) {
+			features |= MEM_FEATURE_FSRM;
+		}
+	}
+
+	mem_features = features;
+
+	return features;
+}
+
+static inline void mem_rep_stosb(uint8_t *d, uint8_t val, uint64_t count)
+{
+	__asm__ __volatile__ ("cld; rep; stosb"
+		: "+D" (d), "+c" (count)
+		: "a" (val)
+		: "memory");
+}
+
+static inline void mem_rep_stosq(uint8_t *d, uint64_t val, uint64_t qwords)
+{
+	__asm__ __volatile__ ("cld; rep; stosq"
+		: "+D" (d), "+c" (qwords)
+		: "a" (val)
+		: "memory");
+}
+
+static inline void mem_rep_movsb(uint8_t *d, const uint8_t *s, uint64_t count)
+{
+	__asm__ __volatile__ ("cld; rep; movsb"
+		: "+D" (d), "+S" (s), "+c" (count)
 		:
-		: "g" (dest), "g" (val), "g" (count)
-		: "rdi", "rax", "rcx", "memory"
-		);
+		: "memory");
+}
+
+static inline void mem_rep_movsq(uint8_t *d, const uint8_t *s, uint64_t qwords)
+{
+	__asm__ __volatile__ ("cld; rep; movsq"
+		: "+D" (d), "+S" (s), "+c" (qwords)
+		:
+		: "memory");
+}
+
+/* 64 bytes (one cache line) per iteration, d must be 64 bytes aligned */
+static inline void mem_nt_fill(uint8_t *d, uint64_t val, uint64_t lines)
+{
+	__asm__ __volatile__ (
+		"1:\n"
+		"movnti %2, 0(%0)\n"
+		"movnti %2, 8(%0)\n"
+		"movnti %2, 16(%0)\n"
+		"movnti %2, 24(%0)\n"
+		"movnti %2, 32(%0)\n"
+		"movnti %2, 40(%0)\n"
+		"movnti %2, 48(%0)\n"
+		"movnti %2, 56(%0)\n"
+		"add $64, %0\n"
+		"dec %1\n"
+		"jnz 1b\n"
+		"sfence"
+		: "+r" (d), "+r" (lines)
+		: "r" (val)
+		: "cc", "memory");
+}
+
+/* count <= 16 */
+static inline void mem_set_small(uint8_t *d, uint64_t val, uint64_t count)
+{
+	if (count >= 8) {
+		*(mem_u64_t *)d = val;
+		*(mem_u64_t *)(d + count - 8) = val;
+	} else if (count >= 4) {
+		*(mem_u32_t *)d = (uint32_t)val;
+		*(mem_u32_t *)(d + count - 4) = (uint32_t)val;
+	} else if (count >= 2) {
+		*(mem_u16_t *)d = (uint16_t)val;
+		*(mem_u16_t *)(d + count - 2) = (uint16_t)val;
+	} else if (count == 1) {
+		*d = (uint8_t)val;
+	}
+}
+
+/* count <= 16 */
+static inline void mem_copy_small(uint8_t *d, const uint8_t *s, uint64_t count)
+{
+	if (count >= 8) {
+		uint64_t head = *(const mem_u64_t *)s;
+		uint64_t tail = *(const mem_u64_t *)(s + count - 8);
+
+		*(mem_u64_t *)d = head;
+		*(mem_u64_t *)(d + count - 8) = tail;
+	} else if (count >= 4) {
+		uint32_t head = *(const mem_u32_t *)s;
+		uint32_t tail = *(const mem_u32_t *)(s + count - 4);
+
+		*(mem_u32_t *)d = head;
+		*(mem_u32_t *)(d + count - 4) = tail;
+	} else if (count >= 2) {
+		uint16_t head = *(const mem_u16_t *)s;
+		uint16_t tail = *(const mem_u16_t *)(s + count - 2);
+
+		*(mem_u16_t *)d = head;
+		*(mem_u16_t *)(d + count - 2) = tail;
+	} else if (count == 1) {
+		*d = *s;
+	}
+}
+
+void *mon_memset(void *dest, uint8_t val, uint64_t count)
+{
+	uint8_t *d = (uint8_t *)dest;
+	uint64_t val64 = val * 0x0101010101010101ULL;
+	uint64_t head;
+
+	if (count <= 16) {
+		mem_set_small(d, val64, count);
+		return dest;
+	}
+
+	/* the unaligned head is covered by one 64-bit store */
+	*(mem_u64_t *)d = val64;
+	*(mem_u64_t *)(d + count - 8) = val64;
+
+	if (count >= MEM_NT_THRESHOLD) {
+		head = 64 - ((uint64_t)d & 63);
+		mem_rep_stosq(d + (head & 7), val64, head >> 3);
+		d += head;
+		count -= head;
+		mem_nt_fill(d, val64, count >> 6);
+		d += count & ~63ULL;
+		count &= 63;
+		/* the last partial qword was stored above */
+		mem_rep_stosq(d, val64, count >> 3);
+		return dest;
+	}
+
+	if ((mem_get_features() & MEM_FEATURE_ERMS) &&
+	    (count >= MEM_ERMS_THRESHOLD)) {
+		mem_rep_stosb(d, val, count);
+		return dest;
+	}
+
+	head = 8 - ((uint64_t)d & 7);
+	mem_rep_stosq(d + head, val64, (count - head) >> 3);
 
 	return dest;
 }
 
 void *mon_memcpy(void *dest, const void *src, uint64_t count)
 {
-	__asm__ __volatile__ (
-		"mov %0, %%rdi\n"
-		"mov %1, %%rsi\n"
-		"mov %2, %%rcx\n"
-		"cld; rep; movsb"
-		:
-		: "g" (dest), "g" (src), "g" (count)
-		: "rdi", "rsi", "rcx", "memory"
-		);
+	uint8_t *d = (uint8_t *)dest;
+	const uint8_t *s = (const uint8_t *)src;
+	uint32_t features = mem_get_features();
+	uint64_t head;
+
+	if (features & MEM_FEATURE_FSRM) {
+		mem_rep_movsb(d, s, count);
+		return dest;
+	}
+
+	if (count <= 16) {
+		mem_copy_small(d, s, count);
+		return dest;
+	}
+
+	if ((features & MEM_FEATURE_ERMS) && (count >= MEM_ERMS_THRESHOLD)) {
+		mem_rep_movsb(d, s, count);
+		return dest;
+	}
+
+	/* unaligned head and tail are covered by one 64-bit access each */
+	*(mem_u64_t *)d = *(const mem_u64_t *)s;
+	*(mem_u64_t *)(d + count - 8) = *(const mem_u64_t *)(s + count - 8);
+
+	head = 8 - ((uint64_t)d & 7);
+	mem_rep_movsq(d + head, s + head, (count - head) >> 3);
 
 	return dest;
 }
@@ -0,0 +1,59 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include "common_types.h"
+#include "loader_log.h"
+
+loader_log_t loader_log = {
+	LOG_LEVEL_DEFAULT,
+	LOG_SS_ALL,
+	NULL,
+	NULL,
+	NULL
+};
+
+void loader_log_init(uint32_t level, uint32_t mask,
+		     loader_log_string_t put_string,
+		     loader_log_value_t put_value,
+		     boot_trace_header_t *trace)
+{
+	if (level > LOG_LEVEL_TRACE) {
+		level = LOG_LEVEL_TRACE;
+	}
+
+	loader_log.level = level;
+	loader_log.mask = mask;
+	loader_log.put_string = put_string;
+	loader_log.put_value = put_value;
+	loader_log.trace = trace;
+}
+
+void loader_log_string(const char *string)
+{
+	if (loader_log.put_string) {
+		loader_log.put_string((uint8_t *)string);
+	}
+}
+
+void loader_log_value(uint64_t value)
+{
+	if (loader_log.put_value) {
+		/* the sinks print 32 bits, the high dword only when set */
+		if (value >> 32) {
+			loader_log.put_value((uint32_t)(value >> 32));
+		}
+		loader_log.put_value((uint32_t)value);
+	}
+}
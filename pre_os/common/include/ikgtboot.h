@@ -21,7 +21,7 @@
 #define RT_MEM_BASE                   0x12C00000 /*Hardcoded address for runtime address:300 MB*/
 #define LDR_MEM_BASE                  0x10000000 /*Hardcoded address for load address:256 MB*/
 #define SCAN_MAX_IMAGE_SIZE           0x100000   /*Scan Max image size assumed to be 1 MB*/
-#define BOOT_HDR_VERSION              1
+#define BOOT_HDR_VERSION              3
 #define IKGT_BOOTLOADER_MAGIC         0x4857b815
 #define FLASH_PAGE_SIZE_EFI           2048 /*page size for flashing blocks for flashing images */
 #define __KERNEL_32_CS                0x10
@@ -36,8 +36,9 @@
  *  to load EVMM.
  *  NOTE:
  *  1. The header address is 8-byte aligned in starter.
- *  2. Boot loader, EFI loader or kernelflinger  searches
- *     this header with a 64bit magic value.
+ *  2. The header is placed at offset 0 of the image package, so boot
+ *     loaders check the magic there first. Searching the package for
+ *     the 64bit magic value is only needed for legacy images.
  *  3. CONST - the field is populated by packer or during compilation.
  *  4. Boot loader should copy the whole image package to the
  *     address of ldr_mem_base, and then call into
@@ -58,13 +59,20 @@ typedef struct {
     /* 64bit entry offset */
     CONST uint32_t entry64_offset;
 
+    /* offset of xmon_loaderbin_file_mapping_header_t from the beginning
+     * of the image package, 0 for legacy images (BOOT_HDR_VERSION 1)
+     * where the header has to be searched with its magic values.
+     */
+    CONST uint32_t file_map_hdr_offset;
+
     /* No longer being used, reserved to be cleaned out */
-    CONST uint32_t reserved2;
     CONST uint32_t reserved3;
 
     /* boot loader will allocate it with this size,
     and populate rt_mem_base (make sure it < 4G),
-    the rt_mem_size is sizeof(xmon_runtime_memory_layout_t)
+    the rt_mem_size is the size with the default xmon area size
+    (XMON_RT_DEFAULT_SIZE). Boot loaders that size the xmon area
+    (BOOT_HDR_VERSION 3) allocate rt_xmon_offset + the xmon area size.
     */
     CONST uint32_t rt_mem_base;
     CONST uint32_t rt_mem_size;
@@ -79,6 +87,31 @@ typedef struct {
     /* size of image package after 0-padding to 4k aligned */
     CONST uint32_t image_size;
 
+    /* BOOT_HDR_VERSION 3 fields below */
+
+    /* offsets of the startap, secondary guest and xmon areas in the
+    runtime memory, the xmon area is the last one.
+    */
+    CONST uint32_t rt_startap_offset;
+    CONST uint32_t rt_sguest_offset;
+    CONST uint32_t rt_xmon_offset;
+
+    /* xmon area sizing, the boot loader allocates
+      xmon_image_size + xmon_fixed_size + cpus * xmon_per_cpu_size
+      + GBs of physical memory * (xmon_per_gb_size +
+                                  xmon_view_count * xmon_per_view_gb_size)
+    up to xmon_max_size, see XMON_SIZE_xxx in xmon_desc.h.
+    xmon_image_size is 0 if the packer does not know it, the boot
+    loader allocates rt_mem_size then.
+    */
+    CONST uint32_t xmon_image_size;
+    CONST uint32_t xmon_fixed_size;
+    CONST uint32_t xmon_per_cpu_size;
+    CONST uint32_t xmon_per_gb_size;
+    CONST uint32_t xmon_per_view_gb_size;
+    CONST uint32_t xmon_view_count;
+    CONST uint32_t xmon_max_size;
+
 } ikgt_loader_boot_header_t;
 
 /*   Platform info structure to store the EFI memory map and any future platform info
@@ -93,8 +126,34 @@ typedef struct {
     uint32_t   load_addr;
     /* Address of allocated runtime memory region */
     uint32_t   run_addr;
+    /* Address of the boot trace buffer (boot_trace_header_t), 0 if none */
+    uint32_t   trace_addr;
+    /* Size of allocated runtime memory region */
+    uint32_t   run_size;
+    /* EFI memory map descriptor size and version, as returned by
+     * GetMemoryMap(), 0 if unknown */
+    uint32_t   memmap_desc_size;
+    uint32_t   memmap_desc_version;
+    /* consoles usable by the loaders, IKGT_CONSOLE_xxx */
+    uint32_t   console_flags;
+    /* GOP framebuffer, valid with IKGT_CONSOLE_GOP: 32 bits per pixel */
+    uint32_t   fb_pixels_per_line;
+    uint64_t   fb_base;
+    uint32_t   fb_width;
+    uint32_t   fb_height;
+    /* local APIC IDs (uint32_t) of the enabled cpus listed by the ACPI
+     * MADT, the BSP included, 0 if unknown */
+    uint64_t   cpu_ids_addr;
+    uint32_t   cpu_count;
+    /* ACPI PM timer I/O port from the FADT, and its width, 24 or 32 bits.
+     * 0 if none */
+    uint32_t   pm_timer_port;
+    uint32_t   pm_timer_bits;
 } ikgt_platform_info_t;
 
+#define IKGT_CONSOLE_VGA_TEXT   0x1     /* legacy text buffer at 0xB8000 */
+#define IKGT_CONSOLE_GOP        0x2
+
 
 #undef CONST
 #undef IN
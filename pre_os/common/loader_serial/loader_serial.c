@@ -16,6 +16,7 @@
 
 
 #include "mon_defs.h"
+#include "loader_serial.h"
 
 #define UART_REGISTER_THR 0     /* WO Transmit Holding Register */
 #define UART_REGISTER_RBR 0     /* RO Receive Buffer Register */
@@ -32,7 +33,31 @@
 
 #define PACKED  __attribute((packed))
 
-static uint16_t debug_port;
+/* 1.8432MHz reference clock of the legacy 16550, divided by 16 */
+#define UART_CLOCK_HZ           1843200
+/* usual input clock of PCI/LPSS mmio uarts, gives up to 3Mbaud */
+#define UART_MMIO_CLOCK_HZ      48000000
+#define UART_DEFAULT_BAUD       115200
+
+/* IIR[7:6] reads 11b when the fifos are enabled (16550A and later) */
+#define UART_IIR_FIFO_MASK      0xC0
+#define UART_FIFO_DEPTH         16
+
+/*
+ * Transmit ring. Characters are queued here and pushed out in fifo sized
+ * bursts whenever the transmitter is found empty, so callers only wait
+ * for the wire when the ring is full or on loader_serial_flush().
+ * Must be a power of 2.
+ */
+#define TX_RING_SIZE            1024
+#define TX_RING_MASK            (TX_RING_SIZE - 1)
+
+/* active port, base 0 means no serial output */
+static loader_serial_config_t uart;
+static uint32_t tx_fifo_depth;
+static uint32_t tx_head;        /* next slot to fill */
+static uint32_t tx_tail;        /* next slot to send */
+static char tx_ring[TX_RING_SIZE];
 
 typedef struct {
 	unsigned int ravie:1;
@@ -128,19 +153,84 @@ uint8_t hw_read_port_8(uint16_t port)
 	return val8;
 }
 
+static uint8_t uart_read(uint32_t reg)
+{
+	uint64_t addr;
+
+	if (uart.type == LOADER_SERIAL_IO) {
+		return hw_read_port_8((uint16_t)(uart.base + reg));
+	}
+
+	addr = uart.base + ((uint64_t)reg << uart.reg_shift);
+	if (uart.type == LOADER_SERIAL_MMIO32) {
+		return (uint8_t)*(volatile uint32_t *)addr;
+	}
+
+	return *(volatile uint8_t *)addr;
+}
+
+static void uart_write(uint32_t reg, uint8_t val8)
+{
+	uint64_t addr;
+
+	if (uart.type == LOADER_SERIAL_IO) {
+		hw_write_port_8((uint16_t)(uart.base + reg), val8);
+		return;
+	}
+
+	addr = uart.base + ((uint64_t)reg << uart.reg_shift);
+	if (uart.type == LOADER_SERIAL_MMIO32) {
+		*(volatile uint32_t *)addr = val8;
+	} else {
+		*(volatile uint8_t *)addr = val8;
+	}
+}
 
-void loader_serial_init(uint16_t io_base)
+void loader_serial_init(const loader_serial_config_t *cfg)
 {
 	uart_ier_t ier;
 	uart_fcr_t fcr;
 	uart_lcr_t lcr;
 	uart_mcr_t mcr;
+	uint32_t divisor;
+
+	if ((cfg == NULL) || (cfg->base == 0)) {
+		return;
+	}
 
-	if (!io_base) {
+	uart = *cfg;
+	tx_head = 0;
+	tx_tail = 0;
+
+	switch (uart.type) {
+	case LOADER_SERIAL_IO:
+		uart.reg_shift = 0;
+		break;
+	case LOADER_SERIAL_MMIO8:
+		break;
+	case LOADER_SERIAL_MMIO32:
+		if (uart.reg_shift < 2) {
+			uart.reg_shift = 2;
+		}
+		break;
+	default:
+		uart.base = 0;
 		return;
 	}
 
-	debug_port = io_base;
+	if (uart.baud == 0) {
+		uart.baud = UART_DEFAULT_BAUD;
+	}
+	if (uart.clock == 0) {
+		uart.clock = (uart.type == LOADER_SERIAL_IO) ?
+			     UART_CLOCK_HZ : UART_MMIO_CLOCK_HZ;
+	}
+	divisor = (uart.clock + 8 * uart.baud) / (16 * uart.baud);
+	if (divisor == 0) {
+		divisor = 1;
+	} else if (divisor > 0xFFFF) {
+		divisor = 0xFFFF;
+	}
 
 	/* mcr: reset dtr, rts, out1, out2 & loop */
 
@@ -150,7 +240,7 @@ void loader_serial_init(uint16_t io_base)
 	mcr.bits.out2 = 0;
 	mcr.bits.lme = 0;
 	mcr.bits.reserved = 0;
-	hw_write_port_8(debug_port + UART_REGISTER_MCR, mcr.data);
+	uart_write(UART_REGISTER_MCR, mcr.data);
 
 	/* lcr: reset dlab */
 
@@ -161,7 +251,7 @@ void loader_serial_init(uint16_t io_base)
 	lcr.bits.sticpar = 0;           /* n/a */
 	lcr.bits.brcon = 0;             /* no break */
 	lcr.bits.dlab = 0;
-	hw_write_port_8(debug_port + UART_REGISTER_LCR, lcr.data);
+	uart_write(UART_REGISTER_LCR, lcr.data);
 
 	/* ier: disable interrupts */
 
@@ -170,7 +260,7 @@ void loader_serial_init(uint16_t io_base)
 	ier.bits.rie = 0;
 	ier.bits.mie = 0;
 	ier.bits.reserved = 0;
-	hw_write_port_8(debug_port + UART_REGISTER_IER, ier.data);
+	uart_write(UART_REGISTER_IER, ier.data);
 
 	/* fcr: disable fifos */
 
@@ -180,55 +270,93 @@ void loader_serial_init(uint16_t io_base)
 	fcr.bits.dms = 0;
 	fcr.bits.reserved = 0;
 	fcr.bits.rtb = 0;
-	hw_write_port_8(debug_port + UART_REGISTER_FCR, fcr.data);
+	uart_write(UART_REGISTER_FCR, fcr.data);
 
 	/* scr: scratch register */
 
-	hw_write_port_8(debug_port + UART_REGISTER_SCR, 0x00);
+	uart_write(UART_REGISTER_SCR, 0x00);
 
 	/* lcr: set dlab */
 
 	lcr.bits.dlab = 1;
-	hw_write_port_8(debug_port + UART_REGISTER_LCR, lcr.data);
+	uart_write(UART_REGISTER_LCR, lcr.data);
 
-	/* dll & dlm: divisor value 1 for 115200 baud */
+	/* dll & dlm: divisor for the requested baud rate */
 
-	hw_write_port_8(debug_port + UART_REGISTER_DLL, 0x01);
-	hw_write_port_8(debug_port + UART_REGISTER_DLM, 0x00);
+	uart_write(UART_REGISTER_DLL, (uint8_t)divisor);
+	uart_write(UART_REGISTER_DLM, (uint8_t)(divisor >> 8));
 
 	/* lcr: reset dlab */
 
 	lcr.bits.dlab = 0;
-	hw_write_port_8(debug_port + UART_REGISTER_LCR, lcr.data);
+	uart_write(UART_REGISTER_LCR, lcr.data);
 
 	/* fcr: enable and reset rx & tx fifos */
 
 	fcr.bits.trfifoe = 1;
 	fcr.bits.resetrf = 1;
 	fcr.bits.resettf = 1;
-	hw_write_port_8(debug_port + UART_REGISTER_FCR, fcr.data);
+	uart_write(UART_REGISTER_FCR, fcr.data);
+
+	/* without a working fifo only one byte fits per THRE */
+	if ((uart_read(UART_REGISTER_IIR) &
+	     UART_IIR_FIFO_MASK) == UART_IIR_FIFO_MASK) {
+		tx_fifo_depth = UART_FIFO_DEPTH;
+	} else {
+		tx_fifo_depth = 1;
+	}
 
 	/* mcr: set dtr, rts */
 
 	mcr.bits.dtrc = 1;
 	mcr.bits.rts = 1;
-	hw_write_port_8(debug_port + UART_REGISTER_MCR, mcr.data);
+	uart_write(UART_REGISTER_MCR, mcr.data);
 }
 
 
-char                                    /* ret: character that was sent */
-loader_serial_putc(char c)              /* in:  character to send */
+/*
+ * Push at most one fifo worth of queued characters if the transmitter is
+ * empty. Never waits.
+ */
+static void tx_drain_burst(void)
 {
 	uart_lsr_t lsr;
+	uint32_t n;
 
-	if (!debug_port)
-		return (char)0;
+	if (tx_head == tx_tail) {
+		return;
+	}
 
-	hw_write_port_8(debug_port + UART_REGISTER_THR, c);
+	lsr.data = uart_read(UART_REGISTER_LSR);
+	if (lsr.bits.thre != 1) {
+		return;
+	}
 
-	do
-		lsr.data = hw_read_port_8(debug_port + UART_REGISTER_LSR);
-	while (lsr.bits.thre != 1);
+	/* THRE set means the whole tx fifo is empty */
+	for (n = 0; (n < tx_fifo_depth) && (tx_tail != tx_head); n++) {
+		uart_write(UART_REGISTER_THR, tx_ring[tx_tail & TX_RING_MASK]);
+		tx_tail++;
+	}
+}
+
+static void tx_enqueue(char c)
+{
+	/* ring full, wait for the uart to make room */
+	while ((tx_head - tx_tail) >= TX_RING_SIZE)
+		tx_drain_burst();
+
+	tx_ring[tx_head & TX_RING_MASK] = c;
+	tx_head++;
+}
+
+char                                    /* ret: character that was sent */
+loader_serial_putc(char c)              /* in:  character to send */
+{
+	if (!uart.base)
+		return (char)0;
+
+	tx_enqueue(c);
+	tx_drain_burst();
 
 	return c;
 }
@@ -237,11 +365,38 @@ void loader_serial_puts(char *s)
 {
 	unsigned int i;
 
-	if (!debug_port)
+	if (!uart.base)
 		return;
 
 	for (i = 0; s[i] != 0; i++)
-		loader_serial_putc(s[i]);
+		tx_enqueue(s[i]);
+
+	tx_drain_burst();
+}
+
+int loader_serial_active(void)
+{
+	return uart.base != 0;
+}
+
+/*
+ * Send everything still queued and wait until it has left the uart.
+ * Must be called before control leaves the loader, the ring is lost
+ * afterwards.
+ */
+void loader_serial_flush(void)
+{
+	uart_lsr_t lsr;
+
+	if (!uart.base)
+		return;
+
+	while (tx_head != tx_tail)
+		tx_drain_burst();
+
+	do
+		lsr.data = uart_read(UART_REGISTER_LSR);
+	while (lsr.bits.temt != 1);
 }
 
 static char convert_to_hex_char(char c)
@@ -261,7 +416,7 @@ void loader_serial_put_hex(unsigned int hex, int need_prefix)
 	int i;
 	int highest_valid_bit = 0;
 
-	if (!debug_port)
+	if (!uart.base)
 		return;
 
 	for (i = 0; i < 8; i++) {
@@ -280,5 +435,7 @@ void loader_serial_put_hex(unsigned int hex, int need_prefix)
 	}
 
 	for (i = highest_valid_bit; i >= 0; i--)
-		loader_serial_putc(ch[i]);
+		tx_enqueue(ch[i]);
+
+	tx_drain_burst();
 }
@@ -17,10 +17,25 @@
 #ifndef __LOADER_SERIAL_H__
 #define __LOADER_SERIAL_H__
 
-void loader_serial_init(uint16_t io_base);
+/* how the 16550 compatible registers are reached */
+#define LOADER_SERIAL_IO        0       /* legacy port i/o */
+#define LOADER_SERIAL_MMIO8     1       /* mmio, byte accesses */
+#define LOADER_SERIAL_MMIO32    2       /* mmio, 32-bit accesses */
+
+typedef struct {
+	uint64_t base;          /* io port or mmio address, 0: no output */
+	uint32_t type;          /* LOADER_SERIAL_xxx */
+	uint32_t reg_shift;     /* register stride is (1 << reg_shift) */
+	uint32_t clock;         /* uart input clock in Hz, 0: default */
+	uint32_t baud;          /* 0: 115200 */
+} loader_serial_config_t;
+
+void loader_serial_init(const loader_serial_config_t *cfg);
 void loader_serial_put_hex(unsigned int hex, int need_prefix);
 void loader_serial_puts(char *s);
 char loader_serial_putc(char  c);
+void loader_serial_flush(void);
+int loader_serial_active(void);
 
 
 #endif  /* LOADER_SERIAL_H */
@@ -17,8 +17,10 @@
 #include "mon_defs.h"
 #include "mon_arch_defs.h"
 #include "image_loader.h"
+#include "elf64_ld.h"
 #include "xmon_desc.h"
 #include "error_code.h"
+#include "boot_trace.h"
 static uint64_t get_xmon_loader_img_base(xmon_desc_t *xmon_desc)
 {
 	xmon_loader_memory_layout_t *ldr_mem;
@@ -42,8 +44,9 @@ int run_xmon_loader(xmon_desc_t *xd)
 		return STARTER_INVALID_XMON_LOADER_BIN_ADDR;
 	}
 
-	image_info_status = get_image_info(img,
+	image_info_status = get_planned_image_info(img,
 		xd->xmon_loader_file.size,
+		(const load_plan_t *)xd->xmon_loader_file.plan_addr,
 		&img_info);
 
 	if ((image_info_status != IMAGE_INFO_OK) ||
@@ -53,15 +56,20 @@ int run_xmon_loader(xmon_desc_t *xd)
 		return STARTER_FAILED_TO_GET_XMON_LOADER_IMG_INFO;
 	}
 
-	ok = load_image((void *)img,
+	ok = load_planned_image((void *)img,
 		(void *)get_xmon_loader_img_base(xd),
 		img_info.load_size,
+		(const load_plan_t *)xd->xmon_loader_file.plan_addr,
+		xd->xmon_loader_file.prelink_base,
 		(uint64_t *)&xmon_loader);
 
 	if (!ok) {
 		return STARTER_FAILED_TO_RELOCATE_XMON_LOADER;
 	}
 
+	boot_trace_record(boot_trace_get(xd->boot_trace_addr),
+		BOOT_TRACE_STARTER_LOADER_RELOCATED, 0, img_info.load_size);
+
 	return xmon_loader(xd);
 }
 
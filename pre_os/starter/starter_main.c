@@ -21,6 +21,7 @@
 #include "xmon_desc.h"
 #include "common.h"
 #include "ikgtboot.h"
+#include "boot_trace.h"
 int run_xmon_loader(xmon_desc_t *td);
 
 extern void __cpuid(uint64_t cpu_info[4], uint64_t info_type);
@@ -78,11 +79,34 @@ __attribute__ ((aligned(4))) = {
 };
 
 
+static boolean_t file_offsets_header_is_valid(xmon_loaderbin_file_mapping_header_t *hdr)
+{
+	return (hdr->magic0 == XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC0) &&
+	       (hdr->magic1 == XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC1);
+}
+
 static xmon_loaderbin_file_mapping_header_t* get_file_offsets_header(uint32_t start_addr, uint32_t size)
 {
 	/* search the magic file offset header */
 	uint32_t *tmpbuf, *starter_img_base;
 	xmon_loaderbin_file_mapping_header_t *tmp_hdr;
+	ikgt_loader_boot_header_t *boot_hdr;
+
+	/* the boot header at offset 0 tells where the file offset header is */
+	boot_hdr = (ikgt_loader_boot_header_t *)(uint64_t)start_addr;
+	if ((boot_hdr->magic == IKGT_BOOT_HEADER_MAGIC) &&
+	    (boot_hdr->size >= OFFSET_OF(ikgt_loader_boot_header_t, file_map_hdr_offset) +
+			sizeof(boot_hdr->file_map_hdr_offset)) &&
+	    boot_hdr->file_map_hdr_offset &&
+	    (boot_hdr->file_map_hdr_offset <=
+			size - sizeof(xmon_loaderbin_file_mapping_header_t))) {
+		tmp_hdr = (xmon_loaderbin_file_mapping_header_t *)
+			((uint64_t)start_addr + boot_hdr->file_map_hdr_offset);
+		if (file_offsets_header_is_valid(tmp_hdr))
+			return tmp_hdr;
+	}
+
+	/* legacy image, fall back to scanning */
 	starter_img_base = (uint32_t *)(uint64_t)start_addr;
 	for (tmpbuf = starter_img_base;
 		 (uint64_t)tmpbuf < ((uint64_t)starter_img_base + size - 4);
@@ -90,10 +114,7 @@ static xmon_loaderbin_file_mapping_header_t* get_file_offsets_header(uint32_t st
 			/* 4 byte aligned searching */
 			tmp_hdr = (xmon_loaderbin_file_mapping_header_t *)tmpbuf;
 
-			if ((tmp_hdr->magic0 ==
-			     XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC0) &&
-			    (tmp_hdr->magic1 ==
-			     XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC1)) {
+			if (file_offsets_header_is_valid(tmp_hdr)) {
 				return (xmon_loaderbin_file_mapping_header_t *) tmp_hdr;
 			}
 	}
@@ -115,11 +136,14 @@ void starter_main(uint64_t header,
 	mon_guest_cpu_startup_state_t *s;
 	xmon_loaderbin_file_mapping_header_t *file_hdr;
 	xmon_loader_memory_layout_t *loader_mem;
-	xmon_runtime_memory_layout_t *runtime_mem;
+	ikgt_loader_boot_header_t *boot_hdr;
 	xmon_desc_t *xmon_desc;
 	uint32_t err = 0;
 	ikgt_platform_info_t * platform_info  = (ikgt_platform_info_t*)header;
+	boot_trace_header_t *trace;
 
+	trace = boot_trace_get(platform_info->trace_addr);
+	boot_trace_record(trace, BOOT_TRACE_STARTER_ENTRY, 0, 0);
 
 	/* Find file offsets header */
 	file_hdr = get_file_offsets_header(platform_info->load_addr, SCAN_MAX_IMAGE_SIZE);
@@ -139,35 +163,58 @@ void starter_main(uint64_t header,
 
 	/* assign it to xmon_desc for later reference */
 	xmon_desc->loader_mem_addr = (uint64_t)loader_mem;
+	xmon_desc->boot_trace_addr = (uint64_t)trace;
 
 
-	/*
-	 * caculate the total xmon size < use default value currently >
-	 * or get it from cmdline.
-	 * TODO: do a runtime xmon size estimation, if it is larger than default
-	 *       value XMON_DEFAULT_TOTAL_SIZE, then return an error.
-	 * could move to xmon_loader to do so.
+	/* the runtime memory was sized by the boot loader, the xmon area
+	 * (image, stacks and heap) is its last part, see
+	 * XMON_RT_XMON_OFFSET.
+	 * headers older than BOOT_HDR_VERSION 3 carry no offsets, and boot
+	 * loaders that do not size the xmon area leave run_size 0, both
+	 * get the fixed layout of XMON_RT_DEFAULT_SIZE bytes.
 	 */
-	xmon_desc->xmon.total_size = XMON_DEFAULT_TOTAL_SIZE;
-
-	/* get runtime_mem (xmon_runtime_memory_layout_t) address */
-	runtime_mem = (xmon_runtime_memory_layout_t *)(uint64_t)(platform_info->run_addr);
+	boot_hdr = (ikgt_loader_boot_header_t *)(uint64_t)(platform_info->load_addr);
+	if ((boot_hdr->magic == IKGT_BOOT_HEADER_MAGIC) &&
+	    (boot_hdr->version >= BOOT_HDR_VERSION)) {
+		xmon_desc->runtime_layout.startap_offset = boot_hdr->rt_startap_offset;
+		xmon_desc->runtime_layout.sguest_offset = boot_hdr->rt_sguest_offset;
+		xmon_desc->runtime_layout.xmon_offset = boot_hdr->rt_xmon_offset;
+	} else {
+		xmon_desc->runtime_layout.startap_offset = XMON_RT_STARTAP_OFFSET;
+		xmon_desc->runtime_layout.sguest_offset = XMON_RT_SGUEST_OFFSET;
+		xmon_desc->runtime_layout.xmon_offset = XMON_RT_XMON_OFFSET;
+	}
 
-	/* assign it to xmon_desc_t for later reference */
-	xmon_desc->runtime_mem_addr = (uint64_t)runtime_mem;
+	xmon_desc->runtime_mem_addr = (uint64_t)(platform_info->run_addr);
+	if (platform_info->run_size > xmon_desc->runtime_layout.xmon_offset) {
+		xmon_desc->runtime_mem_size = platform_info->run_size;
+	} else {
+		xmon_desc->runtime_mem_size = XMON_RT_DEFAULT_SIZE;
+		xmon_desc->runtime_layout.startap_offset = XMON_RT_STARTAP_OFFSET;
+		xmon_desc->runtime_layout.sguest_offset = XMON_RT_SGUEST_OFFSET;
+		xmon_desc->runtime_layout.xmon_offset = XMON_RT_XMON_OFFSET;
+	}
+	xmon_desc->xmon.total_size = xmon_desc->runtime_mem_size -
+				     xmon_desc->runtime_layout.xmon_offset;
 
 	/* save module information (file mapped address in RAM + base location )
 	 *  TODO: better to caculate what address is starter loaded by bootstub...instead of
 	 *        using the hardcode address.
 	 */
+	/* xmon_loader runs before any heap exists, so it is never compressed */
 	if (file_hdr->files[XMON_LOADER_BIN_INDEX].size &&
-	    (file_hdr->flags & INDEX_TO_BITMAP_FLAG(XMON_LOADER_BIN_INDEX))) {
+	    (file_hdr->flags & INDEX_TO_BITMAP_FLAG(XMON_LOADER_BIN_INDEX)) &&
+	    !(file_hdr->files[XMON_LOADER_BIN_INDEX].flags & FILE_BIN_FLAG_LZ4)) {
 		xmon_desc->xmon_loader_file.addr =
 			(uint64_t)(loader_mem->u_ldr_bin.img_base) +
 			file_hdr->files[
 				XMON_LOADER_BIN_INDEX].offset;
 		xmon_desc->xmon_loader_file.size =
 			file_hdr->files[XMON_LOADER_BIN_INDEX].size;
+		xmon_desc->xmon_loader_file.prelink_base =
+			file_hdr->files[XMON_LOADER_BIN_INDEX].prelink_base;
+		xmon_desc->xmon_loader_file.plan_addr =
+			(uint64_t)&file_hdr->plans[XMON_LOADER_BIN_INDEX];
 	} else {
 		goto DEADLOOP;
 	}
@@ -177,6 +224,10 @@ void starter_main(uint64_t header,
 		xmon_desc->startap_file.addr = (uint64_t)(loader_mem->u_ldr_bin.img_base) +
 			file_hdr->files[STARTAP_BIN_INDEX].offset;
 		xmon_desc->startap_file.size = file_hdr->files[STARTAP_BIN_INDEX].size;
+		xmon_desc->startap_file.flags = file_hdr->files[STARTAP_BIN_INDEX].flags;
+		xmon_desc->startap_file.raw_size = file_hdr->files[STARTAP_BIN_INDEX].raw_size;
+		xmon_desc->startap_file.prelink_base = file_hdr->files[STARTAP_BIN_INDEX].prelink_base;
+		xmon_desc->startap_file.plan_addr = (uint64_t)&file_hdr->plans[STARTAP_BIN_INDEX];
 	} else {
 		goto DEADLOOP;
 	}
@@ -186,6 +237,10 @@ void starter_main(uint64_t header,
 		xmon_desc->xmon_file.addr = (uint64_t)(loader_mem->u_ldr_bin.img_base) +
 			file_hdr->files[XMON_BIN_INDEX].offset;
 		xmon_desc->xmon_file.size = file_hdr->files[XMON_BIN_INDEX].size;
+		xmon_desc->xmon_file.flags = file_hdr->files[XMON_BIN_INDEX].flags;
+		xmon_desc->xmon_file.raw_size = file_hdr->files[XMON_BIN_INDEX].raw_size;
+		xmon_desc->xmon_file.prelink_base = file_hdr->files[XMON_BIN_INDEX].prelink_base;
+		xmon_desc->xmon_file.plan_addr = (uint64_t)&file_hdr->plans[XMON_BIN_INDEX];
 	} else {
 		goto DEADLOOP;
 	}
@@ -204,6 +259,7 @@ void starter_main(uint64_t header,
 	xmon_desc->initial_state.rsp = rsp;  /* undefined, here uses our own starter stack */
 
 
+	boot_trace_record(trace, BOOT_TRACE_STARTER_RUN_LOADER, 0, 0);
 	err = run_xmon_loader(xmon_desc);
 	if(err != 0)
 		goto DEADLOOP;
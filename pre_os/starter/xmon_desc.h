@@ -21,7 +21,7 @@
  * Current design: xmon_pkg.bin will be loaded to 0x10000000.
  * User must update this address in available space of E820
  * if this default value address doesn't work.
- * And it points to the structure xmon_memory_layout_t
+ * And it points to the structure xmon_loader_memory_layout_t
  */
 #define STARTER_DEFAULT_LOAD_ADDR 0x10000000  /* @256MB  */
 
@@ -53,6 +53,7 @@
 #include "mon_startup.h"
 #include "image_loader.h"
 #include "x32_init64.h"
+#include "load_plan.h"
 
 
 /* file layout in this order (no starter.bin)*/
@@ -71,13 +72,26 @@ enum {
  */
 #define INDEX_TO_BITMAP_FLAG(_index_)   (1 << (_index_))
 
+/* file_bin_info_t flags */
+#define FILE_BIN_FLAG_LZ4               (1 << 0) /* stored as one raw LZ4 block */
+
 typedef struct {
 	/* address offset: offset to the _start of xmon_pkg.bin
 	 *  packer will update these fields, and starter_main()
 	 *  then uses them to get the binaries' location info.
 	 */
 	unsigned int offset;
+	/* size stored in the package */
 	unsigned int size;
+
+	/* FILE_BIN_FLAG_xxx */
+	unsigned int flags;
+	/* size after decompression, same as size if not compressed */
+	unsigned int raw_size;
+	/* load address the packer applied the relocations for,
+	 * 0 if not prelinked
+	 */
+	unsigned int prelink_base;
 } file_bin_info_t;
 
 /* layout header for files (xmon.bin,xmon_loader.bin,startap.bin) mapped in RAM
@@ -99,13 +113,22 @@ typedef struct {
 
 	/* valid only if the corresponding flag bit-map is set */
 	file_bin_info_t files[MAX_BIN_COUNT];
+
+	/* load plan of the (decompressed) files, not valid (magic 0)
+	 *  if the packer could not compute one, see load_plan.h
+	 */
+	load_plan_t plans[MAX_BIN_COUNT];
 } xmon_loaderbin_file_mapping_header_t;
 
 
 
 
-/* The size of our heap (32MB) for starter/loader(xmon_loader) */
-#define LOADER_HEAP_SIZE       0x2000000
+/* The size of our heap (4MB) for starter/loader(xmon_loader), it holds
+ *  the decompression staging buffer of one module at a time (checked
+ *  by the packer) plus LOADER_HEAP_RESERVE for everything else
+ */
+#define LOADER_HEAP_SIZE       0x400000
+#define LOADER_HEAP_RESERVE    0x100000
 
 /* startap size 128KB (must be 4KB aligned), otherwise, need to
  *  use paged_buffer_t to force page alignment
@@ -118,7 +141,8 @@ typedef struct {
 /* secondary guest runtime footprint size */
 #define SG_RUNTIME_SIZE                     0x800000
 
-/* startap AP startup stack: 1024 bytes
+/* startap AP startup stack: 1024 bytes per AP, taken off the end of the
+ *  xmon area by xmon_loader, as the AP check-in slots
  *  refer to the function start_application() in startap.c file.
  */
 #define STARTUP_AP_STACK_SIZE           0x400
@@ -147,8 +171,9 @@ typedef struct {
 
 
 
-/* default xmon total size (depens on CPU count, total RAM size, and xmon view count)
- *  improvement: 1) caculate it at runtime, or; 2) passed on from command line
+/* default xmon total size (depends on CPU count, total RAM size, and xmon
+ *  view count), only used when the boot loader does not size the xmon
+ *  area at boot, see the sizing parameters below
  */
 #ifdef DEBUG
 #define XMON_DEFAULT_TOTAL_SIZE  0xD00000 /* include xmon img/stack/heap */
@@ -156,7 +181,26 @@ typedef struct {
 #define XMON_DEFAULT_TOTAL_SIZE  0xA00000
 #endif
 
-
+/* xmon area sizing parameters, passed on to the boot loader in the boot
+ *  header (ikgtboot.h). The xmon area is
+ *    xmon image + FIXED + cpus * PER_CPU
+ *    + GBs of physical memory * (PER_GB + views * PER_VIEW_GB)
+ *  capped at XMON_MAX_TOTAL_SIZE.
+ */
+#ifdef DEBUG
+#define XMON_SIZE_FIXED                 0x600000
+#else
+#define XMON_SIZE_FIXED                 0x300000
+#endif
+/* stack, VMCS, MSR/IO bitmaps and the other per cpu structures, and
+ *  the AP startup stack and check-in slot xmon_loader takes off the end */
+#define XMON_SIZE_PER_CPU               0x20000
+/* memory map and physical memory tracking */
+#define XMON_SIZE_PER_GB                0x1000
+/* EPT tables of a view, mostly 2MB mappings */
+#define XMON_SIZE_PER_VIEW_GB           0x10000
+#define XMON_DEFAULT_VIEW_COUNT         1
+#define XMON_MAX_TOTAL_SIZE             0x10000000
 
 /* dummy page buffer definition:
  *  used as a place holder to force page alignment, e.g. paged_buffer_t[x]
@@ -197,8 +241,8 @@ typedef struct {
 typedef struct {
 	uint64_t img_base;
 
-	/* may be not fixed, it is variable (not include startap size)
-	 *  see XMON_DEFAULT_TOTAL_SIZE
+	/* sized at boot (not include startap size), the runtime memory
+	 *  from the xmon area offset to its end
 	 */
 	uint64_t total_size;
 
@@ -217,10 +261,24 @@ typedef struct {
 } sguest_info_t;
 
 
+/* runtime memory layout, offsets of the areas, copied from the
+ * boot header by starter, see XMON_RT_XMON_OFFSET */
+typedef struct {
+	uint32_t startap_offset;
+	uint32_t sguest_offset;
+	uint32_t xmon_offset;
+	uint32_t pad;
+} xmon_runtime_layout_t;
+
+
 /* file modules (raw binary) mapped in memory/RAM */
 typedef struct {
 	uint64_t addr;
 	uint64_t size;
+	uint32_t flags;         /* FILE_BIN_FLAG_xxx */
+	uint32_t raw_size;      /* size after decompression */
+	uint64_t prelink_base;  /* 0 if not prelinked */
+	uint64_t plan_addr;     /* load_plan_t in the package */
 } module_file_info_t;
 
 
@@ -249,6 +307,9 @@ typedef struct {
 	/* starter fills these below */
 	uint64_t loader_mem_addr;
 	uint64_t runtime_mem_addr;
+	uint64_t runtime_mem_size;
+	xmon_runtime_layout_t runtime_layout;
+	uint64_t boot_trace_addr;       /* boot_trace_header_t, 0 if none */
 	module_file_info_t xmon_loader_file;
 	module_file_info_t startap_file;
 	module_file_info_t xmon_file;
@@ -312,7 +373,7 @@ typedef struct {
  *  |           |     \
  *  |           |      \
  *  |           |       |
- *  +-----------+       |->- mon_memory_layout[mon_image].total_size (XMON_DEFAULT_TOTAL_SIZE)
+ *  +-----------+       |->- mon_memory_layout[mon_image].total_size (sized at boot)
  *  |           |       |
  *  |  stack    |      /
  *  |           |     /
@@ -321,73 +382,29 @@ typedef struct {
  *  |  xmon img |  /  <--- mon_memory_layout[mon_image].image_size
  *  |           | /
  *  +-----------+/    <--- mon_memory_layout[mon_image].base_address
- *  |           |
+ *  |           |          (XMON_RT_XMON_OFFSET)
  *  | otherguest|
  *  |   imgs(if |
  *  |   any)    |
  *  |           |
- *  +-----------+
+ *  +-----------+     <--- XMON_RT_SGUEST_OFFSET
  *  |           |
  *  |startap img|     <--- STARTAP_IMG_SIZE
- *  +-----------+
+ *  +-----------+     <--- XMON_RT_STARTAP_OFFSET
  *
+ * The xmon area is the last one, its size is decided by the boot loader
+ * (see the sizing parameters above), so the layout is described by the
+ * offsets below (put in the boot header by the packer) instead of a
+ * struct. All offsets are page aligned.
  */
+#define XMON_RT_STARTAP_OFFSET          0
+#define XMON_RT_SGUEST_OFFSET           (XMON_RT_STARTAP_OFFSET + STARTAP_IMG_SIZE)
+#define XMON_RT_XMON_OFFSET             (XMON_RT_SGUEST_OFFSET + SG_RUNTIME_SIZE)
 
-/* memory layout at runtime
- * startap, xmon and secondary guest runtime memory layout
- */
-typedef struct {
-	/* startap runtime image in RAM */
-	union {
-		uint8_t base[STARTAP_IMG_SIZE];
-		paged_buffer_t holder[NUM_OF_PAGE(STARTAP_IMG_SIZE)];
-	} u_startap_img;
-
-	union {
-		uint8_t base[SG_RUNTIME_SIZE];
-		paged_buffer_t holder[NUM_OF_PAGE(SG_RUNTIME_SIZE)];
-	} u_sguest_img;
-
-	/* add more if any */
-
-
-	/* currently using default size.
-	 *  xmon(code, stack, heap) at runtime.
-	 */
-	union {
-		uint8_t img_base[XMON_DEFAULT_TOTAL_SIZE];
-		paged_buffer_t holder[NUM_OF_PAGE(XMON_DEFAULT_TOTAL_SIZE)];
-	} u_xmon;
-} xmon_runtime_memory_layout_t;
-
-#define FIELD_OFFSET_TO_HEAD(__struct, __member) OFFSET_OF(__struct, __member)
-
-/*
- *  this struct is just used as memory layout definition, and for
- *  easy memory base address caculation.
- *  this structure must be pointered by STARTER_DEFAULT_LOAD_ADDR
- */
-typedef struct _XMON_MEMORY_LAYOUT_ {
-	/* this memory used at loader time only, they will be
-	 *  re-claim by guest OS after xmon starts.
-	 */
-	xmon_loader_memory_layout_t ldr_mem_base;      /* must be located at first one */
-
-
-	/* this memory used at RUNTIME , it is bootstub or xmon_loader's
-	 *  responsibility to hide it from E820 table, and eventually
-	 *  hiden from guest
-	 *  by xmon code with ept settings.
-	 */
-	xmon_runtime_memory_layout_t rt_mem_base;
-} xmon_memory_layout_t;
-
+/* runtime memory size if the xmon area has the default size */
+#define XMON_RT_DEFAULT_SIZE            (XMON_RT_XMON_OFFSET + \
+					 XMON_DEFAULT_TOTAL_SIZE)
 
-/* must hide this memory range below by xmon_loader or bootstub */
-#define XMON_RUNTIME_MEMORY_BASE  (STARTER_DEFAULT_LOAD_ADDR + \
-				   FIELD_OFFSET_TO_HEAD(xmon_memory_layout_t, \
-					   rt_mem_base))
-#define XMON_RUNTIME_MEMORY_SIZE  (sizeof(xmon_runtime_memory_layout_t))
 
 
 /* Check if the bit BIT in FLAGS is set. */
@@ -0,0 +1,208 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+/*
+ * Host side decoder of the boot trace buffer, see boot_trace.h.
+ *
+ * Usage: boot_trace_decode [-a address] file
+ *   file     a dump of the trace buffer, or any memory image containing it
+ *            (the buffer is then searched on 4KB boundaries)
+ *   address  offset of the buffer in file, e.g. its physical address
+ *            with file /dev/mem
+ */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boot_trace.h"
+
+#define SCAN_ALIGN    0x1000
+
+typedef struct {
+	const char *name;
+	const char *format;
+} event_desc_t;
+
+#define BOOT_TRACE_DESC(name, format) { #name, format },
+
+static const event_desc_t event_desc[] = {
+	BOOT_TRACE_EVENT_LIST(BOOT_TRACE_DESC)
+};
+
+#undef BOOT_TRACE_DESC
+
+static int header_valid(const boot_trace_header_t *bt)
+{
+	return (bt->magic == BOOT_TRACE_MAGIC) &&
+	       (bt->size > sizeof(boot_trace_header_t)) &&
+	       (bt->max_records <= (bt->size - sizeof(boot_trace_header_t)) /
+		sizeof(boot_trace_record_t));
+}
+
+/* find the header at offset, or the first one from offset on */
+static int find_header(FILE *f, off_t *offset, int scan,
+		       boot_trace_header_t *bt)
+{
+	do {
+		if (fseeko(f, *offset, SEEK_SET) != 0) {
+			return 0;
+		}
+		if (fread(bt, sizeof(*bt), 1, f) != 1) {
+			return 0;
+		}
+		if (bt->magic == BOOT_TRACE_MAGIC) {
+			return 1;
+		}
+		*offset += SCAN_ALIGN;
+	} while (scan);
+
+	return 0;
+}
+
+static void print_record(uint32_t index, const boot_trace_record_t *rec,
+			 uint64_t tsc_base, uint64_t tsc_prev, uint64_t tsc_hz)
+{
+	printf("%5u cpu%-4u %14llu %+12lld ", index, rec->cpu,
+		(unsigned long long)(rec->tsc - tsc_base),
+		(long long)(rec->tsc - tsc_prev));
+	if (tsc_hz != 0) {
+		printf("%12.1f ", (double)(rec->tsc - tsc_base) * 1000000.0 /
+			(double)tsc_hz);
+	}
+	printf(" ");
+
+	if (rec->event >= BOOT_TRACE_EVENT_COUNT) {
+		printf("EVENT_%u 0x%llx 0x%llx 0x%llx 0x%llx\n", rec->event,
+			(unsigned long long)rec->args[0],
+			(unsigned long long)rec->args[1],
+			(unsigned long long)rec->args[2],
+			(unsigned long long)rec->args[3]);
+		return;
+	}
+
+	if (event_desc[rec->event].format[0] == '\0') {
+		printf("%s\n", event_desc[rec->event].name);
+		return;
+	}
+
+	printf("%-26s ", event_desc[rec->event].name);
+	printf(event_desc[rec->event].format,
+		(unsigned long long)rec->args[0],
+		(unsigned long long)rec->args[1],
+		(unsigned long long)rec->args[2],
+		(unsigned long long)rec->args[3]);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	boot_trace_header_t hdr;
+	boot_trace_record_t *records;
+	const char *file = NULL;
+	off_t offset = 0;
+	int scan = 1;
+	uint32_t count;
+	uint32_t i;
+	uint64_t tsc_base = 0;
+	uint64_t tsc_prev = 0;
+	FILE *f;
+
+	for (i = 1; i < (uint32_t)argc; i++) {
+		if ((strcmp(argv[i], "-a") == 0) && (i + 1 < (uint32_t)argc)) {
+			offset = (off_t)strtoull(argv[++i], NULL, 0);
+			scan = 0;
+		} else if (file == NULL) {
+			file = argv[i];
+		} else {
+			file = NULL;
+			break;
+		}
+	}
+
+	if (file == NULL) {
+		fprintf(stderr, "usage: %s [-a address] file\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(file, "rb");
+	if (f == NULL) {
+		perror(file);
+		return 1;
+	}
+
+	if (!find_header(f, &offset, scan, &hdr) || !header_valid(&hdr)) {
+		fprintf(stderr, "no boot trace found in %s\n", file);
+		fclose(f);
+		return 1;
+	}
+
+	if (hdr.version != BOOT_TRACE_VERSION) {
+		fprintf(stderr, "boot trace version %u, expected %u\n",
+			hdr.version, BOOT_TRACE_VERSION);
+		fclose(f);
+		return 1;
+	}
+
+	count = (hdr.next < hdr.max_records) ? hdr.next : hdr.max_records;
+	records = calloc(count ? count : 1, sizeof(boot_trace_record_t));
+	if (records == NULL) {
+		fclose(f);
+		return 1;
+	}
+
+	if (fread(records, sizeof(boot_trace_record_t), count, f) != count) {
+		fprintf(stderr, "%s: truncated boot trace\n", file);
+		free(records);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+
+	printf("boot trace at 0x%llx: %u records", (unsigned long long)offset,
+		count);
+	if (hdr.next > hdr.max_records) {
+		printf(", %u dropped", hdr.next - hdr.max_records);
+	}
+	if (hdr.tsc_hz != 0) {
+		printf(", tsc %llu Hz%s", (unsigned long long)hdr.tsc_hz,
+			(hdr.tsc_flags & BOOT_TRACE_TSC_INVARIANT) ?
+			" invariant" : "");
+	}
+	printf("\n%5s %-7s %14s %12s ", "#", "cpu", "tsc", "delta");
+	if (hdr.tsc_hz != 0) {
+		printf("%12s ", "usec");
+	}
+	printf(" %s\n", "event");
+
+	for (i = 0; i < count; i++) {
+		/* reserved but never completed */
+		if (records[i].event == BOOT_TRACE_NONE) {
+			continue;
+		}
+		if (tsc_base == 0) {
+			tsc_base = records[i].tsc;
+			tsc_prev = records[i].tsc;
+		}
+		print_record(i, &records[i], tsc_base, tsc_prev, hdr.tsc_hz);
+		tsc_prev = records[i].tsc;
+	}
+
+	free(records);
+
+	return 0;
+}
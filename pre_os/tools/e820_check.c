@@ -0,0 +1,506 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Host side check of the E820 table built by xmon_loader
+ * (get_e820_table_from_ibh() in pre_os/xmon_loader/e820.c) from the EFI
+ * memory map passed on by preload.
+ *
+ * Sample maps (a firmware like map, the same map out of order, and a
+ * large fragmented one) are replayed with several descriptor sizes, with
+ * the runtime memory carved out of them. The table must be sorted, must
+ * not overlap, must have no adjacent entries of the same type, must
+ * cover the same memory as the EFI map, and e820_lookup() must give the
+ * type of every descriptor, the runtime memory and the holes.
+ * The time of one conversion of the fragmented map is printed as well.
+ *
+ * Usage: e820_check
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define int64_t _int64_t
+#define size_t _size_t
+#include "xmon_desc.h"
+#include "ikgtboot.h"
+#include "e820_lookup.h"
+
+/* pre_os/xmon_loader/e820.c */
+boolean_t get_e820_table_from_ibh(xmon_desc_t *xd, uint64_t *e820_addr);
+
+/* the E820 table is taken from the loader heap */
+void_t *allocate_memory(uint64_t size)
+{
+	return calloc(1, size);
+}
+
+/* EFI_MEMORY_DESCRIPTOR, as in e820.c */
+typedef struct {
+	uint32_t type;
+	uint32_t pad;
+	uint64_t phys_addr;
+	uint64_t virt_addr;
+	uint64_t num_pages;
+	uint64_t attribute;
+} efi_desc_t;
+
+enum {
+	EFI_RESERVED,
+	EFI_LOADER_CODE,
+	EFI_LOADER_DATA,
+	EFI_BS_CODE,
+	EFI_BS_DATA,
+	EFI_RT_CODE,
+	EFI_RT_DATA,
+	EFI_CONVENTIONAL,
+	EFI_UNUSABLE,
+	EFI_ACPI_RECLAIM,
+	EFI_ACPI_NVS,
+	EFI_MMIO,
+	EFI_MMIO_PORT,
+	EFI_PAL_CODE
+};
+
+#define E820_MEMORY     1
+#define E820_RESERVED   2
+#define E820_ACPI       3
+#define E820_NVS        4
+
+#define PAGE_SIZE       0x1000ULL
+
+#define MAP_MAX_DESCS   1024
+#define MAP_MAX_DESC_SIZE 80
+#define BENCH_LOOPS     1000
+
+typedef struct {
+	uint32_t type;
+	uint64_t base;
+	uint64_t pages;
+} sample_desc_t;
+
+/* a firmware like map, with runs of adjacent ranges of the same E820 type */
+static const sample_desc_t sample_fw[] = {
+	{ EFI_BS_CODE,      0x0,         0x1     },
+	{ EFI_CONVENTIONAL, 0x1000,      0x9F    },
+	{ EFI_CONVENTIONAL, 0x100000,    0x700   },
+	{ EFI_ACPI_NVS,     0x800000,    0x8     },
+	{ EFI_CONVENTIONAL, 0x808000,    0x3     },
+	{ EFI_ACPI_NVS,     0x80B000,    0x1     },
+	{ EFI_CONVENTIONAL, 0x80C000,    0x4     },
+	{ EFI_ACPI_NVS,     0x810000,    0xF0    },
+	{ EFI_BS_DATA,      0x900000,    0x700   },
+	{ EFI_CONVENTIONAL, 0x1000000,   0x1F000 },
+	{ EFI_LOADER_CODE,  0x20000000,  0x40    },
+	{ EFI_LOADER_DATA,  0x20040000,  0x1C0   },
+	{ EFI_BS_DATA,      0x20200000,  0x20    },
+	{ EFI_BS_CODE,      0x20220000,  0x60    },
+	{ EFI_BS_DATA,      0x20280000,  0x180   },
+	{ EFI_RT_DATA,      0x20400000,  0x80    },
+	{ EFI_RT_CODE,      0x20480000,  0x30    },
+	{ EFI_RESERVED,     0x204B0000,  0x50    },
+	{ EFI_BS_DATA,      0x20500000,  0x3A00  },
+	{ EFI_ACPI_RECLAIM, 0x23F00000,  0x10    },
+	{ EFI_ACPI_RECLAIM, 0x23F10000,  0x8     },
+	{ EFI_ACPI_NVS,     0x23F18000,  0x68    },
+	{ EFI_BS_CODE,      0x23F80000,  0x80    },
+	{ EFI_MMIO,         0xE0000000,  0x10000 },
+	{ EFI_MMIO,         0xFEC00000,  0x1     },
+	{ EFI_MMIO,         0xFEE00000,  0x1     },
+	{ EFI_MMIO,         0xFFC00000,  0x400   },
+	{ EFI_CONVENTIONAL, 0x100000000, 0x80000 },
+	{ EFI_UNUSABLE,     0x180000000, 0x10    },
+	{ EFI_CONVENTIONAL, 0x180010000, 0x3FFF0 },
+};
+
+#define SAMPLE_FW_COUNT (sizeof(sample_fw) / sizeof(sample_fw[0]))
+
+static const uint32_t desc_sizes[] = {
+	0,                              /* not passed on by preload */
+	sizeof(efi_desc_t),
+	sizeof(efi_desc_t) + 8,         /* what firmwares usually report */
+	MAP_MAX_DESC_SIZE,
+};
+
+/* GetMemoryMap() output, preload passes a 32-bit address on */
+static uint8_t efi_map[MAP_MAX_DESCS * MAP_MAX_DESC_SIZE]
+	__attribute__((aligned(8)));
+
+static uint32_t rand_seed = 1;
+
+static uint32_t next_rand(void)
+{
+	rand_seed = rand_seed * 1103515245 + 12345;
+	return rand_seed >> 16;
+}
+
+static uint32_t expected_type(uint32_t efi_type)
+{
+	switch (efi_type) {
+	case EFI_LOADER_CODE:
+	case EFI_LOADER_DATA:
+	case EFI_BS_CODE:
+	case EFI_BS_DATA:
+	case EFI_CONVENTIONAL:
+		return E820_MEMORY;
+	case EFI_ACPI_RECLAIM:
+		return E820_ACPI;
+	case EFI_ACPI_NVS:
+		return E820_NVS;
+	default:
+		return E820_RESERVED;
+	}
+}
+
+/*
+ * a large fragmented map: runs of small ranges of mixed types with a few
+ * holes, as on machines with many devices and a long boot
+ */
+static uint32_t make_fragmented(sample_desc_t *descs, uint32_t count)
+{
+	static const uint32_t types[] = {
+		EFI_LOADER_CODE, EFI_LOADER_DATA, EFI_BS_CODE, EFI_BS_DATA,
+		EFI_CONVENTIONAL, EFI_CONVENTIONAL, EFI_BS_DATA, EFI_BS_DATA,
+		EFI_RT_DATA, EFI_ACPI_RECLAIM, EFI_ACPI_NVS, EFI_RESERVED,
+	};
+	uint64_t base = 0x100000;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		/* mostly memory, so that many ranges merge */
+		descs[i].type = types[next_rand() % 12];
+		if (next_rand() % 4) {
+			descs[i].type = types[next_rand() % 8];
+		}
+		descs[i].base = base;
+		descs[i].pages = 1 + next_rand() % 64;
+		base += descs[i].pages * PAGE_SIZE;
+		if ((next_rand() % 32) == 0) {
+			base += (1 + next_rand() % 16) * PAGE_SIZE;
+		}
+	}
+
+	return count;
+}
+
+static void shuffle(sample_desc_t *descs, uint32_t count)
+{
+	sample_desc_t tmp;
+	uint32_t i, j;
+
+	for (i = count - 1; i > 0; i--) {
+		j = next_rand() % (i + 1);
+		tmp = descs[i];
+		descs[i] = descs[j];
+		descs[j] = tmp;
+	}
+}
+
+static int cmp_desc(const void *a, const void *b)
+{
+	const sample_desc_t *da = a;
+	const sample_desc_t *db = b;
+
+	if (da->base != db->base) {
+		return (da->base < db->base) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static void write_map(const sample_desc_t *descs, uint32_t count,
+		      uint32_t desc_size)
+{
+	efi_desc_t *d;
+	uint32_t i;
+
+	memset(efi_map, 0xCC, sizeof(efi_map));
+	for (i = 0; i < count; i++) {
+		d = (efi_desc_t *)(efi_map + (uint64_t)desc_size * i);
+		memset(d, 0, sizeof(efi_desc_t));
+		d->type = descs[i].type;
+		d->phys_addr = descs[i].base;
+		d->num_pages = descs[i].pages;
+	}
+}
+
+/* the type at addr as the EFI map and the runtime memory describe it */
+static uint32_t type_at(const sample_desc_t *sorted, uint32_t count,
+			uint64_t carve_base, uint64_t carve_end, uint64_t addr)
+{
+	uint32_t i;
+
+	if ((addr >= carve_base) && (addr < carve_end)) {
+		return E820_RESERVED;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((addr >= sorted[i].base) &&
+		    (addr - sorted[i].base < sorted[i].pages * PAGE_SIZE)) {
+			return expected_type(sorted[i].type);
+		}
+	}
+
+	/* hole */
+	return 0;
+}
+
+static int check_addr(const int15_e820_memory_map_t *e820,
+		      const sample_desc_t *sorted, uint32_t count,
+		      uint64_t carve_base, uint64_t carve_end, uint64_t addr)
+{
+	const int15_e820_memory_map_entry_ext_t *entry;
+	uint32_t expected;
+	uint32_t found;
+
+	expected = type_at(sorted, count, carve_base, carve_end, addr);
+	entry = e820_lookup(e820, addr);
+	found = entry ? entry->basic_entry.address_range_type : 0;
+	if (found != expected) {
+		printf("  lookup 0x%llx: type %u, expected %u\n",
+			(unsigned long long)addr, found, expected);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* bytes covered by the EFI map and the runtime memory */
+static uint64_t covered_size(const sample_desc_t *sorted, uint32_t count,
+			     uint64_t carve_base, uint64_t carve_end)
+{
+	uint64_t total = carve_end - carve_base;
+	uint64_t base, end;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		base = sorted[i].base;
+		end = base + sorted[i].pages * PAGE_SIZE;
+		if ((base < carve_end) && (end > carve_base)) {
+			if (base < carve_base) {
+				total += carve_base - base;
+			}
+			if (end > carve_end) {
+				total += end - carve_end;
+			}
+			continue;
+		}
+		total += end - base;
+	}
+
+	return total;
+}
+
+static int check_table(const int15_e820_memory_map_t *e820,
+		       const sample_desc_t *descs, uint32_t count,
+		       uint64_t carve_base, uint64_t carve_end)
+{
+	const int15_e820_memory_map_entry_ext_t *entry, *prev = NULL;
+	sample_desc_t sorted[MAP_MAX_DESCS];
+	uint64_t total = 0;
+	uint64_t base, end;
+	uint32_t n = e820_entry_count(e820);
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		entry = &e820->memory_map_entry[i];
+		if (entry->basic_entry.length == 0) {
+			printf("  entry %u is empty\n", i);
+			return -1;
+		}
+		if (prev) {
+			end = prev->basic_entry.base_address +
+			      prev->basic_entry.length;
+			if (entry->basic_entry.base_address < end) {
+				printf("  entry %u overlaps or is out of order\n", i);
+				return -1;
+			}
+			if ((entry->basic_entry.base_address == end) &&
+			    (entry->basic_entry.address_range_type ==
+			     prev->basic_entry.address_range_type)) {
+				printf("  entry %u is not merged\n", i);
+				return -1;
+			}
+		}
+		total += entry->basic_entry.length;
+		prev = entry;
+	}
+
+	memcpy(sorted, descs, count * sizeof(sample_desc_t));
+	qsort(sorted, count, sizeof(sample_desc_t), cmp_desc);
+
+	if (total != covered_size(sorted, count, carve_base, carve_end)) {
+		printf("  covers 0x%llx bytes, the EFI map 0x%llx\n",
+			(unsigned long long)total,
+			(unsigned long long)covered_size(sorted, count,
+				carve_base, carve_end));
+		return -1;
+	}
+
+	/* both ends of every range and of the holes after them */
+	for (i = 0; i < count; i++) {
+		base = sorted[i].base;
+		end = base + sorted[i].pages * PAGE_SIZE;
+		if (check_addr(e820, sorted, count, carve_base, carve_end, base) ||
+		    check_addr(e820, sorted, count, carve_base, carve_end, end - 1) ||
+		    check_addr(e820, sorted, count, carve_base, carve_end, end)) {
+			return -1;
+		}
+	}
+
+	if (check_addr(e820, sorted, count, carve_base, carve_end,
+		       carve_base) ||
+	    check_addr(e820, sorted, count, carve_base, carve_end,
+		       carve_end - 1) ||
+	    check_addr(e820, sorted, count, carve_base, carve_end, ~0ULL)) {
+		return -1;
+	}
+
+	if (!e820_range_is_type(e820, carve_base, carve_end - carve_base,
+				E820_RESERVED)) {
+		printf("  runtime memory is not one reserved range\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int replay(const char *name, const sample_desc_t *descs,
+		  uint32_t count, uint64_t carve_base, uint64_t carve_size)
+{
+	int15_e820_memory_map_t *e820;
+	ikgt_platform_info_t platform_info;
+	xmon_desc_t xd;
+	uint64_t e820_addr;
+	uint32_t desc_size;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(desc_sizes) / sizeof(desc_sizes[0]); i++) {
+		desc_size = desc_sizes[i] ? desc_sizes[i] : sizeof(efi_desc_t) + 8;
+		write_map(descs, count, desc_size);
+
+		memset(&platform_info, 0, sizeof(platform_info));
+		platform_info.memmap_addr = (uint32_t)(uint64_t)efi_map;
+		platform_info.memmap_size = count * desc_size;
+		platform_info.memmap_desc_size = desc_sizes[i];
+		platform_info.memmap_desc_version = desc_sizes[i] ? 1 : 0;
+
+		memset(&xd, 0, sizeof(xd));
+		xd.initial_state.rbx = (uint64_t)&platform_info;
+		xd.runtime_mem_addr = carve_base;
+		xd.runtime_mem_size = carve_size;
+
+		if (!get_e820_table_from_ibh(&xd, &e820_addr)) {
+			printf("%s, descriptor size %u: conversion failed\n",
+				name, desc_size);
+			return -1;
+		}
+		e820 = (int15_e820_memory_map_t *)e820_addr;
+
+		if (check_table(e820, descs, count, carve_base,
+				carve_base + carve_size)) {
+			printf("%s, descriptor size %u: FAILED\n", name,
+				desc_size);
+			free(e820);
+			return -1;
+		}
+
+		if (i == 0) {
+			printf("%s: %u EFI descriptors -> %u E820 entries\n",
+				name, count, e820_entry_count(e820));
+		}
+		free(e820);
+	}
+
+	return 0;
+}
+
+/* time of one conversion */
+static void bench(const char *name, const sample_desc_t *descs,
+		  uint32_t count, uint64_t carve_base, uint64_t carve_size)
+{
+	ikgt_platform_info_t platform_info;
+	xmon_desc_t xd;
+	uint64_t e820_addr;
+	struct timespec start, end;
+	uint32_t i;
+
+	write_map(descs, count, sizeof(efi_desc_t) + 8);
+	memset(&platform_info, 0, sizeof(platform_info));
+	platform_info.memmap_addr = (uint32_t)(uint64_t)efi_map;
+	platform_info.memmap_size = count * (sizeof(efi_desc_t) + 8);
+	memset(&xd, 0, sizeof(xd));
+	xd.initial_state.rbx = (uint64_t)&platform_info;
+	xd.runtime_mem_addr = carve_base;
+	xd.runtime_mem_size = carve_size;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		if (get_e820_table_from_ibh(&xd, &e820_addr)) {
+			free((void *)e820_addr);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%s: %.1f us per conversion\n", name,
+		((end.tv_sec - start.tv_sec) * 1e9 +
+		 (end.tv_nsec - start.tv_nsec)) / BENCH_LOOPS / 1e3);
+}
+
+int main(void)
+{
+	sample_desc_t descs[MAP_MAX_DESCS];
+	uint64_t carve_base, carve_size;
+	uint32_t count;
+
+	if ((uint64_t)efi_map >> 32) {
+		printf("the EFI map buffer is above 4GB, link it static\n");
+		return 1;
+	}
+
+	/* the runtime memory where preload asks for it, in one range */
+	memcpy(descs, sample_fw, sizeof(sample_fw));
+	if (replay("firmware map", descs, SAMPLE_FW_COUNT, RT_MEM_BASE,
+		   0x2000000)) {
+		return 1;
+	}
+
+	/* out of order, and the runtime memory over several ranges */
+	shuffle(descs, SAMPLE_FW_COUNT);
+	if (replay("unsorted firmware map", descs, SAMPLE_FW_COUNT,
+		   0x1F000000, 0x1400000)) {
+		return 1;
+	}
+
+	count = make_fragmented(descs, MAP_MAX_DESCS);
+	carve_base = descs[count / 2].base;
+	carve_size = descs[count / 2 + 8].base - carve_base + PAGE_SIZE;
+	if (replay("fragmented map", descs, count, carve_base, carve_size)) {
+		return 1;
+	}
+	bench("fragmented map", descs, count, carve_base, carve_size);
+
+	shuffle(descs, count);
+	if (replay("unsorted fragmented map", descs, count, carve_base,
+		   carve_size)) {
+		return 1;
+	}
+
+	printf("check OK\n");
+
+	return 0;
+}
@@ -0,0 +1,644 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <elf.h>
+
+#include "elf_reloc.h"
+
+/* packed relative relocations, not known by older elf headers */
+#ifndef DT_RELRSZ
+#define DT_RELRSZ       35
+#endif
+#ifndef DT_RELR
+#define DT_RELR         36
+#endif
+#ifndef DT_RELRENT
+#define DT_RELRENT      37
+#endif
+
+/* number of words covered by one RELR bitmap entry */
+#define RELR_BITMAP_WORDS  (sizeof(Elf64_Xword) * 8 - 1)
+
+typedef struct {
+	unsigned char *image;
+	unsigned int size;
+	Elf64_Ehdr *ehdr;
+	Elf64_Phdr *phdr;
+	unsigned int phnum;
+	Elf64_Dyn *dyn;
+	unsigned int dyn_cnt;
+
+	/* from the dynamic section, link addresses */
+	Elf64_Addr rela_addr;
+	Elf64_Xword rela_sz;
+	Elf64_Xword rela_ent;
+	Elf64_Addr relr_addr;
+	Elf64_Xword relr_sz;
+	Elf64_Xword relr_ent;
+	Elf64_Addr symtab_addr;
+} elf_image_t;
+
+/*
+ * return the file offset of [vaddr, vaddr + len) if it is fully backed by
+ * the file content of a PT_LOAD segment, -1 otherwise.
+ */
+static long vaddr_to_offset(const elf_image_t *elf,
+			    Elf64_Addr vaddr, Elf64_Xword len)
+{
+	unsigned int i;
+
+	for (i = 0; i < elf->phnum; i++) {
+		Elf64_Phdr *phdr = &elf->phdr[i];
+
+		if (phdr->p_type != PT_LOAD ||
+		    vaddr < phdr->p_vaddr ||
+		    vaddr + len > phdr->p_vaddr + phdr->p_filesz) {
+			continue;
+		}
+
+		if (phdr->p_offset + (vaddr - phdr->p_vaddr) + len > elf->size) {
+			return -1;
+		}
+
+		return (long)(phdr->p_offset + (vaddr - phdr->p_vaddr));
+	}
+
+	return -1;
+}
+
+/*
+ * check the image is an x86_64 PIE and locate its dynamic section.
+ * return 1 if so, 0 if the image is not relocated by the loader,
+ * -1 if it is malformed.
+ */
+static int elf_parse(elf_image_t *elf, unsigned char *image, unsigned int size)
+{
+	Elf64_Ehdr *ehdr = (Elf64_Ehdr *)image;
+	unsigned int i;
+
+	memset(elf, 0, sizeof(*elf));
+	elf->image = image;
+	elf->size = size;
+	elf->ehdr = ehdr;
+
+	if (size < sizeof(Elf64_Ehdr) ||
+	    memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    ehdr->e_machine != EM_X86_64 ||
+	    ehdr->e_type != ET_DYN) {
+		return 0;
+	}
+
+	if (ehdr->e_phentsize != sizeof(Elf64_Phdr) ||
+	    ehdr->e_phoff > size ||
+	    ehdr->e_phnum * sizeof(Elf64_Phdr) > size - ehdr->e_phoff) {
+		printf("!ERROR(packer): bad ELF program headers\r\n");
+		return -1;
+	}
+	elf->phdr = (Elf64_Phdr *)(image + ehdr->e_phoff);
+	elf->phnum = ehdr->e_phnum;
+
+	for (i = 0; i < elf->phnum; i++) {
+		if (elf->phdr[i].p_type != PT_DYNAMIC) {
+			continue;
+		}
+		if (elf->phdr[i].p_offset > size ||
+		    elf->phdr[i].p_filesz > size - elf->phdr[i].p_offset) {
+			printf("!ERROR(packer): bad ELF dynamic section\r\n");
+			return -1;
+		}
+		elf->dyn = (Elf64_Dyn *)(image + elf->phdr[i].p_offset);
+		elf->dyn_cnt = elf->phdr[i].p_filesz / sizeof(Elf64_Dyn);
+		break;
+	}
+
+	for (i = 0; i < elf->dyn_cnt && elf->dyn[i].d_tag != DT_NULL; i++) {
+		switch (elf->dyn[i].d_tag) {
+		case DT_RELA:
+			elf->rela_addr = elf->dyn[i].d_un.d_ptr;
+			break;
+		case DT_RELASZ:
+			elf->rela_sz = elf->dyn[i].d_un.d_val;
+			break;
+		case DT_RELAENT:
+			elf->rela_ent = elf->dyn[i].d_un.d_val;
+			break;
+		case DT_RELR:
+			elf->relr_addr = elf->dyn[i].d_un.d_ptr;
+			break;
+		case DT_RELRSZ:
+			elf->relr_sz = elf->dyn[i].d_un.d_val;
+			break;
+		case DT_RELRENT:
+			elf->relr_ent = elf->dyn[i].d_un.d_val;
+			break;
+		case DT_SYMTAB:
+			elf->symtab_addr = elf->dyn[i].d_un.d_ptr;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (elf->rela_sz && elf->rela_ent != sizeof(Elf64_Rela)) {
+		printf("!ERROR(packer): unsupported DT_RELAENT %ld\r\n",
+			(long)elf->rela_ent);
+		return -1;
+	}
+
+	if (elf->relr_sz && elf->relr_ent != sizeof(Elf64_Xword)) {
+		printf("!ERROR(packer): unsupported DT_RELRENT %ld\r\n",
+			(long)elf->relr_ent);
+		return -1;
+	}
+
+	return 1;
+}
+
+/*
+ * a RELATIVE relocation can go to RELR if its target is an aligned word
+ * with file content (the addend is stored there), outside the RELA table.
+ */
+static int is_relr_candidate(const elf_image_t *elf, const Elf64_Rela *rela)
+{
+	return ELF64_R_TYPE(rela->r_info) == R_X86_64_RELATIVE &&
+	       (rela->r_offset & (sizeof(Elf64_Addr) - 1)) == 0 &&
+	       (rela->r_offset + sizeof(Elf64_Addr) <= elf->rela_addr ||
+		rela->r_offset >= elf->rela_addr + elf->rela_sz) &&
+	       vaddr_to_offset(elf, rela->r_offset, sizeof(Elf64_Addr)) >= 0;
+}
+
+static int cmp_addr(const void *a, const void *b)
+{
+	Elf64_Addr x = *(const Elf64_Addr *)a;
+	Elf64_Addr y = *(const Elf64_Addr *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * encode sorted, unique and aligned addresses into RELR words.
+ * return the number of words, relr may be NULL to get the count only.
+ */
+static unsigned int relr_encode(const Elf64_Addr *addr, unsigned int count,
+				Elf64_Xword *relr)
+{
+	unsigned int i = 0, n = 0;
+
+	while (i < count) {
+		Elf64_Addr base = addr[i] + sizeof(Elf64_Addr);
+
+		/* address entry */
+		if (relr) {
+			relr[n] = addr[i];
+		}
+		n++;
+		i++;
+
+		/* followed by bitmaps while the next addresses are close */
+		for (;;) {
+			Elf64_Xword bitmap = 0;
+
+			while (i < count &&
+			       addr[i] - base <
+			       RELR_BITMAP_WORDS * sizeof(Elf64_Addr)) {
+				bitmap |= 1ULL << ((addr[i] - base) /
+						   sizeof(Elf64_Addr));
+				i++;
+			}
+
+			if (bitmap == 0) {
+				break;
+			}
+
+			if (relr) {
+				relr[n] = (bitmap << 1) | 1;
+			}
+			n++;
+			base += RELR_BITMAP_WORDS * sizeof(Elf64_Addr);
+		}
+	}
+
+	return n;
+}
+
+int elf_rela_to_relr(unsigned char *image, unsigned int size)
+{
+	elf_image_t elf;
+	Elf64_Dyn *new_dyn = NULL;
+	unsigned int new_cnt = 0;
+	Elf64_Rela *rela;
+	Elf64_Xword *relr;
+	Elf64_Addr *addr = NULL;
+	unsigned int rel_cnt, relative_cnt = 0, other_cnt = 0, relr_cnt;
+	unsigned int i, j;
+	long offset;
+	int ret;
+
+	/* only x86_64 PIE images are relocated by the loader */
+	ret = elf_parse(&elf, image, size);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	/* nothing to convert, or already packed */
+	if (elf.rela_sz == 0 || elf.relr_sz != 0) {
+		return 0;
+	}
+
+	offset = vaddr_to_offset(&elf, elf.rela_addr, elf.rela_sz);
+	if (offset < 0) {
+		printf("!ERROR(packer): bad ELF RELA table\r\n");
+		return -1;
+	}
+	rela = (Elf64_Rela *)(image + offset);
+	rel_cnt = elf.rela_sz / sizeof(Elf64_Rela);
+
+	ret = -1;
+
+	addr = malloc(rel_cnt * sizeof(Elf64_Addr));
+	new_dyn = calloc(elf.dyn_cnt, sizeof(Elf64_Dyn));
+	if (!addr || !new_dyn) {
+		printf("!ERROR(packer): failed to allocate memory\r\n");
+		goto exit;
+	}
+
+	for (i = 0; i < rel_cnt; i++) {
+		if (is_relr_candidate(&elf, &rela[i])) {
+			addr[relative_cnt++] = rela[i].r_offset;
+		} else {
+			other_cnt++;
+		}
+	}
+
+	/* success, nothing to do */
+	ret = 0;
+
+	if (relative_cnt == 0) {
+		goto exit;
+	}
+
+	qsort(addr, relative_cnt, sizeof(Elf64_Addr), cmp_addr);
+	for (i = 1; i < relative_cnt; i++) {
+		if (addr[i] == addr[i - 1]) {
+			printf("!WARNING(packer): duplicated RELATIVE relocation, keep RELA\r\n");
+			goto exit;
+		}
+	}
+	relr_cnt = relr_encode(addr, relative_cnt, NULL);
+
+	/*
+	 * new dynamic section: DT_RELACOUNT goes away (and the RELA tags,
+	 * if no RELA entry is left), the RELR tags are appended, and it
+	 * still ends with DT_NULL.
+	 */
+	for (i = 0; i < elf.dyn_cnt && elf.dyn[i].d_tag != DT_NULL; i++) {
+		switch (elf.dyn[i].d_tag) {
+		case DT_RELACOUNT:
+			continue;
+		case DT_RELA:
+		case DT_RELAENT:
+		case DT_RELASZ:
+			if (other_cnt == 0) {
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+
+		new_dyn[new_cnt] = elf.dyn[i];
+		if (new_dyn[new_cnt].d_tag == DT_RELASZ) {
+			new_dyn[new_cnt].d_un.d_val =
+				other_cnt * sizeof(Elf64_Rela);
+		}
+		new_cnt++;
+	}
+
+	if (new_cnt + 3 + 1 > elf.dyn_cnt) {
+		printf("!WARNING(packer): no free slot for DT_RELR in the dynamic section, keep RELA\r\n");
+		goto exit;
+	}
+
+	new_dyn[new_cnt].d_tag = DT_RELR;
+	new_dyn[new_cnt++].d_un.d_ptr =
+		elf.rela_addr + other_cnt * sizeof(Elf64_Rela);
+	new_dyn[new_cnt].d_tag = DT_RELRSZ;
+	new_dyn[new_cnt++].d_un.d_val = relr_cnt * sizeof(Elf64_Xword);
+	new_dyn[new_cnt].d_tag = DT_RELRENT;
+	new_dyn[new_cnt++].d_un.d_val = sizeof(Elf64_Xword);
+
+	/*
+	 * no way back from here: store the addends at the targets and keep
+	 * the other relocations at the start of the RELA table (j <= i, so
+	 * they are never overwritten before being read).
+	 */
+	for (i = 0, j = 0; i < rel_cnt; i++) {
+		Elf64_Rela r = rela[i];
+
+		if (is_relr_candidate(&elf, &r)) {
+			offset = vaddr_to_offset(&elf, r.r_offset,
+					sizeof(Elf64_Addr));
+			memcpy(image + offset, &r.r_addend, sizeof(Elf64_Addr));
+		} else {
+			rela[j++] = r;
+		}
+	}
+
+	/* RELR table behind them, then zeroes up to the old table end */
+	relr = (Elf64_Xword *)(rela + other_cnt);
+	relr_encode(addr, relative_cnt, relr);
+	memset(relr + relr_cnt, 0,
+		(elf.rela_sz - other_cnt * sizeof(Elf64_Rela)) -
+		relr_cnt * sizeof(Elf64_Xword));
+
+	memcpy(elf.dyn, new_dyn, elf.dyn_cnt * sizeof(Elf64_Dyn));
+
+	/* keep the RELA section header in line for the binutils */
+	if (elf.ehdr->e_shentsize == sizeof(Elf64_Shdr) &&
+	    elf.ehdr->e_shoff <= size &&
+	    elf.ehdr->e_shnum * sizeof(Elf64_Shdr) <= size - elf.ehdr->e_shoff) {
+		Elf64_Shdr *shdr = (Elf64_Shdr *)(image + elf.ehdr->e_shoff);
+
+		for (i = 0; i < elf.ehdr->e_shnum; i++) {
+			if (shdr[i].sh_type == SHT_RELA &&
+			    shdr[i].sh_addr == elf.rela_addr &&
+			    shdr[i].sh_size == elf.rela_sz) {
+				shdr[i].sh_size = other_cnt * sizeof(Elf64_Rela);
+			}
+		}
+	}
+
+	printf("!INFO(packer): %u RELATIVE relocations packed into %u DT_RELR words\r\n",
+		relative_cnt, relr_cnt);
+
+exit:
+	free(addr);
+	free(new_dyn);
+
+	return ret;
+}
+
+/*
+ * set (add == 0) or add to (add != 0) the word at vaddr, or only check
+ * it has file content when apply is 0.
+ * return 0 on success, -1 if the word has no file content.
+ */
+static int prelink_word(elf_image_t *elf, Elf64_Addr vaddr,
+			Elf64_Addr value, int add, int apply)
+{
+	long offset = vaddr_to_offset(elf, vaddr, sizeof(Elf64_Addr));
+	Elf64_Addr word;
+
+	if (offset < 0) {
+		printf("!WARNING(packer): relocation at 0x%llx is out of the file content\r\n",
+			(unsigned long long)vaddr);
+		return -1;
+	}
+
+	if (apply) {
+		memcpy(&word, elf->image + offset, sizeof(word));
+		word = add ? word + value : value;
+		memcpy(elf->image + offset, &word, sizeof(word));
+	}
+
+	return 0;
+}
+
+/*
+ * apply the relocations for delta in the order and the way
+ * elf64_do_relocation() does, or only check they can be applied.
+ * return 0 on success, -1 if the image cannot be prelinked.
+ */
+static int prelink_pass(elf_image_t *elf, Elf64_Addr delta, int apply)
+{
+	const unsigned char *table;
+	Elf64_Addr where = 0;
+	Elf64_Xword i;
+	long offset;
+
+	if (elf->relr_sz) {
+		offset = vaddr_to_offset(elf, elf->relr_addr, elf->relr_sz);
+		if (offset < 0) {
+			printf("!WARNING(packer): bad ELF RELR table\r\n");
+			return -1;
+		}
+		table = elf->image + offset;
+
+		for (i = 0; i < elf->relr_sz / sizeof(Elf64_Xword); i++) {
+			Elf64_Xword entry, bitmap;
+			Elf64_Addr p;
+
+			memcpy(&entry, table + i * sizeof(entry), sizeof(entry));
+			if ((entry & 1) == 0) {
+				if (prelink_word(elf, entry, delta, 1, apply)) {
+					return -1;
+				}
+				where = entry + sizeof(Elf64_Addr);
+				continue;
+			}
+
+			for (p = where, bitmap = entry >> 1; bitmap;
+			     p += sizeof(Elf64_Addr), bitmap >>= 1) {
+				if ((bitmap & 1) &&
+				    prelink_word(elf, p, delta, 1, apply)) {
+					return -1;
+				}
+			}
+			where += RELR_BITMAP_WORDS * sizeof(Elf64_Addr);
+		}
+	}
+
+	if (elf->rela_sz) {
+		offset = vaddr_to_offset(elf, elf->rela_addr, elf->rela_sz);
+		if (offset < 0) {
+			printf("!WARNING(packer): bad ELF RELA table\r\n");
+			return -1;
+		}
+		table = elf->image + offset;
+
+		for (i = 0; i < elf->rela_sz / sizeof(Elf64_Rela); i++) {
+			Elf64_Rela r;
+			Elf64_Sym sym;
+			Elf64_Addr value;
+
+			memcpy(&r, table + i * sizeof(r), sizeof(r));
+
+			switch (ELF64_R_TYPE(r.r_info)) {
+			case R_X86_64_RELATIVE:
+				value = r.r_addend + delta;
+				break;
+			case R_X86_64_32:
+				offset = vaddr_to_offset(elf, elf->symtab_addr +
+						ELF64_R_SYM(r.r_info) * sizeof(sym),
+						sizeof(sym));
+				if (!elf->symtab_addr || offset < 0) {
+					printf("!WARNING(packer): bad ELF symbol table\r\n");
+					return -1;
+				}
+				memcpy(&sym, elf->image + offset, sizeof(sym));
+				value = r.r_addend + delta + sym.st_value;
+				break;
+			case R_X86_64_NONE:
+				continue;
+			default:
+				printf("!WARNING(packer): unsupported relocation type %ld\r\n",
+					(long)ELF64_R_TYPE(r.r_info));
+				return -1;
+			}
+
+			if (prelink_word(elf, r.r_offset, value, 0, apply)) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int elf_prelink(unsigned char *image, unsigned int size,
+		unsigned long long base)
+{
+	elf_image_t elf;
+	Elf64_Addr low_addr = ~0ULL;
+	unsigned int i;
+	int ret;
+
+	ret = elf_parse(&elf, image, size);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	/* same load address as elf64_get_load_info() */
+	for (i = 0; i < elf.phnum; i++) {
+		if (elf.phdr[i].p_type == PT_LOAD && elf.phdr[i].p_memsz &&
+		    elf.phdr[i].p_paddr < low_addr) {
+			low_addr = elf.phdr[i].p_paddr;
+		}
+	}
+
+	if (low_addr == ~0ULL) {
+		return 0;
+	}
+
+	/* check everything first, the image is left untouched on failure */
+	if (prelink_pass(&elf, base - low_addr, 0)) {
+		return 0;
+	}
+	prelink_pass(&elf, base - low_addr, 1);
+
+	return 1;
+}
+
+int elf_load_plan(const unsigned char *image, unsigned int size,
+		  load_plan_t *plan)
+{
+	elf_image_t elf;
+	Elf64_Addr low_addr = ~0ULL, max_addr = 0;
+	load_plan_segment_t *seg;
+	unsigned int i;
+	int ret;
+
+	memset(plan, 0, sizeof(*plan));
+
+	ret = elf_parse(&elf, (unsigned char *)image, size);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	/* same footprint as elf64_get_load_info() */
+	for (i = 0; i < elf.phnum; i++) {
+		Elf64_Phdr *phdr = &elf.phdr[i];
+
+		if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+			continue;
+		}
+		if (phdr->p_paddr < low_addr) {
+			low_addr = phdr->p_paddr;
+		}
+		if (phdr->p_paddr + phdr->p_memsz > max_addr) {
+			max_addr = phdr->p_paddr + phdr->p_memsz;
+		}
+	}
+
+	/* let the ELF loader report it */
+	if (low_addr == ~0ULL || (low_addr & 0xFFF) ||
+	    max_addr - low_addr > 0xFFFFFFFFULL) {
+		return 0;
+	}
+
+	/* and the same copy as elf64_load_executable() */
+	for (i = 0; i < elf.phnum; i++) {
+		Elf64_Phdr *phdr = &elf.phdr[i];
+		Elf64_Xword filesz = phdr->p_filesz;
+
+		if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+			continue;
+		}
+
+		if (plan->segment_count == LOAD_PLAN_MAX_SEGMENTS) {
+			printf("!WARNING(packer): too many segments for a load plan\r\n");
+			memset(plan, 0, sizeof(*plan));
+			return 0;
+		}
+
+		if (filesz > phdr->p_memsz) {
+			filesz = phdr->p_memsz;
+		}
+		if (phdr->p_offset > size || filesz > size - phdr->p_offset) {
+			printf("!ERROR(packer): ELF segment out of the file\r\n");
+			return -1;
+		}
+
+		seg = &plan->segments[plan->segment_count++];
+		seg->src_offset = phdr->p_offset;
+		seg->dst_offset = phdr->p_paddr - low_addr;
+		seg->copy_size = filesz;
+		seg->zero_size = phdr->p_memsz - filesz;
+	}
+
+	plan->total_size = max_addr - low_addr;
+	plan->entry_offset = elf.ehdr->e_entry - low_addr;
+	plan->link_base = low_addr;
+
+	if (elf.rela_sz) {
+		plan->rela_offset = elf.rela_addr - low_addr;
+		plan->rela_size = elf.rela_sz;
+	}
+	if (elf.relr_sz) {
+		plan->relr_offset = elf.relr_addr - low_addr;
+		plan->relr_size = elf.relr_sz;
+	}
+	if (elf.symtab_addr) {
+		plan->symtab_offset = elf.symtab_addr - low_addr;
+	}
+
+	/* the loader expects the program headers loaded at e_phoff */
+	if (elf.ehdr->e_phoff + elf.phnum * sizeof(Elf64_Phdr) <=
+	    plan->total_size) {
+		plan->phdr_offset = elf.ehdr->e_phoff;
+		plan->phdr_count = elf.phnum;
+	}
+
+	plan->magic = LOAD_PLAN_MAGIC;
+	plan->version = LOAD_PLAN_VERSION;
+	plan->size = sizeof(load_plan_t);
+
+	return 1;
+}
@@ -0,0 +1,59 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef _ELF_RELOC_H_
+#define _ELF_RELOC_H_
+
+#include "load_plan.h"
+
+/*
+ * relocation passes on the ELF64 PIE modules (xmon_loader, startap, xmon),
+ * done in place on the file content before it is compressed and packed,
+ * and their load plan.
+ */
+
+/*
+ * move the R_X86_64_RELATIVE relocations into a DT_RELR table. The
+ * addends are stored at the targets, the RELR table takes the space freed
+ * in the RELA table and the rest of it is zeroed, so the image size does
+ * not change (LZ4 squeezes the zeroes).
+ * the image is left untouched if it is not an x86_64 PIE, or if there is
+ * no free slot in the dynamic section for the new tags.
+ * return 0 on success or if there is nothing to convert, -1 on error.
+ */
+int elf_rela_to_relr(unsigned char *image, unsigned int size);
+
+/*
+ * apply the RELR and RELA relocations for the load address base (where
+ * the lowest PT_LOAD segment goes), as elf64_do_relocation() would, so the
+ * loader can skip them when it gets that address.
+ * the image is left untouched if it is not an x86_64 PIE, or if some
+ * relocation cannot be applied to the file content (e.g. in .bss).
+ * return 1 if the image got prelinked, 0 if not, -1 on error.
+ */
+int elf_prelink(unsigned char *image, unsigned int size,
+		unsigned long long base);
+
+/*
+ * compute the load plan of an ELF64 PIE image, to be run by
+ * elf64_load_plan() with the same result as elf64_load_executable().
+ * call it last, the other passes change the relocation tables.
+ * return 1 if done, 0 if the image has no plan (not an x86_64 PIE, too
+ * many segments...), -1 on error.
+ */
+int elf_load_plan(const unsigned char *image, unsigned int size,
+		  load_plan_t *plan);
+
+#endif
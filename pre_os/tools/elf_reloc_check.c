@@ -0,0 +1,232 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Host side check of the relocation passes of xmon_packer against the
+ * loader: every module is loaded at the same address with
+ * elf64_load_plan(), once as packed without prelinking (the reference),
+ * then prelinked for that address and for addresses around it. All the
+ * loads must give the reference image.
+ * Both the RELA and the DT_RELR (--relr) forms of the module are checked.
+ *
+ * Usage: elf_reloc_check file...
+ *   file     ELF64 PIE module, e.g. xmon.elf, startap.elf
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf_reloc.h"
+
+/* common/ld/elf_ld/elf64_ld.c, returns MON_OK (0) on success */
+int elf64_load_plan(const load_plan_t *plan, const uint8_t *file,
+		    uint8_t *p_dest, uint64_t prelink_base,
+		    uint64_t *p_entry_point_address);
+
+#define LOAD_ALIGN    0x200000
+
+/* prelink addresses, relative to the load address */
+static const int64_t prelink_deltas[] = {
+	0,                      /* loaded where prelinked: nothing to do */
+	0x200000,
+	-0x200000,
+	0x40000000,
+	-0x1000,
+};
+
+static unsigned char *read_file(const char *name, unsigned int *size)
+{
+	unsigned char *buf;
+	FILE *f;
+	long len;
+
+	f = fopen(name, "rb");
+	if (f == NULL) {
+		perror(name);
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	buf = malloc(len ? len : 1);
+	if (buf && (fread(buf, 1, len, f) != (size_t)len)) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+
+	*size = (unsigned int)len;
+
+	return buf;
+}
+
+/*
+ * load image at dest, prelinked for prelink_base first unless it is 0.
+ * return 0 on success, -1 on error.
+ */
+static int load(const unsigned char *image, unsigned int size,
+		uint64_t prelink_base, uint8_t *dest, uint32_t dest_size,
+		uint64_t *entry)
+{
+	unsigned char *copy;
+	load_plan_t plan;
+	int ret = -1;
+
+	copy = malloc(size);
+	if (copy == NULL) {
+		return -1;
+	}
+	memcpy(copy, image, size);
+
+	if (prelink_base && (elf_prelink(copy, size, prelink_base) != 1)) {
+		printf("  cannot prelink for 0x%llx\n",
+			(unsigned long long)prelink_base);
+		goto exit;
+	}
+
+	if (elf_load_plan(copy, size, &plan) != 1) {
+		printf("  no load plan\n");
+		goto exit;
+	}
+
+	if (plan.total_size > dest_size) {
+		printf("  load plan size changed\n");
+		goto exit;
+	}
+
+	/* garbage, a word the loader forgets shows up */
+	memset(dest, 0xA5, dest_size);
+	if (elf64_load_plan(&plan, copy, dest, prelink_base, entry) != 0) {
+		printf("  elf64_load_plan() failed\n");
+		goto exit;
+	}
+
+	ret = 0;
+
+exit:
+	free(copy);
+
+	return ret;
+}
+
+static int check_image(const char *name, const unsigned char *image,
+		       unsigned int size)
+{
+	load_plan_t plan;
+	uint8_t *dest, *expected;
+	uint64_t ref_entry, entry, prelink_base;
+	uint32_t i, j;
+	int failed = 0;
+
+	if (elf_load_plan(image, size, &plan) != 1) {
+		printf("%s: not an x86_64 PIE, skipped\n", name);
+		return 0;
+	}
+
+	dest = aligned_alloc(LOAD_ALIGN,
+		(plan.total_size + LOAD_ALIGN - 1) & ~(LOAD_ALIGN - 1));
+	expected = malloc(plan.total_size);
+	if ((dest == NULL) || (expected == NULL)) {
+		free(dest);
+		free(expected);
+		return -1;
+	}
+
+	if (load(image, size, 0, dest, plan.total_size, &ref_entry) != 0) {
+		printf("%s: reference load failed\n", name);
+		failed = 1;
+		goto exit;
+	}
+	memcpy(expected, dest, plan.total_size);
+
+	for (i = 0; i < sizeof(prelink_deltas) / sizeof(prelink_deltas[0]);
+	     i++) {
+		prelink_base = (uint64_t)(uintptr_t)dest + prelink_deltas[i];
+
+		if (load(image, size, prelink_base, dest, plan.total_size,
+			 &entry) != 0) {
+			printf("%s: prelinked for 0x%llx: load failed\n", name,
+				(unsigned long long)prelink_base);
+			failed = 1;
+			continue;
+		}
+
+		for (j = 0; j < plan.total_size; j++) {
+			if (dest[j] != expected[j]) {
+				break;
+			}
+		}
+		if ((j < plan.total_size) || (entry != ref_entry)) {
+			printf("%s: prelinked for 0x%llx, loaded at 0x%llx: differs at offset 0x%x\n",
+				name, (unsigned long long)prelink_base,
+				(unsigned long long)(uintptr_t)dest, j);
+			failed = 1;
+		}
+	}
+
+	if (!failed) {
+		printf("%s: OK, %u bytes\n", name, plan.total_size);
+	}
+
+exit:
+	free(dest);
+	free(expected);
+
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char *image;
+	unsigned int size;
+	char name[256];
+	int failed = 0;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file...\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		image = read_file(argv[i], &size);
+		if (image == NULL) {
+			return 1;
+		}
+
+		snprintf(name, sizeof(name), "%s (RELA)", argv[i]);
+		if (check_image(name, image, size) != 0) {
+			failed = 1;
+		}
+
+		if (elf_rela_to_relr(image, size) != 0) {
+			printf("%s: RELR conversion failed\n", argv[i]);
+			failed = 1;
+		} else {
+			snprintf(name, sizeof(name), "%s (RELR)", argv[i]);
+			if (check_image(name, image, size) != 0) {
+				failed = 1;
+			}
+		}
+
+		free(image);
+	}
+
+	return failed;
+}
@@ -0,0 +1,139 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include <string.h>
+#include <stdint.h>
+
+#include "lz4_compress.h"
+
+#define MIN_MATCH       4
+#define RUN_MASK        15
+/* the spec requires the last 5 bytes to be literals, and the last
+ * match to start at least 12 bytes before the end of the block */
+#define LAST_LITERALS   5
+#define MF_LIMIT        12
+#define MAX_OFFSET      65535
+#define HASH_LOG        16
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/* write the extra length bytes of a length >= RUN_MASK */
+static unsigned char *write_length(unsigned char *op, unsigned int len)
+{
+	len -= RUN_MASK;
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+static unsigned char *write_sequence(unsigned char *op,
+				     const unsigned char *literals,
+				     unsigned int lit_len,
+				     unsigned int offset,
+				     unsigned int match_len)
+{
+	unsigned char *token = op++;
+
+	*token = (lit_len >= RUN_MASK ? RUN_MASK : lit_len) << 4;
+	if (lit_len >= RUN_MASK)
+		op = write_length(op, lit_len);
+	memcpy(op, literals, lit_len);
+	op += lit_len;
+
+	/* literals only sequence, the last one */
+	if (match_len == 0)
+		return op;
+
+	*op++ = offset & 0xff;
+	*op++ = (offset >> 8) & 0xff;
+
+	match_len -= MIN_MATCH;
+	*token |= (match_len >= RUN_MASK ? RUN_MASK : match_len);
+	if (match_len >= RUN_MASK)
+		op = write_length(op, match_len);
+
+	return op;
+}
+
+unsigned int lz4_compress(const unsigned char *src, unsigned int src_size,
+			  unsigned char *dst, unsigned int dst_size)
+{
+	static uint32_t table[1 << HASH_LOG];
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *iend = src + src_size;
+	const unsigned char *mflimit = iend - MF_LIMIT;
+	const unsigned char *match_limit = iend - LAST_LITERALS;
+	unsigned char *op = dst;
+
+	if (dst_size < LZ4_COMPRESS_BOUND(src_size))
+		return 0;
+
+	memset(table, 0xff, sizeof(table));
+
+	if (src_size > MF_LIMIT) {
+		while (ip < mflimit) {
+			uint32_t h = hash32(read32(ip));
+			const unsigned char *ref;
+			unsigned int len;
+
+			ref = (table[h] == 0xffffffff) ? NULL : src + table[h];
+			table[h] = (uint32_t)(ip - src);
+
+			if (ref == NULL || ip - ref > MAX_OFFSET ||
+			    read32(ref) != read32(ip)) {
+				ip++;
+				continue;
+			}
+
+			/* extend the match forwards */
+			len = MIN_MATCH;
+			while (ip + len < match_limit && ref[len] == ip[len])
+				len++;
+
+			/* and backwards into the pending literals */
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+				len++;
+			}
+
+			op = write_sequence(op, anchor, ip - anchor,
+					    ip - ref, len);
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	/* remaining bytes as the last literals */
+	op = write_sequence(op, anchor, iend - anchor, 0, 0);
+
+	return (unsigned int)(op - dst);
+}
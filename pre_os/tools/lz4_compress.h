@@ -0,0 +1,30 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef _LZ4_COMPRESS_H_
+#define _LZ4_COMPRESS_H_
+
+/* worst case size of lz4_compress() output for src_size input bytes */
+#define LZ4_COMPRESS_BOUND(src_size)  ((src_size) + (src_size) / 255 + 16)
+
+/*
+ * compress src into one raw LZ4 block (no frame header), decoded by
+ * lz4_decompress() in xmon_loader.
+ * return the compressed size, or 0 if it does not fit in dst_size.
+ */
+unsigned int lz4_compress(const unsigned char *src, unsigned int src_size,
+			  unsigned char *dst, unsigned int dst_size);
+
+#endif
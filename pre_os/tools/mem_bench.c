@@ -0,0 +1,451 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Host side check and benchmark of mon_memcpy()/mon_memset()
+ * (common/util/linux/common.c).
+ *
+ * The check copies and fills every size up to 1KB and sizes around the
+ * non-temporal threshold, at every source and destination alignment
+ * within 16 bytes (a few within a cache line for the large sizes), and
+ * verifies the result and the guard bytes around it.
+ *
+ * The benchmark compares the dispatched routines with the variants they
+ * replace or choose from (byte loop, rep movsb/stosb, rep movsq/stosq)
+ * and with the C library, from 16B to 32MB.
+ *
+ * Usage: mem_bench [--check]
+ *   --check  run the check only
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* common/util/linux/common.c */
+void *mon_memset(void *dest, uint8_t val, uint64_t count);
+void *mon_memcpy(void *dest, const void *src, uint64_t count);
+
+#define GUARD_SIZE       64
+#define GUARD_BYTE       0xA5
+#define CHECK_MAX_SMALL  1024
+#define CHECK_ALIGN      16
+#define NT_THRESHOLD     (2 * 1024 * 1024)
+
+#define BENCH_MIN_SIZE   16
+#define BENCH_MAX_SIZE   (32 * 1024 * 1024)
+/* bytes moved per measurement, at least one call */
+#define BENCH_BYTES      (256 * 1024 * 1024)
+
+#define CPUID_7_EBX_ERMS (1 << 9)
+#define CPUID_7_EDX_FSRM (1 << 4)
+
+/* sizes around the non-temporal threshold, checked on top of the small ones */
+static const uint64_t check_large_sizes[] = {
+	NT_THRESHOLD - 65,
+	NT_THRESHOLD - 1,
+	NT_THRESHOLD,
+	NT_THRESHOLD + 1,
+	NT_THRESHOLD + 63,
+	NT_THRESHOLD + 4097,
+};
+
+/*
+ * variants
+ */
+static void *copy_bytes(void *dest, const void *src, uint64_t count)
+{
+	volatile uint8_t *d = dest;
+	const uint8_t *s = src;
+
+	while (count--) {
+		*d++ = *s++;
+	}
+
+	return dest;
+}
+
+static void *copy_movsb(void *dest, const void *src, uint64_t count)
+{
+	void *d = dest;
+
+	__asm__ __volatile__ ("cld; rep; movsb"
+		: "+D" (d), "+S" (src), "+c" (count)
+		:
+		: "memory");
+
+	return dest;
+}
+
+static void *copy_movsq(void *dest, const void *src, uint64_t count)
+{
+	uint8_t *d = dest;
+	const uint8_t *s = src;
+	uint64_t qwords = count >> 3;
+
+	__asm__ __volatile__ ("cld; rep; movsq"
+		: "+D" (d), "+S" (s), "+c" (qwords)
+		:
+		: "memory");
+	count &= 7;
+	while (count--) {
+		*d++ = *s++;
+	}
+
+	return dest;
+}
+
+static void *copy_libc(void *dest, const void *src, uint64_t count)
+{
+	return memcpy(dest, src, count);
+}
+
+static void *set_bytes(void *dest, uint8_t val, uint64_t count)
+{
+	volatile uint8_t *d = dest;
+
+	while (count--) {
+		*d++ = val;
+	}
+
+	return dest;
+}
+
+static void *set_stosb(void *dest, uint8_t val, uint64_t count)
+{
+	void *d = dest;
+
+	__asm__ __volatile__ ("cld; rep; stosb"
+		: "+D" (d), "+c" (count)
+		: "a" (val)
+		: "memory");
+
+	return dest;
+}
+
+static void *set_stosq(void *dest, uint8_t val, uint64_t count)
+{
+	uint8_t *d = dest;
+	uint64_t qwords = count >> 3;
+
+	__asm__ __volatile__ ("cld; rep; stosq"
+		: "+D" (d), "+c" (qwords)
+		: "a" (val * 0x0101010101010101ULL)
+		: "memory");
+	count &= 7;
+	while (count--) {
+		*d++ = val;
+	}
+
+	return dest;
+}
+
+static void *set_libc(void *dest, uint8_t val, uint64_t count)
+{
+	return memset(dest, val, count);
+}
+
+typedef struct {
+	const char *name;
+	void *(*copy)(void *dest, const void *src, uint64_t count);
+	void *(*set)(void *dest, uint8_t val, uint64_t count);
+} mem_variant_t;
+
+static const mem_variant_t variants[] = {
+	{ "mon",   mon_memcpy, mon_memset },
+	{ "bytes", copy_bytes, set_bytes  },
+	{ "movsb", copy_movsb, set_stosb  },
+	{ "movsq", copy_movsq, set_stosq  },
+	{ "libc",  copy_libc,  set_libc   },
+};
+
+#define VARIANT_COUNT    (sizeof(variants) / sizeof(variants[0]))
+
+static uint8_t *alloc_lines(uint64_t size)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 64, size)) {
+		return NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * check
+ */
+static void fill_pattern(uint8_t *buf, uint64_t size, uint32_t seed)
+{
+	uint64_t i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+/* dst has GUARD_SIZE guard bytes before and after count bytes */
+static int check_guards(const uint8_t *dst, uint64_t count)
+{
+	uint64_t i;
+
+	for (i = 0; i < GUARD_SIZE; i++) {
+		if ((dst[i] != GUARD_BYTE) ||
+		    (dst[GUARD_SIZE + count + i] != GUARD_BYTE)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_one(uint8_t *dst_buf, const uint8_t *src_buf,
+		     uint64_t count, unsigned int dst_align,
+		     unsigned int src_align)
+{
+	uint8_t *dst = dst_buf + dst_align;
+	const uint8_t *src = src_buf + src_align;
+	uint8_t val = (uint8_t)(count + dst_align);
+	uint64_t i;
+
+	memset(dst, GUARD_BYTE, count + 2 * GUARD_SIZE);
+	if ((mon_memcpy(dst + GUARD_SIZE, src, count) != dst + GUARD_SIZE) ||
+	    memcmp(dst + GUARD_SIZE, src, count) ||
+	    check_guards(dst, count)) {
+		printf("mon_memcpy failed: size %llu, dst +%u, src +%u\n",
+			(unsigned long long)count, dst_align, src_align);
+		return -1;
+	}
+
+	/* memset does not depend on the source alignment */
+	if (src_align) {
+		return 0;
+	}
+
+	memset(dst, GUARD_BYTE, count + 2 * GUARD_SIZE);
+	if (mon_memset(dst + GUARD_SIZE, val, count) != dst + GUARD_SIZE) {
+		goto set_failed;
+	}
+	for (i = 0; i < count; i++) {
+		if (dst[GUARD_SIZE + i] != val) {
+			goto set_failed;
+		}
+	}
+	if (check_guards(dst, count)) {
+		goto set_failed;
+	}
+
+	return 0;
+
+set_failed:
+	printf("mon_memset failed: size %llu, dst +%u\n",
+		(unsigned long long)count, dst_align);
+	return -1;
+}
+
+static int check_sizes(uint8_t *dst_buf, const uint8_t *src_buf,
+		       uint64_t count)
+{
+	unsigned int dst_align, src_align;
+
+	for (dst_align = 0; dst_align < CHECK_ALIGN; dst_align++) {
+		for (src_align = 0; src_align < CHECK_ALIGN; src_align++) {
+			if (check_one(dst_buf, src_buf, count, dst_align,
+				      src_align)) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int run_check(void)
+{
+	uint64_t max_size = check_large_sizes[
+		sizeof(check_large_sizes) / sizeof(check_large_sizes[0]) - 1];
+	uint8_t *src_buf, *dst_buf;
+	uint64_t count;
+	unsigned int i;
+	int ret = -1;
+
+	src_buf = alloc_lines(max_size + 128);
+	dst_buf = alloc_lines(max_size + 2 * GUARD_SIZE + 128);
+	if ((src_buf == NULL) || (dst_buf == NULL)) {
+		printf("out of memory\n");
+		goto out;
+	}
+	fill_pattern(src_buf, max_size + 128, 1);
+
+	for (count = 0; count <= CHECK_MAX_SMALL; count++) {
+		if (check_sizes(dst_buf, src_buf, count)) {
+			goto out;
+		}
+	}
+
+	/* the large sizes at a few alignments only, they are slow */
+	for (i = 0; i < sizeof(check_large_sizes) / sizeof(check_large_sizes[0]); i++) {
+		count = check_large_sizes[i];
+		if (check_one(dst_buf, src_buf, count, 0, 0) ||
+		    check_one(dst_buf, src_buf, count, 1, 0) ||
+		    check_one(dst_buf, src_buf, count, 63, 5) ||
+		    check_one(dst_buf, src_buf, count, 8, 3)) {
+			goto out;
+		}
+	}
+
+	printf("check OK: sizes 0-%u and around %u\n", CHECK_MAX_SMALL,
+		NT_THRESHOLD);
+	ret = 0;
+
+out:
+	free(src_buf);
+	free(dst_buf);
+
+	return ret;
+}
+
+/*
+ * benchmark
+ */
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_features(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	__asm__ __volatile__ ("cpuid"
+		: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		: "a" (0), "c" (0));
+	if (eax < 7) {
+		ebx = edx = 0;
+	} else {
+		__asm__ __volatile__ ("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (7), "c" (0));
+	}
+
+	printf("cpu: ERMS %s, FSRM %s\n",
+		(ebx & CPUID_7_EBX_ERMS) ? "yes" : "no",
+		(edx & CPUID_7_EDX_FSRM) ? "yes" : "no");
+}
+
+/* GB/s of one variant at one size, dest and src 64 bytes aligned */
+static double bench_one(const mem_variant_t *v, int copy, uint8_t *dst,
+			const uint8_t *src, uint64_t count)
+{
+	uint64_t loops = BENCH_BYTES / count;
+	uint64_t i;
+	double start;
+
+	/* the byte loop is slow, give it less work */
+	if (v->copy == copy_bytes) {
+		loops = loops / 16 + 1;
+	}
+
+	/* warm up */
+	if (copy) {
+		v->copy(dst, src, count);
+	} else {
+		v->set(dst, 0, count);
+	}
+
+	start = now_sec();
+	for (i = 0; i < loops; i++) {
+		if (copy) {
+			v->copy(dst, src, count);
+		} else {
+			v->set(dst, (uint8_t)i, count);
+		}
+		__asm__ __volatile__ ("" : : "r" (dst) : "memory");
+	}
+
+	return (double)count * loops / (now_sec() - start) / 1e9;
+}
+
+static int run_bench(void)
+{
+	uint8_t *src, *dst;
+	uint64_t count;
+	unsigned int i;
+	int copy;
+
+	src = alloc_lines(BENCH_MAX_SIZE);
+	dst = alloc_lines(BENCH_MAX_SIZE);
+	if ((src == NULL) || (dst == NULL)) {
+		printf("out of memory\n");
+		free(src);
+		free(dst);
+		return -1;
+	}
+	fill_pattern(src, BENCH_MAX_SIZE, 2);
+	memset(dst, 0, BENCH_MAX_SIZE);
+
+	print_features();
+
+	for (copy = 1; copy >= 0; copy--) {
+		printf("\n%s, GB/s\n%10s", copy ? "copy" : "set", "size");
+		for (i = 0; i < VARIANT_COUNT; i++) {
+			printf("%9s", variants[i].name);
+		}
+		printf("\n");
+
+		for (count = BENCH_MIN_SIZE; count <= BENCH_MAX_SIZE; count <<= 1) {
+			printf("%10llu", (unsigned long long)count);
+			for (i = 0; i < VARIANT_COUNT; i++) {
+				printf("%9.2f", bench_one(&variants[i], copy,
+					dst, src, count));
+			}
+			printf("\n");
+		}
+	}
+
+	free(src);
+	free(dst);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int check_only = 0;
+
+	if ((argc > 2) ||
+	    ((argc == 2) && strcmp(argv[1], "--check"))) {
+		printf("usage: %s [--check]\n", argv[0]);
+		return 1;
+	}
+	check_only = (argc == 2);
+
+	if (run_check()) {
+		return 1;
+	}
+
+	if (check_only) {
+		return 0;
+	}
+
+	return run_bench() ? 1 : 0;
+}
@@ -14,6 +14,7 @@
 * limitations under the License.
 *******************************************************************************/
 #include <stdio.h>
+#include <stddef.h>
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +25,8 @@
 #define size_t _size_t
 #include "xmon_desc.h"
 #include "ikgtboot.h"
+#include "lz4_compress.h"
+#include "elf_reloc.h"
 
 typedef int bool;
 
@@ -44,6 +47,9 @@ typedef int bool;
 #define XMON_LOADER_FILE_OPTION   "--xmon_loader"
 #define STARTAP_FILE_OPTION "--startap"
 #define XMON_FILE_OPTION   "--xmon"
+#define COMPRESS_OPTION    "--compress"
+#define RELR_OPTION        "--relr"
+#define PRELINK_OPTION     "--prelink"
 
 
 /* could change to ikgt_pkg.bin if needed */
@@ -73,8 +79,37 @@ typedef struct {
 	 *  do not set corresponding flag
 	 */
 	unsigned int fsize;
+
+	/* the module is decoded by xmon_loader, so it can be compressed */
+	const bool compressible;
+
+	/* the module is an ELF relocated by the loader (elf64_ld.c) */
+	const bool relocatable;
+
+	/* file size before compression, and FILE_BIN_FLAG_xxx */
+	unsigned int raw_size;
+	unsigned int bin_flags;
+
+	/* load address the relocations were applied for, 0 if none */
+	unsigned int prelink_base;
+
+	/* load plan, computed for every relocatable module */
+	load_plan_t plan;
+
+	/* converted or compressed content to be packed instead of the
+	 * file, if any */
+	void *data;
 } FILE_OPTIONS;
 
+/* set by COMPRESS_OPTION */
+static bool compress_files = false;
+
+/* set by RELR_OPTION */
+static bool relr_files = false;
+
+/* set by PRELINK_OPTION */
+static bool prelink_files = false;
+
 
 /* default settings if no cmdline inputs
  *  to add new modules, just append them at the end of
@@ -92,11 +127,11 @@ static FILE_OPTIONS files_options[] = {
 	 *  the code will check this assumption.
 	 */
 	{ true, XMON_LOADER_FILE_OPTION, "xmon_loader.bin",  INDEX_TO_BITMAP_FLAG(
-		  XMON_LOADER_BIN_INDEX), 0, 0 },
+		  XMON_LOADER_BIN_INDEX), 0, 0, false, true },
 	{ true, STARTAP_FILE_OPTION,	 "startap.bin",	     INDEX_TO_BITMAP_FLAG(
-		  STARTAP_BIN_INDEX),	  0, 0 },
+		  STARTAP_BIN_INDEX),	  0, 0, true, true },
 	{ true, XMON_FILE_OPTION,	 "xmon.bin",	     INDEX_TO_BITMAP_FLAG(
-		  XMON_BIN_INDEX),	  0, 0 },
+		  XMON_BIN_INDEX),	  0, 0, true, true },
 	/* and others
 	 * (to support secondary guests' img/bins, set field "must_exist" as false)
 	 */
@@ -139,6 +174,12 @@ static void cmdline_help(FILE_OPTIONS *file_array)
 	for (idx = 0; idx < PACK_FILE_COUNT; idx++)
 		printf("  %s\t  specify the corresponding file name\r\n",
 			file_array[idx].option_name);
+	printf("  %s\t  compress startap and xmon with LZ4\r\n",
+		COMPRESS_OPTION);
+	printf("  %s\t\t  move relative relocations of the modules to DT_RELR\r\n",
+		RELR_OPTION);
+	printf("  %s\t  relocate the modules for the preferred load addresses\r\n",
+		PRELINK_OPTION);
 
 	printf("\r\nUse default file name(s), if no such option(s).\r\n\r\n");
 
@@ -153,6 +194,23 @@ static int parse_packer_cmdline(int argc, char *argv[], FILE_OPTIONS *file_array
 	int cmd_idx, file_idx;
 
 	for (cmd_idx = 1; cmd_idx < argc; ) {
+		/* options without file name */
+		if (0 == strcmp(argv[cmd_idx], COMPRESS_OPTION)) {
+			compress_files = true;
+			cmd_idx++;
+			continue;
+		}
+		if (0 == strcmp(argv[cmd_idx], RELR_OPTION)) {
+			relr_files = true;
+			cmd_idx++;
+			continue;
+		}
+		if (0 == strcmp(argv[cmd_idx], PRELINK_OPTION)) {
+			prelink_files = true;
+			cmd_idx++;
+			continue;
+		}
+
 		/* firstly searching if the option is valid */
 		for (file_idx = 0; file_idx < PACK_FILE_COUNT; file_idx++) {
 			if (0 ==
@@ -174,6 +232,13 @@ static int parse_packer_cmdline(int argc, char *argv[], FILE_OPTIONS *file_array
 		/* then move to next to get the file name(path) */
 		cmd_idx++;
 
+		if (cmd_idx == argc) {
+			printf(
+				"\r\n!ERROR(packer): option \"%s\" requires a file name\r\n\r\n",
+				argv[cmd_idx - 1]);
+			return -1;
+		}
+
 		/* must not be with prefix "--" */
 		if (0 == strncmp(argv[cmd_idx], "--", 2)) {
 			printf(
@@ -192,6 +257,109 @@ static int parse_packer_cmdline(int argc, char *argv[], FILE_OPTIONS *file_array
 }
 
 
+/*
+ * where a module is loaded if preload gets the preferred RT_MEM_BASE and
+ * LDR_MEM_BASE regions, see xmon_loader_memory_layout_t and
+ * XMON_RT_XMON_OFFSET.
+ */
+static unsigned int get_preferred_load_addr(FILE_OPTIONS *file)
+{
+	switch (file->flag) {
+	case INDEX_TO_BITMAP_FLAG(XMON_LOADER_BIN_INDEX):
+		return LDR_MEM_BASE +
+		       offsetof(xmon_loader_memory_layout_t, u_xmon_loader);
+	case INDEX_TO_BITMAP_FLAG(STARTAP_BIN_INDEX):
+		return RT_MEM_BASE + XMON_RT_STARTAP_OFFSET;
+	case INDEX_TO_BITMAP_FLAG(XMON_BIN_INDEX):
+		return RT_MEM_BASE + XMON_RT_XMON_OFFSET;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * convert the relocations of the file content, prelink it, compute its
+ * load plan and/or compress it, the compressed content is kept only if
+ * it gets smaller.
+ * fsize is updated to the packed size.
+ */
+static int prepare_file(FILE_OPTIONS *file)
+{
+	unsigned char *raw, *packed;
+	unsigned int bound = LZ4_COMPRESS_BOUND(file->raw_size);
+	unsigned int packed_size;
+	unsigned int base;
+	int ret;
+
+	raw = read_file_to_buf(file->file_name, file->raw_size);
+	if (!raw) {
+		return -1;
+	}
+
+	if (relr_files && file->relocatable &&
+	    (0 != elf_rela_to_relr(raw, file->raw_size))) {
+		printf("!ERROR(packer): failed to convert relocations of %s\r\n",
+			file->file_name);
+		free(raw);
+		return -1;
+	}
+
+	/* RELR first, the prelinked words hold the addends it moved */
+	base = get_preferred_load_addr(file);
+	if (prelink_files && file->relocatable && base) {
+		ret = elf_prelink(raw, file->raw_size, base);
+		if (ret < 0) {
+			printf("!ERROR(packer): failed to prelink %s\r\n",
+				file->file_name);
+			free(raw);
+			return -1;
+		}
+		if (ret > 0) {
+			file->prelink_base = base;
+		} else {
+			printf("!WARNING(packer): %s is not prelinked\r\n",
+				file->file_name);
+		}
+	}
+
+	/* last, the passes above change the relocation tables */
+	if (file->relocatable &&
+	    (elf_load_plan(raw, file->raw_size, &file->plan) < 0)) {
+		printf("!ERROR(packer): failed to compute the load plan of %s\r\n",
+			file->file_name);
+		free(raw);
+		return -1;
+	}
+
+	/* the content may have changed, pack it rather than the file */
+	file->data = raw;
+
+	if (!compress_files || !file->compressible) {
+		return 0;
+	}
+
+	packed = malloc(bound);
+	if (!packed) {
+		printf("!ERROR(packer): failed to allocate memory\r\n");
+		return -1;
+	}
+
+	packed_size = lz4_compress(raw, file->raw_size, packed, bound);
+
+	if (packed_size == 0 || packed_size >= file->raw_size) {
+		/* not worth it, pack the raw content */
+		free(packed);
+		return 0;
+	}
+
+	free(raw);
+	file->data = packed;
+	file->fsize = packed_size;
+	file->bin_flags |= FILE_BIN_FLAG_LZ4;
+
+	return 0;
+}
+
 /*
  *  update offset and fsize info in files_options[] array.
  */
@@ -226,6 +394,14 @@ static int update_file_info(FILE_OPTIONS *file_array)
 
 			/* update file size */
 			file_array[file_idx].fsize = fsize;
+			file_array[file_idx].raw_size = fsize;
+
+			if (fsize &&
+			    ((compress_files && file_array[file_idx].compressible) ||
+			     file_array[file_idx].relocatable) &&
+			    (0 != prepare_file(&file_array[file_idx]))) {
+				return -1;
+			}
 		} else {
 			file_array[file_idx].fsize = 0;
 		}
@@ -284,6 +460,22 @@ static int total_file_size_check(FILE_OPTIONS *file_array)
 		return -1;
 	}
 
+	/* compressed modules are decoded into the loader heap one by one */
+	for (file_idx = 0; file_idx < PACK_FILE_COUNT; file_idx++) {
+		if (!(file_array[file_idx].bin_flags & FILE_BIN_FLAG_LZ4)) {
+			continue;
+		}
+		if (file_array[file_idx].raw_size >
+		    LOADER_HEAP_SIZE - LOADER_HEAP_RESERVE) {
+			printf(
+				"\r\n!ERROR(packer): %s needs 0x%x bytes of loader heap to be decompressed, only 0x%x available. Please update macro(LOADER_HEAP_SIZE,xmon_desc.h)\r\n\r\n",
+				file_array[file_idx].file_name,
+				file_array[file_idx].raw_size,
+				LOADER_HEAP_SIZE - LOADER_HEAP_RESERVE);
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -321,7 +513,13 @@ static int pack_files(FILE_OPTIONS *file_array)
 		unsigned int fsize = file_array[file_idx].fsize;
 
 		/* if file size is zero, skip it, no need to pack it */
-		if (fsize) {
+		if (fsize && file_array[file_idx].data) {
+			/* converted or compressed content */
+			if (0 != append_buf_to_file(newfile,
+				    file_array[file_idx].data, fsize)) {
+				goto exit;
+			}
+		} else if (fsize) {
 			/* read file to tmp buffer */
 			file_buf = read_file_to_buf(fname, fsize);
 			if (!file_buf) {
@@ -384,6 +582,13 @@ static int  get_file_hdr_info(FILE_OPTIONS *file_array,
 					1].offset = file_array[file_idx].offset;
 			file_hdr->files[file_idx -
 					1].size = file_array[file_idx].fsize;
+			file_hdr->files[file_idx -
+					1].flags = file_array[file_idx].bin_flags;
+			file_hdr->files[file_idx -
+					1].raw_size = file_array[file_idx].raw_size;
+			file_hdr->files[file_idx -
+					1].prelink_base = file_array[file_idx].prelink_base;
+			file_hdr->plans[file_idx - 1] = file_array[file_idx].plan;
 		}
 	}
 
@@ -396,43 +601,69 @@ static int get_file_header_location(FILE_OPTIONS *file_array,
 {
 	FILE *starter_file = NULL;
 	unsigned int *starter_buf = NULL, *tmp;
+	xmon_loaderbin_file_mapping_header_t *starter_bin_file_hdr = NULL;
+	ikgt_loader_boot_header_t *boot_hdr;
+	unsigned int fsize = file_array[0].fsize;
 	int ret = -1;
 
 	/* we can safely assume the first one is starter.bin due to checks before */
-	starter_buf = read_file_to_buf(file_array[0].file_name, file_array[0].fsize);
+	starter_buf = read_file_to_buf(file_array[0].file_name, fsize);
 	if (!starter_buf) {
 		printf("!ERROR(packer): failed to get file content (%s)\r\n",
 			file_array[0].file_name);
 		goto exit;
 	}
 
+	/* the boot header at offset 0 carries the location, resolved
+	 * when starter.bin was linked
+	 */
+	boot_hdr = (ikgt_loader_boot_header_t *)starter_buf;
+	if ((fsize >= sizeof(ikgt_loader_boot_header_t)) &&
+	    (boot_hdr->magic == IKGT_BOOT_HEADER_MAGIC) &&
+	    boot_hdr->file_map_hdr_offset &&
+	    (boot_hdr->file_map_hdr_offset <=
+	     fsize - sizeof(xmon_loaderbin_file_mapping_header_t))) {
+		starter_bin_file_hdr = (xmon_loaderbin_file_mapping_header_t *)
+			((unsigned long)starter_buf + boot_hdr->file_map_hdr_offset);
+
+		if ((starter_bin_file_hdr->magic0 ==
+		     XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC0) &&
+		    (starter_bin_file_hdr->magic1 ==
+		     XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC1)) {
+			*hdr_offset = boot_hdr->file_map_hdr_offset;
+		} else {
+			starter_bin_file_hdr = NULL;
+		}
+	}
+
+	/* legacy starter.bin, search the magic header */
 	for (tmp = starter_buf;
+	     !starter_bin_file_hdr &&
 	     (unsigned long)tmp <
-	     ((unsigned long)starter_buf + file_array[0].fsize - 4);
+	     ((unsigned long)starter_buf + fsize - 4);
 	     tmp++) {
-		xmon_loaderbin_file_mapping_header_t *starter_bin_file_hdr;
+		xmon_loaderbin_file_mapping_header_t *hdr;
 
 		/* 4 byte aligned searching */
-		starter_bin_file_hdr = (xmon_loaderbin_file_mapping_header_t *)tmp;
+		hdr = (xmon_loaderbin_file_mapping_header_t *)tmp;
 
-		if ((starter_bin_file_hdr->magic0 ==
+		if ((hdr->magic0 ==
 		     XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC0) &&
-		    (starter_bin_file_hdr->magic1 ==
+		    (hdr->magic1 ==
 		     XMON_LOADERBIN_FILE_MAPPING_HEADER_MAGIC1)) {
 			/* get the offset to the beginning of file */
 			*hdr_offset = (unsigned long)tmp -
 				      (unsigned long)starter_buf;
-
-			if (starter_bin_file_hdr->flags != 0) {
-				printf(
-					"\r\n!ERROR(packer): why the flags are NOT zero set before by starter\r\n\r\n");
-				goto exit;
-			}
-
-			break;
+			starter_bin_file_hdr = hdr;
 		}
 	}
 
+	if (starter_bin_file_hdr && starter_bin_file_hdr->flags != 0) {
+		printf(
+			"\r\n!ERROR(packer): why the flags are NOT zero set before by starter\r\n\r\n");
+		goto exit;
+	}
+
 	ret = 0;
 
 exit:
@@ -443,7 +674,30 @@ exit:
 	return ret;
 }
 
-static int update_boot_header(FILE_OPTIONS *file_array)
+/*
+ * the xmon image size used by the boot loader to size the xmon area,
+ * 0 (use the default rt_mem_size) if the xmon load plan is not known
+ */
+static unsigned int get_xmon_image_size(FILE_OPTIONS *file_array)
+{
+	unsigned int file_idx;
+
+	for (file_idx = 0; file_idx < PACK_FILE_COUNT; file_idx++) {
+		if (file_array[file_idx].flag !=
+		    INDEX_TO_BITMAP_FLAG(XMON_BIN_INDEX)) {
+			continue;
+		}
+		if (!load_plan_is_valid(&file_array[file_idx].plan)) {
+			return 0;
+		}
+		return ALIGN_4K(file_array[file_idx].plan.total_size);
+	}
+
+	return 0;
+}
+
+static int update_boot_header(FILE_OPTIONS *file_array,
+			      unsigned int file_hdr_offset)
 {
 	FILE		   *file = NULL;
 	unsigned int   *buf  = NULL, *tmp = NULL, found = 0;
@@ -460,8 +714,14 @@ static int update_boot_header(FILE_OPTIONS *file_array)
 		goto exit;
 	}
 
+	/* the boot header is expected at offset 0 */
+	boot_hdr = (ikgt_loader_boot_header_t *) buf;
+	if (boot_hdr->magic == IKGT_BOOT_HEADER_MAGIC)
+		found = 1;
+
+	/* legacy starter.bin, search the magic header */
 	for (tmp = buf;
-		(unsigned long)tmp < ((unsigned long)buf + fsize - 4);
+		!found && (unsigned long)tmp < ((unsigned long)buf + fsize - 4);
 		tmp++){
 
 
@@ -478,11 +738,26 @@ static int update_boot_header(FILE_OPTIONS *file_array)
 	if (!found)
 		goto exit;
 
-	boot_hdr->rt_mem_size = sizeof(xmon_runtime_memory_layout_t);
+	if (hdr_offset != 0)
+		printf("!WARNING(packer): boot header is not at offset 0 of %s\r\n",
+			file_array[0].file_name);
+
+	boot_hdr->rt_mem_size = XMON_RT_DEFAULT_SIZE;
 	boot_hdr->rt_mem_base = RT_MEM_BASE;
+	boot_hdr->rt_startap_offset = XMON_RT_STARTAP_OFFSET;
+	boot_hdr->rt_sguest_offset = XMON_RT_SGUEST_OFFSET;
+	boot_hdr->rt_xmon_offset = XMON_RT_XMON_OFFSET;
+	boot_hdr->xmon_image_size = get_xmon_image_size(file_array);
+	boot_hdr->xmon_fixed_size = XMON_SIZE_FIXED;
+	boot_hdr->xmon_per_cpu_size = XMON_SIZE_PER_CPU;
+	boot_hdr->xmon_per_gb_size = XMON_SIZE_PER_GB;
+	boot_hdr->xmon_per_view_gb_size = XMON_SIZE_PER_VIEW_GB;
+	boot_hdr->xmon_view_count = XMON_DEFAULT_VIEW_COUNT;
+	boot_hdr->xmon_max_size = XMON_MAX_TOTAL_SIZE;
 	boot_hdr->ldr_mem_size = sizeof(xmon_loader_memory_layout_t);
 	boot_hdr->ldr_mem_base = LDR_MEM_BASE;
 	boot_hdr->version = BOOT_HDR_VERSION;
+	boot_hdr->file_map_hdr_offset = file_hdr_offset;
 	/* image is 4K aligned after padding later */
 	boot_hdr->image_size = ALIGN_4K(fsize);
 
@@ -523,8 +798,11 @@ exit:
 }
 
 
-/* update file header information in the new created file */
-static int update_file_header(FILE_OPTIONS *file_array)
+/* update file header information in the new created file,
+ * and return its offset to be recorded in the boot header.
+ */
+static int update_file_header(FILE_OPTIONS *file_array,
+			      unsigned int *file_hdr_offset)
 {
 	unsigned int hdr_offset = -1;
 	xmon_loaderbin_file_mapping_header_t file_hdr = {
@@ -562,6 +840,7 @@ static int update_file_header(FILE_OPTIONS *file_array)
 		goto exit;;
 	}
 
+	*file_hdr_offset = hdr_offset;
 	ret = 0;
 
 exit:
@@ -615,6 +894,7 @@ int main(int argc, char *argv[])
 {
 	int ret = 0;
 	int idx = 0;
+	unsigned int file_hdr_offset = 0;
 
 	FILE_OPTIONS *file_array = files_options;
 
@@ -653,12 +933,12 @@ int main(int argc, char *argv[])
 	}
 
 	/* update file header info */
-	ret = update_file_header(file_array);
+	ret = update_file_header(file_array, &file_hdr_offset);
 	if (ret == -1) {
 		goto error;
 	}
 
-	ret = update_boot_header(file_array);
+	ret = update_boot_header(file_array, file_hdr_offset);
 	if (ret == -1) {
 		goto error;
     }
@@ -666,7 +946,12 @@ int main(int argc, char *argv[])
 	printf("\r\n!INFO(packer): Successfully pack below binaries into %s:\r\n",
 		XMON_PKG_BIN_NAME);
 	for (idx = 0; idx < PACK_FILE_COUNT; idx++) {
-		if (file_array[idx].fsize) {
+		if (file_array[idx].fsize &&
+		    (file_array[idx].bin_flags & FILE_BIN_FLAG_LZ4)) {
+			printf("\t %20s %16d bytes (%d bytes LZ4)\n",
+				basename(file_array[idx].file_name),
+				file_array[idx].raw_size, file_array[idx].fsize);
+		} else if (file_array[idx].fsize) {
 			printf("\t %20s %16d bytes\n",
 				basename(file_array[idx].file_name), file_array[idx].fsize);
 		}
@@ -29,6 +29,57 @@
 
 static boot_protocol_ops_t *boot_protocol_ops;
 
+static void get_console_info_from_ibh(xmon_desc_t *xd,
+				      screen_console_info_t *info)
+{
+	ikgt_platform_info_t *platform_info =
+		(ikgt_platform_info_t *)(xd->initial_state.rbx);
+
+	if (platform_info == NULL) {
+		return;
+	}
+
+	if (platform_info->console_flags & IKGT_CONSOLE_VGA_TEXT) {
+		info->flags |= SCREEN_CONSOLE_VGA_TEXT;
+	}
+
+	if (platform_info->console_flags & IKGT_CONSOLE_GOP) {
+		info->flags |= SCREEN_CONSOLE_GOP;
+		info->fb_base = platform_info->fb_base;
+		info->fb_width = platform_info->fb_width;
+		info->fb_height = platform_info->fb_height;
+		info->fb_pixels_per_line = platform_info->fb_pixels_per_line;
+	}
+}
+
+static void get_cpu_ids_from_ibh(xmon_desc_t *xd, uint32_t *cpu_count,
+				 uint64_t *cpu_ids_addr)
+{
+	ikgt_platform_info_t *platform_info =
+		(ikgt_platform_info_t *)(xd->initial_state.rbx);
+
+	if ((platform_info == NULL) || (platform_info->cpu_ids_addr == 0)) {
+		return;
+	}
+
+	*cpu_count = platform_info->cpu_count;
+	*cpu_ids_addr = platform_info->cpu_ids_addr;
+}
+
+static void get_pm_timer_from_ibh(xmon_desc_t *xd, uint32_t *port,
+				  uint32_t *bits)
+{
+	ikgt_platform_info_t *platform_info =
+		(ikgt_platform_info_t *)(xd->initial_state.rbx);
+
+	if ((platform_info == NULL) || (platform_info->pm_timer_port == 0)) {
+		return;
+	}
+
+	*port = platform_info->pm_timer_port;
+	*bits = platform_info->pm_timer_bits;
+}
+
 static boot_protocol_ops_t default_ops = {
     .name   = "default",
 };
@@ -37,6 +88,9 @@ static boot_protocol_ops_t default_ops = {
 static boot_protocol_ops_t ibh_ops = {
 	.name			= "ibh",
 	.get_e820_table		= get_e820_table_from_ibh,
+	.get_console_info	= get_console_info_from_ibh,
+	.get_cpu_ids		= get_cpu_ids_from_ibh,
+	.get_pm_timer		= get_pm_timer_from_ibh,
 };
 
 boolean_t protocol_ops_init(uint32_t boot_magic)
@@ -74,3 +128,41 @@ boolean_t loader_hide_runtime_memory(xmon_desc_t *xd, uint32_t hide_mem_addr,
 	}
 }
 
+void loader_get_console_info(xmon_desc_t *xd, screen_console_info_t *info)
+{
+	info->flags = 0;
+	info->fb_width = 0;
+	info->fb_height = 0;
+	info->fb_pixels_per_line = 0;
+	info->fb_base = 0;
+
+	if (boot_protocol_ops->get_console_info) {
+		boot_protocol_ops->get_console_info(xd, info);
+	} else {
+		/* legacy boot loaders run with the BIOS text mode */
+		info->flags = SCREEN_CONSOLE_VGA_TEXT;
+	}
+}
+
+/* cpus the APs wakeup can wait for, cpu_count is 0 when unknown */
+void loader_get_cpu_ids(xmon_desc_t *xd, uint32_t *cpu_count,
+			uint64_t *cpu_ids_addr)
+{
+	*cpu_count = 0;
+	*cpu_ids_addr = 0;
+
+	if (boot_protocol_ops->get_cpu_ids) {
+		boot_protocol_ops->get_cpu_ids(xd, cpu_count, cpu_ids_addr);
+	}
+}
+
+/* ACPI PM timer startap can calibrate the TSC with, port is 0 when unknown */
+void loader_get_pm_timer(xmon_desc_t *xd, uint32_t *port, uint32_t *bits)
+{
+	*port = 0;
+	*bits = 0;
+
+	if (boot_protocol_ops->get_pm_timer) {
+		boot_protocol_ops->get_pm_timer(xd, port, bits);
+	}
+}
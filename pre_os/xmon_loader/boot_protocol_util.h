@@ -18,6 +18,7 @@
 #define BOOT_PROTOCOL_UTIL_H
 
 #include "xmon_desc.h"
+#include "screen.h"
 
 #define true 1
 #define false 0
@@ -28,6 +29,11 @@ typedef struct {
 	boolean_t (*get_e820_table)(xmon_desc_t *td, uint64_t *e820_addr);
 	boolean_t (*hide_runtime_memory)(xmon_desc_t *xd, uint32_t hide_mem_addr,
 					uint32_t hide_mem_size);
+	void (*get_console_info)(xmon_desc_t *xd,
+				 screen_console_info_t *info);
+	void (*get_cpu_ids)(xmon_desc_t *xd, uint32_t *cpu_count,
+			    uint64_t *cpu_ids_addr);
+	void (*get_pm_timer)(xmon_desc_t *xd, uint32_t *port, uint32_t *bits);
 } boot_protocol_ops_t;
 
 boolean_t protocol_ops_init(uint32_t boot_magic);
@@ -35,5 +41,9 @@ boolean_t loader_get_e820_table(xmon_desc_t *td, uint64_t *e820_addr);
 boolean_t loader_hide_runtime_memory(xmon_desc_t *xd,
 				    uint32_t hide_mem_addr,
 				    uint32_t hide_mem_size);
+void loader_get_console_info(xmon_desc_t *xd, screen_console_info_t *info);
+void loader_get_cpu_ids(xmon_desc_t *xd, uint32_t *cpu_count,
+			uint64_t *cpu_ids_addr);
+void loader_get_pm_timer(xmon_desc_t *xd, uint32_t *port, uint32_t *bits);
 
 #endif    /* BOOT_PROTOCOL_UTIL_H */
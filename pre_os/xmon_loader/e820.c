@@ -25,7 +25,14 @@
 #include "ikgtboot.h"
 /* data struct definition for EFI memory map 
    xmon loader parses the e820 from EFI mmap struct */
+
+/* the only layout of efi_memory_desc_t, as GetMemoryMap() reports it */
+#define EFI_MEMORY_DESCRIPTOR_VERSION   1
+
+/* descriptor size assumed if preload does not pass it on */
 #define EFI_E820_SIZE_PADDING           8
+#define EFI_DEFAULT_DESC_SIZE           (sizeof(efi_memory_desc_t) + \
+					 EFI_E820_SIZE_PADDING)
 typedef enum {
     EfiAcpiAddressRangeMemory   = 1,
     EfiAcpiAddressRangeReserved = 2,
@@ -86,13 +93,128 @@ efi_acpi_memory_t EfiTypeToE820Type(uint32_t Type)
 }
 
 
+typedef int15_e820_memory_map_entry_ext_t e820_entry_t;
+
+static void set_entry(e820_entry_t *entry, uint64_t base, uint64_t end,
+		      uint32_t type)
+{
+	entry->basic_entry.base_address = base;
+	entry->basic_entry.length = end - base;
+	entry->basic_entry.address_range_type = type;
+	entry->extended_attributes.uint32 = 0;
+	entry->extended_attributes.bits.enabled = 1;
+}
+
+/*
+ * add [base, end) of type, minus the part covered by the carved out
+ * range [carve_base, carve_end), returns the number of entries added
+ */
+static uint32_t add_range(e820_entry_t *entry, uint64_t base, uint64_t end,
+			  uint32_t type, uint64_t carve_base, uint64_t carve_end)
+{
+	uint32_t n = 0;
+
+	if ((end <= carve_base) || (base >= carve_end)) {
+		set_entry(entry, base, end, type);
+		return 1;
+	}
+
+	if (base < carve_base) {
+		set_entry(&entry[n++], base, carve_base, type);
+	}
+	if (end > carve_end) {
+		set_entry(&entry[n++], carve_end, end, type);
+	}
+
+	return n;
+}
+
+/*
+ * insertion sort by base address, firmware maps are sorted or nearly
+ * sorted already, so this is linear in practice
+ */
+static void sort_entries(e820_entry_t *entry, uint32_t count)
+{
+	e820_entry_t tmp;
+	uint32_t i, j;
+
+	for (i = 1; i < count; i++) {
+		if (entry[i - 1].basic_entry.base_address <=
+		    entry[i].basic_entry.base_address) {
+			continue;
+		}
+
+		tmp = entry[i];
+		for (j = i; (j > 0) && (entry[j - 1].basic_entry.base_address >
+					tmp.basic_entry.base_address); j--)
+			entry[j] = entry[j - 1];
+		entry[j] = tmp;
+	}
+}
+
+/*
+ * merge adjacent and overlapping entries of the same type, for
+ * overlapping entries of different types the lower one wins. Returns
+ * the new count.
+ */
+static uint32_t merge_entries(e820_entry_t *entry, uint32_t count)
+{
+	uint64_t cur_end, base, end;
+	uint32_t out = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		base = entry[i].basic_entry.base_address;
+		end = base + entry[i].basic_entry.length;
+
+		if (out == 0) {
+			entry[out++] = entry[i];
+			continue;
+		}
+
+		cur_end = entry[out - 1].basic_entry.base_address +
+			  entry[out - 1].basic_entry.length;
+
+		if (base < cur_end) {
+			/* overlap, drop the covered part */
+			if (end <= cur_end) {
+				continue;
+			}
+			if (entry[i].basic_entry.address_range_type !=
+			    entry[out - 1].basic_entry.address_range_type) {
+				base = cur_end;
+			}
+		}
+
+		if ((base <= cur_end) &&
+		    (entry[i].basic_entry.address_range_type ==
+		     entry[out - 1].basic_entry.address_range_type)) {
+			entry[out - 1].basic_entry.length =
+				end - entry[out - 1].basic_entry.base_address;
+			continue;
+		}
+
+		set_entry(&entry[out++], base, end,
+			entry[i].basic_entry.address_range_type);
+	}
+
+	return out;
+}
+
+/*
+ * build the E820 table from the EFI memory map passed on by preload:
+ * the runtime memory is carved out (reserved) while converting, then the
+ * entries are sorted and coalesced, see e820_lookup.h
+ */
 boolean_t get_e820_table_from_ibh(xmon_desc_t *xd, uint64_t *e820_addr)
 {
 	int15_e820_memory_map_t      *e820 = NULL;
 	ikgt_platform_info_t         *platform_info = NULL;
-	efi_memory_desc_t            *efi_map;
+	efi_memory_desc_t            *next;
+	uint64_t                     efi_map;
+	uint64_t                     base, carve_base, carve_end;
 	uint32_t                     desc_size, map_size;
-	uint32_t                     count, i;
+	uint32_t                     count, n, i;
 
 	platform_info = (ikgt_platform_info_t *)(xd->initial_state.rbx);
 
@@ -100,25 +222,54 @@ boolean_t get_e820_table_from_ibh(xmon_desc_t *xd, uint64_t *e820_addr)
 		return FALSE;
 
 	map_size = platform_info->memmap_size;
-	desc_size = sizeof(efi_memory_desc_t)+EFI_E820_SIZE_PADDING;
-	count = map_size/desc_size;
-	efi_map = (efi_memory_desc_t *) (uint64_t)platform_info->memmap_addr;
+	desc_size = platform_info->memmap_desc_size;
+	if (desc_size == 0) {
+		desc_size = EFI_DEFAULT_DESC_SIZE;
+	}
+	if (desc_size < sizeof(efi_memory_desc_t)) {
+		return FALSE;
+	}
+	/* 0 from a preload that did not pass it */
+	if ((platform_info->memmap_desc_version != 0) &&
+	    (platform_info->memmap_desc_version !=
+	     EFI_MEMORY_DESCRIPTOR_VERSION)) {
+		return FALSE;
+	}
+	count = map_size / desc_size;
+	efi_map = (uint64_t)platform_info->memmap_addr;
 
-	e820 = (int15_e820_memory_map_t *)allocate_memory(PAGE_ALIGN_4K(map_size));
+	carve_base = xd->runtime_mem_addr;
+	carve_end = xd->runtime_mem_addr + xd->runtime_mem_size;
+
+	/* carving may split one range into two, plus the carved range */
+	e820 = (int15_e820_memory_map_t *)allocate_memory(
+		sizeof(e820->memory_map_size) +
+		(count + 2) * sizeof(e820_entry_t));
 	if (e820 == NULL)
 		return FALSE;
 
-	for (i = 0; i < count; i++)
-	{
-		efi_memory_desc_t *next = (efi_memory_desc_t*)((uint64_t)efi_map+desc_size*i);
+	n = 0;
+	for (i = 0; i < count; i++) {
+		next = (efi_memory_desc_t *)(efi_map + (uint64_t)desc_size * i);
+		if (next->num_pages == 0) {
+			continue;
+		}
 
-		e820->memory_map_entry[i].basic_entry.base_address = next->phys_addr;
-		e820->memory_map_entry[i].basic_entry.length = next->num_pages * 0x1000;
-		e820->memory_map_entry[i].basic_entry.address_range_type = EfiTypeToE820Type(next->type);
-		e820->memory_map_entry[i].extended_attributes.bits.enabled = 1;
+		base = next->phys_addr;
+		n += add_range(&e820->memory_map_entry[n], base,
+			base + next->num_pages * 0x1000,
+			EfiTypeToE820Type(next->type), carve_base, carve_end);
 	}
 
-	e820->memory_map_size = count * sizeof(int15_e820_memory_map_entry_ext_t);
+	if (carve_end > carve_base) {
+		set_entry(&e820->memory_map_entry[n++], carve_base, carve_end,
+			EfiAcpiAddressRangeReserved);
+	}
+
+	sort_entries(e820->memory_map_entry, n);
+	n = merge_entries(e820->memory_map_entry, n);
+
+	e820->memory_map_size = n * sizeof(e820_entry_t);
 
 	*e820_addr = (uint64_t)e820;
 
@@ -22,6 +22,7 @@
 #include "xmon_desc.h"
 #include "common.h"
 #include "screen.h"
+#include "loader_log.h"
 #include "memory.h"
 #include "error_code.h"
 #include "ikgtboot.h"
@@ -228,7 +229,8 @@ void save_other_cpu_state(mon_guest_cpu_startup_state_t *s)
 	sel.sel16 = __readldtr();
 
 	if (sel.bits.index != 0) {
-		print_string("Invalid sel.bits.index\n");
+		LOG_STRING(LOG_LEVEL_ERROR, LOG_SS_GUEST,
+			"Invalid sel.bits.index\n");
 		return;
 	}
 
@@ -262,7 +264,8 @@ mon_guest_startup_t *setup_primary_guest_env(xmon_desc_t *xd)
 				allocate_memory(num_of_cpu *
 		sizeof(mon_guest_cpu_startup_state_t));
 	if (!primary_guest_bsp_cpu) {
-		print_string("Heap Out of Memory (mon_guest_cpu_startup_state_t)\n");
+		LOG_STRING(LOG_LEVEL_ERROR, LOG_SS_GUEST,
+			"Heap Out of Memory (mon_guest_cpu_startup_state_t)\n");
 		return NULL;
 	}
 
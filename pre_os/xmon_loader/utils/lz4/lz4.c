@@ -0,0 +1,122 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include <mon_defs.h>
+#include <common.h>
+#include <lz4.h>
+
+/*
+ * LZ4 block format:
+ *   sequence := token [literal length bytes] literals
+ *               offset(LE16) [match length bytes]
+ *   token    := literal length (high 4 bits), match length - 4 (low 4 bits)
+ * A length of 15 in the token is continued with bytes until one < 255.
+ * The last sequence has literals only.
+ */
+#define LZ4_MIN_MATCH     4
+#define LZ4_RUN_MASK      15
+
+typedef uint64_t __attribute__ ((__may_alias__, aligned(1))) unaligned_u64_t;
+
+static boolean_t read_length(const uint8_t **ip, const uint8_t *iend,
+			     uint32_t *len, uint32_t limit)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= iend) {
+			return FALSE;
+		}
+		b = *(*ip)++;
+		*len += b;
+		/* also avoids any overflow of len */
+		if (*len > limit) {
+			return FALSE;
+		}
+	} while (b == 255);
+
+	return TRUE;
+}
+
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_size,
+		       uint8_t *dst, uint32_t dst_size)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = src + src_size;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + dst_size;
+	const uint8_t *match;
+	uint32_t token, len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* literals */
+		len = token >> 4;
+		if (len == LZ4_RUN_MASK &&
+		    !read_length(&ip, iend, &len, dst_size)) {
+			return -1;
+		}
+		if ((len > (uint32_t)(iend - ip)) ||
+		    (len > (uint32_t)(oend - op))) {
+			return -1;
+		}
+		mon_memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* the last sequence ends right after its literals */
+		if (ip == iend) {
+			break;
+		}
+
+		/* match */
+		if (iend - ip < 2) {
+			return -1;
+		}
+		offset = ip[0] | ((uint32_t)ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (uint32_t)(op - dst))) {
+			return -1;
+		}
+
+		len = token & LZ4_RUN_MASK;
+		if (len == LZ4_RUN_MASK &&
+		    !read_length(&ip, iend, &len, dst_size)) {
+			return -1;
+		}
+		len += LZ4_MIN_MATCH;
+		if (len > (uint32_t)(oend - op)) {
+			return -1;
+		}
+
+		match = op - offset;
+		if (offset >= sizeof(uint64_t)) {
+			/* 8 byte chunks never overlap the bytes being written */
+			while (len >= sizeof(uint64_t)) {
+				*(unaligned_u64_t *)op = *(const unaligned_u64_t *)match;
+				op += sizeof(uint64_t);
+				match += sizeof(uint64_t);
+				len -= sizeof(uint64_t);
+			}
+		}
+		/* short tail, or overlapped copy repeating the last offset bytes */
+		while (len--) {
+			*op++ = *match++;
+		}
+	}
+
+	return (int32_t)(op - dst);
+}
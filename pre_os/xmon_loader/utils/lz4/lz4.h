@@ -0,0 +1,29 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef LZ4_H
+#define LZ4_H
+
+#include "common_types.h"
+
+/*
+ * Decompress one raw LZ4 block (no frame header) from src into dst.
+ * Return the number of bytes written to dst, or -1 if the input is
+ * malformed or does not fit in dst_size.
+ */
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_size,
+		       uint8_t *dst, uint32_t dst_size);
+
+#endif                          /* LZ4_H */
@@ -17,42 +17,245 @@
 #include <xmon_loader.h>
 #include <memory.h>
 #include <screen.h>
+#include <common.h>
 
-static uint32_t heap_base;
-static uint32_t heap_current;
-static uint32_t heap_tops;
+/*
+ * Loader heap arena.
+ *
+ * Memory is carved from the heap with an aligned bump pointer. Freed
+ * blocks of up to MEM_MAX_CLASS_SIZE bytes go to per size class free
+ * lists (power of 2 classes), larger ones to a first fit list, and a
+ * block freed at the top of the heap moves the bump pointer back. The
+ * size of a block is not stored, free_memory() gets it from the caller.
+ *
+ * Allocations are zeroed unless MEM_ALLOC_NO_ZERO is given.
+ */
+#define MEM_ALLOCATE_ALIGNMENT  16
+#define MEM_MIN_CLASS_SHIFT     4       /* 16 bytes */
+#define MEM_MAX_CLASS_SHIFT     12      /* 4KB */
+#define MEM_CLASS_COUNT         (MEM_MAX_CLASS_SHIFT - MEM_MIN_CLASS_SHIFT + 1)
+#define MEM_MAX_CLASS_SIZE      (1ULL << MEM_MAX_CLASS_SHIFT)
+
+#define PAGE_SIZE (1024 * 4)
+
+typedef struct mem_free_block {
+	struct mem_free_block *next;
+	uint64_t size;
+} mem_free_block_t;
+
+static uint64_t heap_base;
+static uint64_t heap_current;
+static uint64_t heap_tops;
+
+static mem_free_block_t *free_lists[MEM_CLASS_COUNT];
+static mem_free_block_t *free_large;
+
+static mem_stats_t heap_stats;
 
 void_t zero_mem(void_t *address, uint64_t size)
 {
-	uint8_t *source;
+	mon_memset(address, 0, size);
+}
+
+static uint32_t size_to_class(uint64_t size)
+{
+	uint32_t shift = MEM_MIN_CLASS_SHIFT;
 
-	source = (uint8_t *)address;
-	while (size--)
-		*source++ = 0;
+	while ((1ULL << shift) < size)
+		shift++;
+
+	return shift - MEM_MIN_CLASS_SHIFT;
 }
 
+/* the size a request of size bytes really takes in the heap */
+static uint64_t round_size(uint64_t size)
+{
+	if (size <= MEM_MAX_CLASS_SIZE) {
+		return 1ULL << (size_to_class(size) + MEM_MIN_CLASS_SHIFT);
+	}
+
+	return ALIGN_FORWARD(size, MEM_ALLOCATE_ALIGNMENT);
+}
 
-#define MEM_ALLOCATE_ALIGNMENT	8
-/*
- * allocate_memory(): Simple memory allocation routine */
-void_t *allocate_memory(uint64_t size_request)
+static uint64_t bump(uint64_t size, uint64_t align)
 {
-	uint64_t address;
+	uint64_t address = ALIGN_FORWARD(heap_current, align);
 
-	if (heap_current + size_request > heap_tops) {
+	if ((address > heap_tops) || (size > heap_tops - address)) {
 		PRINT_STRING("Allocation request exceeds heap's size\r\n");
-		PRINT_STRING_AND_VALUE("Heap current = 0x", heap_current);
-		PRINT_STRING_AND_VALUE("Requested size = 0x", size_request);
+		PRINT_STRING_AND_VALUE("Aligned heap current = 0x", address);
+		PRINT_STRING_AND_VALUE("Requested size = 0x", size);
 		PRINT_STRING_AND_VALUE("Heap tops = 0x", heap_tops);
+		return 0;
+	}
+
+	heap_current = address + size;
+	if (heap_current - heap_base > heap_stats.high_water) {
+		heap_stats.high_water = heap_current - heap_base;
+	}
+
+	return address;
+}
+
+/* first fit, the rest of the block stays in the list */
+static uint64_t take_large(uint64_t size, uint64_t align)
+{
+	mem_free_block_t **prev;
+	mem_free_block_t *block;
+	uint64_t address;
+
+	for (prev = &free_large; *prev != NULL; prev = &(*prev)->next) {
+		block = *prev;
+		address = (uint64_t)block;
+		if ((address & (align - 1)) || (block->size < size)) {
+			continue;
+		}
+
+		if (block->size == size) {
+			*prev = block->next;
+		} else {
+			mem_free_block_t *rest = (mem_free_block_t *)(address + size);
+
+			rest->next = block->next;
+			rest->size = block->size - size;
+			*prev = rest;
+		}
+		return address;
+	}
+
+	return 0;
+}
+
+/*
+ * the large free list is sorted by address, adjacent blocks are merged,
+ * and a block ending at the top of the heap gives the memory back to
+ * the bump pointer */
+static void_t free_large_block(uint64_t address, uint64_t size)
+{
+	mem_free_block_t *before = NULL;
+	mem_free_block_t *after = free_large;
+	mem_free_block_t *block;
+
+	while ((after != NULL) && ((uint64_t)after < address)) {
+		before = after;
+		after = after->next;
+	}
+
+	if ((before != NULL) && ((uint64_t)before + before->size == address)) {
+		block = before;
+		block->size += size;
+	} else {
+		block = (mem_free_block_t *)address;
+		block->size = size;
+		block->next = after;
+		if (before != NULL) {
+			before->next = block;
+		} else {
+			free_large = block;
+		}
+		before = NULL;
+	}
+
+	if ((after != NULL) && ((uint64_t)block + block->size == (uint64_t)after)) {
+		block->size += after->size;
+		block->next = after->next;
+	}
+
+	/* it is the last block, find the one before it to unlink it */
+	if ((uint64_t)block + block->size == heap_current) {
+		heap_current = (uint64_t)block;
+		if (free_large == block) {
+			free_large = NULL;
+		} else {
+			for (before = free_large; before->next != block;
+			     before = before->next)
+				;
+			before->next = NULL;
+		}
+	}
+}
+
+/*
+ * allocate_memory_ex(): allocate size bytes aligned to align (a power of
+ * 2), zeroed unless MEM_ALLOC_NO_ZERO is set in flags */
+void_t *allocate_memory_ex(uint64_t size_request, uint64_t align, uint32_t flags)
+{
+	uint64_t size = round_size(size_request);
+	uint64_t address = 0;
 
-		return NULL;
+	if (align < MEM_ALLOCATE_ALIGNMENT) {
+		align = MEM_ALLOCATE_ALIGNMENT;
 	}
-	address = ALIGN_FORWARD(heap_current, MEM_ALLOCATE_ALIGNMENT);
-	heap_current += size_request;
-	zero_mem((void_t *)address, size_request);
+
+	if (size <= MEM_MAX_CLASS_SIZE) {
+		mem_free_block_t **list = &free_lists[size_to_class(size)];
+
+		if ((*list != NULL) && (((uint64_t)*list & (align - 1)) == 0)) {
+			address = (uint64_t)*list;
+			*list = (*list)->next;
+		}
+	} else {
+		address = take_large(size, align);
+	}
+
+	if (address == 0) {
+		address = bump(size, align);
+		if (address == 0) {
+			return NULL;
+		}
+	}
+
+	if (!(flags & MEM_ALLOC_NO_ZERO)) {
+		zero_mem((void_t *)address, size);
+	}
+
+	heap_stats.alloc_count++;
+
 	return (void_t *)address;
 }
 
+/*
+ * allocate_memory(): zeroed memory allocation routine */
+void_t *allocate_memory(uint64_t size_request)
+{
+	return allocate_memory_ex(size_request, MEM_ALLOCATE_ALIGNMENT, 0);
+}
+
+/*
+ * free_memory(): size_request must be the size the block was allocated
+ * with */
+void_t free_memory(void_t *address, uint64_t size_request)
+{
+	uint64_t size = round_size(size_request);
+	mem_free_block_t *block = (mem_free_block_t *)address;
+
+	if (address == NULL) {
+		return;
+	}
+
+	heap_stats.free_count++;
+
+	if (size <= MEM_MAX_CLASS_SIZE) {
+		mem_free_block_t **list;
+
+		if ((uint64_t)address + size == heap_current) {
+			heap_current = (uint64_t)address;
+			return;
+		}
+
+		list = &free_lists[size_to_class(size)];
+		block->next = *list;
+		*list = block;
+	} else {
+		free_large_block((uint64_t)address, size);
+	}
+}
+
+void_t get_memory_stats(mem_stats_t *stats)
+{
+	*stats = heap_stats;
+}
+
 /* print_e820_bios_memory_map(): Routine to print the E820 BIOS memory map */
 void_t print_e820_bios_memory_map(void_t)
 {
@@ -60,25 +263,40 @@ void_t print_e820_bios_memory_map(void_t)
 
 void_t initialize_memory_manager(uint64_t heap_base_address, uint64_t heap_bytes)
 {
+	uint32_t i;
+
 	heap_base = heap_base_address;
 	heap_current = heap_base;
 	heap_tops = heap_base + heap_bytes;
+
+	for (i = 0; i < MEM_CLASS_COUNT; i++)
+		free_lists[i] = NULL;
+	free_large = NULL;
+
+	zero_mem(&heap_stats, sizeof(heap_stats));
+	heap_stats.heap_size = heap_bytes;
 }
 
 void_t copy_mem(void_t *dest, void_t *source, uint64_t size)
 {
-	uint8_t *d = (uint8_t *)dest;
-	uint8_t *s = (uint8_t *)source;
-
-	while (size--)
-		*d++ = *s++;
+	mon_memcpy(dest, source, size);
 }
 
+typedef uint64_t __attribute__((__may_alias__, aligned(1))) mem_u64_t;
+
 boolean_t compare_mem(void_t *source1, void_t *source2, uint64_t size)
 {
 	uint8_t *s1 = (uint8_t *)source1;
 	uint8_t *s2 = (uint8_t *)source2;
 
+	/* 8 bytes at a time, then the tail */
+	for (; size >= 8; size -= 8, s1 += 8, s2 += 8) {
+		if (*(mem_u64_t *)s1 != *(mem_u64_t *)s2) {
+			PRINT_STRING("Compare mem failed\n");
+			return FALSE;
+		}
+	}
+
 	while (size--) {
 		if (*s1++ != *s2++) {
 			PRINT_STRING("Compare mem failed\n");
@@ -88,26 +306,11 @@ boolean_t compare_mem(void_t *source1, void_t *source2, uint64_t size)
 	return TRUE;
 }
 
-#define PAGE_SIZE (1024 * 4)
-
 void *CDECL mon_page_alloc(uint64_t pages)
 {
-	uint64_t address;
-	uint64_t size = pages * PAGE_SIZE;
-
-	address = ALIGN_FORWARD(heap_current, PAGE_SIZE);
+	heap_stats.page_alloc_count++;
 
-	if (address + size > heap_tops) {
-		PRINT_STRING("Allocation request exceeds heap's size\r\n");
-		PRINT_STRING_AND_VALUE("Page aligned heap current = 0x", address);
-		PRINT_STRING_AND_VALUE("Requested size = 0x", size);
-		PRINT_STRING_AND_VALUE("Heap tops = 0x", heap_tops);
-		return NULL;
-	}
-
-	heap_current = address + size;
-	zero_mem((void *)address, size);
-	return (void *)address;
+	return allocate_memory_ex(pages * PAGE_SIZE, PAGE_SIZE, 0);
 }
 
 void __cpuid(uint64_t cpu_info[4], uint64_t info_type)
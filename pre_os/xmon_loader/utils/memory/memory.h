@@ -21,8 +21,27 @@
 
 void_t zero_mem(void_t *address, uint64_t size);
 
+/* allocate_memory_ex() flags */
+#define MEM_ALLOC_NO_ZERO       0x1     /* caller overwrites the whole block */
+
+typedef struct {
+	uint64_t heap_size;
+	/* peak number of heap bytes in use (including free list blocks) */
+	uint64_t high_water;
+	uint32_t alloc_count;
+	uint32_t free_count;
+	uint32_t page_alloc_count;
+	uint32_t pad;
+} mem_stats_t;
+
 void_t *allocate_memory(uint64_t size);
 
+void_t *allocate_memory_ex(uint64_t size, uint64_t align, uint32_t flags);
+
+void_t free_memory(void_t *address, uint64_t size);
+
+void_t get_memory_stats(mem_stats_t *stats);
+
 void_t print_e820_bios_memory_map(void_t);
 
 void_t initialize_memory_manager(uint64_t heap_base_address, uint64_t heap_bytes);
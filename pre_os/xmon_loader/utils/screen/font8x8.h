@@ -0,0 +1,25 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef FONT8X8_H
+#define FONT8X8_H
+
+#define FONT8X8_FIRST   0x20
+#define FONT8X8_LAST    0x7E
+
+extern const uint8_t font8x8[FONT8X8_LAST - FONT8X8_FIRST + 1][8];
+
+#endif                          /* FONT8X8_H */
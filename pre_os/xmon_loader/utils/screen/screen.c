@@ -13,11 +13,71 @@
 * See the License for the specific language governing permissions and
 * limitations under the License.
 *******************************************************************************/
-
 #include <mon_defs.h>
 #include <xmon_loader.h>
 #include <screen.h>
 #include "loader_serial.h"
+#include "font8x8.h"
+
+/*
+ * Log output is fanned out to the sinks picked by screen_init() from the
+ * consoles the boot loader reported, a print_* call touches nothing else.
+ * Until screen_init() only the memory ring is written.
+ */
+#define MAX_SINKS     4
+
+static const screen_sink_t *sinks[MAX_SINKS];
+static uint32_t sink_count;
+
+/*---------------------------- memory ring sink ----------------------------*/
+
+/*
+ * Last LOG_RING_SIZE bytes of output, found in a memory dump by its magic.
+ * next counts all the bytes written, the oldest one is at next % size.
+ */
+#define LOG_RING_MAGIC  0x474E4952474F4C58ULL /* "XLOGRING" */
+#define LOG_RING_SIZE   0x1000
+
+static struct {
+	uint64_t magic;
+	uint32_t size;
+	uint32_t next;
+	uint8_t data[LOG_RING_SIZE];
+} log_ring;
+
+static void_t ring_write(const uint8_t *string)
+{
+	uint32_t next = log_ring.next;
+
+	if (log_ring.magic == 0) {
+		log_ring.magic = LOG_RING_MAGIC;
+		log_ring.size = LOG_RING_SIZE;
+	}
+
+	for (; *string != 0; string++, next++)
+		log_ring.data[next & (LOG_RING_SIZE - 1)] = *string;
+
+	log_ring.next = next;
+}
+
+static const screen_sink_t ring_sink = {
+	.name	= "ring",
+	.write	= ring_write,
+};
+
+/*------------------------------ serial sink -------------------------------*/
+
+static void_t serial_write(const uint8_t *string)
+{
+	loader_serial_puts((char *)string);
+}
+
+static const screen_sink_t serial_sink = {
+	.name	= "serial",
+	.write	= serial_write,
+};
+
+/*--------------------------- VGA text mode sink ---------------------------*/
 
 /* There are actually 50, but we start to count from 0 */
 #define MAX_ROWS      49
@@ -27,7 +87,7 @@
 
 static uint8_t *cursor = (uint8_t *)VGA_BASE_ADDRESS;
 
-void_t clear_screen()
+static void_t vga_clear(void)
 {
 	uint32_t index;
 
@@ -37,7 +97,7 @@ void_t clear_screen()
 	cursor = (uint8_t *)VGA_BASE_ADDRESS;
 }
 
-void_t print_string(uint8_t *string)
+static void_t vga_write(const uint8_t *string)
 {
 	uint32_t index;
 
@@ -49,6 +109,9 @@ void_t print_string(uint8_t *string)
 				((uint64_t)cursor -
 				 VGA_BASE_ADDRESS) / (MAX_COLOUMNS * 2);
 			line_number++;
+			if (line_number >= MAX_ROWS) {
+				line_number = 0;
+			}
 			cursor =
 				(uint8_t *)(line_number * MAX_COLOUMNS *
 					    2) + VGA_BASE_ADDRESS;
@@ -57,15 +120,198 @@ void_t print_string(uint8_t *string)
 			cursor += 2;
 		}
 	}
+}
+
+static const screen_sink_t vga_sink = {
+	.name	= "vga",
+	.write	= vga_write,
+	.clear	= vga_clear,
+};
+
+/*------------------------- GOP framebuffer sink ---------------------------*/
 
-	/*
-	 * print log through serial port.
-	 */
-	loader_serial_puts(string);
+/*
+ * Text on the linear framebuffer left by the firmware, 32 bits per pixel.
+ * Glyphs are doubled on large screens. Output wraps to the top instead of
+ * scrolling, framebuffer reads are slow; the line about to be written is
+ * cleared first.
+ */
+#define FB_FOREGROUND   0x00C0C0C0
+#define FB_BACKGROUND   0x00000000
+
+static struct {
+	volatile uint32_t *base;
+	uint32_t pixels_per_line;
+	uint32_t scale;
+	uint32_t cols;
+	uint32_t rows;
+	uint32_t col;
+	uint32_t row;
+} fb;
+
+static void_t fb_fill_cell(uint32_t col, uint32_t row, const uint8_t *glyph)
+{
+	uint32_t cell = 8 * fb.scale;
+	volatile uint32_t *line;
+	uint32_t x, y;
+	uint8_t bits;
+
+	line = fb.base + (uint64_t)row * cell * fb.pixels_per_line +
+	       (uint64_t)col * cell;
+
+	for (y = 0; y < cell; y++, line += fb.pixels_per_line) {
+		bits = glyph ? glyph[y / fb.scale] : 0;
+		for (x = 0; x < cell; x++) {
+			line[x] = (bits & (0x80 >> (x / fb.scale))) ?
+				  FB_FOREGROUND : FB_BACKGROUND;
+		}
+	}
+}
+
+static void_t fb_clear_row(uint32_t row)
+{
+	uint32_t col;
+
+	for (col = 0; col < fb.cols; col++)
+		fb_fill_cell(col, row, NULL);
+}
+
+static void_t fb_new_line(void)
+{
+	fb.col = 0;
+	fb.row++;
+	if (fb.row >= fb.rows) {
+		fb.row = 0;
+	}
+	fb_clear_row(fb.row);
+}
+
+static void_t fb_clear(void)
+{
+	uint32_t row;
+
+	for (row = 0; row < fb.rows; row++)
+		fb_clear_row(row);
+	fb.col = 0;
+	fb.row = 0;
+}
+
+static void_t fb_write(const uint8_t *string)
+{
+	uint8_t c;
+
+	for (; *string != 0; string++) {
+		c = *string;
+		if (c == '\n') {
+			fb_new_line();
+			continue;
+		}
+		if ((c < FONT8X8_FIRST) || (c > FONT8X8_LAST)) {
+			c = '?';
+		}
+		fb_fill_cell(fb.col, fb.row, font8x8[c - FONT8X8_FIRST]);
+		fb.col++;
+		if (fb.col >= fb.cols) {
+			fb_new_line();
+		}
+	}
+}
+
+static const screen_sink_t fb_sink = {
+	.name	= "gop",
+	.write	= fb_write,
+	.clear	= fb_clear,
+};
+
+static boolean_t fb_init(const screen_console_info_t *info)
+{
+	if ((info->fb_base == 0) || (info->fb_width < 8) ||
+	    (info->fb_height < 8) ||
+	    (info->fb_pixels_per_line < info->fb_width)) {
+		return FALSE;
+	}
+
+	fb.base = (volatile uint32_t *)info->fb_base;
+	fb.pixels_per_line = info->fb_pixels_per_line;
+	fb.scale = (info->fb_width >= 1600) ? 2 : 1;
+	fb.cols = info->fb_width / (8 * fb.scale);
+	fb.rows = info->fb_height / (8 * fb.scale);
+	fb.col = 0;
+	fb.row = 0;
+
+	return TRUE;
+}
+
+/*--------------------------------------------------------------------------*/
+
+boolean_t screen_add_sink(const screen_sink_t *sink)
+{
+	uint32_t i;
+
+	for (i = 0; i < sink_count; i++) {
+		if (sinks[i] == sink) {
+			return TRUE;
+		}
+	}
+
+	if (sink_count >= MAX_SINKS) {
+		return FALSE;
+	}
+
+	sinks[sink_count++] = sink;
+
+	return TRUE;
+}
+
+void_t screen_init(const screen_console_info_t *info)
+{
+	sink_count = 0;
+
+	screen_add_sink(&ring_sink);
+
+	if (loader_serial_active()) {
+		screen_add_sink(&serial_sink);
+	}
+
+	if (info == NULL) {
+		return;
+	}
+
+	if ((info->flags & SCREEN_CONSOLE_GOP) && fb_init(info)) {
+		screen_add_sink(&fb_sink);
+		fb_clear();
+	} else if (info->flags & SCREEN_CONSOLE_VGA_TEXT) {
+		screen_add_sink(&vga_sink);
+	}
+}
+
+void_t clear_screen(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < sink_count; i++) {
+		if (sinks[i]->clear) {
+			sinks[i]->clear();
+		}
+	}
+}
+
+void_t print_string(uint8_t *string)
+{
+	uint32_t i;
+
+	if (sink_count == 0) {
+		ring_write(string);
+		return;
+	}
+
+	for (i = 0; i < sink_count; i++)
+		sinks[i]->write(string);
 }
 
 void_t print_value(uint32_t value)
 {
+	uint8_t string[9];
 	uint32_t index;
 	uint8_t character;
 
@@ -74,14 +320,11 @@ void_t print_value(uint32_t value)
 		if (character > '9') {
 			character = character - '0' - 10 + 'A';
 		}
-		*cursor = character;
-		cursor += 2;
+		string[index] = character;
 	}
+	string[8] = 0;
 
-	/*
-	 * print log through serial port.
-	 */
-	loader_serial_put_hex(value, 1);
+	print_string(string);
 }
 
 void_t print_string_value(uint8_t *string, uint32_t value)
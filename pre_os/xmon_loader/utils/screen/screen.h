@@ -17,6 +17,27 @@
 #ifndef SCREEN_H
 #define SCREEN_H
 
+/* consoles reported by the boot loader */
+#define SCREEN_CONSOLE_VGA_TEXT   0x1   /* legacy text buffer at 0xB8000 */
+#define SCREEN_CONSOLE_GOP        0x2   /* 32bpp linear framebuffer */
+
+typedef struct {
+	uint32_t flags;                 /* SCREEN_CONSOLE_xxx */
+	uint32_t fb_width;
+	uint32_t fb_height;
+	uint32_t fb_pixels_per_line;
+	uint64_t fb_base;
+} screen_console_info_t;
+
+typedef struct {
+	const char *name;
+	void_t (*write)(const uint8_t *string);
+	void_t (*clear)(void);          /* optional */
+} screen_sink_t;
+
+void_t screen_init(const screen_console_info_t *info);
+boolean_t screen_add_sink(const screen_sink_t *sink);
+
 void_t clear_screen(void);
 void_t print_string(uint8_t *string);
 void_t print_value(uint32_t value);
@@ -19,6 +19,9 @@
  * file		: x32_pt64.c
  * purpose	: Configures 4G memory space for 64-bit mode
  *			: while runnning in 32-bit mode
+ * note		: not linked into xmon_loader, the UEFI boot path
+ *			: enters the loader in 64-bit mode on the firmware
+ *			: identity map, which startap keeps for the APs
  *
  *----------------------------------------------------*/
 
@@ -21,6 +21,7 @@
 #include "startap.h"
 #include "loader.h"
 #include "image_loader.h"
+#include "elf64_ld.h"
 #include "memory.h"
 #include "xmon_desc.h"
 #include "common.h"
@@ -30,27 +31,73 @@
 #include "cmdline.h"
 #include "string.h"
 #include "loader_serial.h"
+#include "loader_log.h"
+#include "boot_trace.h"
+#include "lz4.h"
 
 void __cpuid(int cpu_info[4], int info_type);
 extern mon_guest_startup_t *setup_primary_guest_env(xmon_desc_t *td);
 
 static uint64_t get_xmon_img_base(xmon_desc_t *xmon_desc)
 {
-	xmon_runtime_memory_layout_t *rt_mem;
-
-	rt_mem = (xmon_runtime_memory_layout_t *)xmon_desc->runtime_mem_addr;
-
-
-	return (uint64_t)rt_mem->u_xmon.img_base;
+	return xmon_desc->runtime_mem_addr +
+	       xmon_desc->runtime_layout.xmon_offset;
 }
 
 static uint64_t get_startap_img_base(xmon_desc_t *xmon_desc)
 {
-	xmon_runtime_memory_layout_t *rt_mem;
+	return xmon_desc->runtime_mem_addr +
+	       xmon_desc->runtime_layout.startap_offset;
+}
 
-	rt_mem = (xmon_runtime_memory_layout_t *)xmon_desc->runtime_mem_addr;
+/*
+ * get the ELF file image of a module packed in the package. Compressed
+ * modules are decoded into a heap staging buffer first, which is then
+ * parsed by get_image_info()/load_image() as the raw file would be.
+ */
+static boolean_t get_module_image(module_file_info_t *file,
+				  void **image,
+				  uint64_t *image_size)
+{
+	void *staging;
+	int32_t size;
 
-	return (uint64_t)rt_mem->u_startap_img.base;
+	if (!(file->flags & FILE_BIN_FLAG_LZ4)) {
+		*image = (void *)(file->addr);
+		*image_size = file->size;
+		return TRUE;
+	}
+
+	if (file->raw_size == 0) {
+		return FALSE;
+	}
+
+	/* fully written by the decoder, no need to zero it */
+	staging = allocate_memory_ex(file->raw_size, sizeof(uint64_t),
+		MEM_ALLOC_NO_ZERO);
+	if (staging == NULL) {
+		return FALSE;
+	}
+
+	size = lz4_decompress((const uint8_t *)(file->addr), file->size,
+		(uint8_t *)staging, file->raw_size);
+	if ((size < 0) || ((uint32_t)size != file->raw_size)) {
+		free_memory(staging, file->raw_size);
+		return FALSE;
+	}
+
+	*image = staging;
+	*image_size = file->raw_size;
+
+	return TRUE;
+}
+
+/* give the staging buffer of get_module_image() back to the heap */
+static void put_module_image(module_file_info_t *file, void *image)
+{
+	if (file->flags & FILE_BIN_FLAG_LZ4) {
+		free_memory(image, file->raw_size);
+	}
 }
 
 /*
@@ -67,6 +114,23 @@ cmdline_string_options_t xmon_cmdline_options[] = {
 	/* io debug port for xmon dbg message print */
 	{ "iobase=",  "0"				 },
 
+	/* baud rate of the debug port, decimal */
+	{ "baud=",    "115200"				 },
+
+	/*
+	 * debug uart, overrides iobase= and baud=:
+	 * uart=<io|mmio|mmio32>,<base>[,<baud>[,<clock hz>]]
+	 */
+	{ "uart=",    "0"				 },
+
+	/* loader log level (0 none .. 5 trace) and subsystem mask (hex) */
+	{ "loglevel=", ""				 },
+	{ "logmask=",  ""				 },
+
+	/* AP startup INIT-SIPI-SIPI timing: legacy or modern, by default
+	 * startap picks it from the cpu family */
+	{ "sipi=",     ""				 },
+
 	/* keep this as last one */
 	{ "\0",	      "\0"				 }
 };
@@ -90,6 +154,111 @@ static uint32_t get_io_base_from_cmdline_option()
 	return io_base;
 }
 
+/*
+ * get serial baud rate in cmdline from grub, 0 selects the default.
+ */
+static uint32_t get_baud_from_cmdline_option()
+{
+	const char *baudstr =
+		get_cmdline_value_str(xmon_cmdline_options, "baud=");
+
+	if (baudstr == NULL) {
+		return 0;
+	}
+
+	return (uint32_t)strtoul(baudstr, NULL, 10);
+}
+
+static boolean_t str_starts_with(const char *str, const char *prefix)
+{
+	return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+/*
+ * get debug uart from cmdline from grub, "uart=" first, then the legacy
+ * "iobase=" and "baud=". base 0 in cfg means no serial port output.
+ */
+static void get_uart_from_cmdline_option(loader_serial_config_t *cfg)
+{
+	const char *uartstr =
+		get_cmdline_value_str(xmon_cmdline_options, "uart=");
+	char *p;
+
+	cfg->base = 0;
+	cfg->type = LOADER_SERIAL_IO;
+	cfg->reg_shift = 0;
+	cfg->clock = 0;
+	cfg->baud = 0;
+
+	if ((uartstr == NULL) || (strchr(uartstr, ',') == NULL)) {
+		cfg->base = get_io_base_from_cmdline_option();
+		cfg->baud = get_baud_from_cmdline_option();
+		return;
+	}
+
+	if (str_starts_with(uartstr, "mmio32,")) {
+		cfg->type = LOADER_SERIAL_MMIO32;
+		cfg->reg_shift = 2;
+	} else if (str_starts_with(uartstr, "mmio,")) {
+		cfg->type = LOADER_SERIAL_MMIO8;
+	} else if (!str_starts_with(uartstr, "io,")) {
+		return;
+	}
+
+	p = strchr(uartstr, ',') + 1;
+	cfg->base = strtoul(p, &p, 16);
+	if (*p == ',') {
+		cfg->baud = (uint32_t)strtoul(p + 1, &p, 10);
+	}
+	if (*p == ',') {
+		cfg->clock = (uint32_t)strtoul(p + 1, &p, 10);
+	}
+}
+
+/*
+ * get the AP startup timing asked for in cmdline from grub, INIT32_APS_xxx.
+ */
+static uint16_t get_sipi_from_cmdline_option()
+{
+	const char *str = get_cmdline_value_str(xmon_cmdline_options, "sipi=");
+
+	if (str == NULL) {
+		return 0;
+	}
+
+	if (str_starts_with(str, "legacy")) {
+		return INIT32_APS_SIPI_LEGACY;
+	}
+
+	if (str_starts_with(str, "modern")) {
+		return INIT32_APS_SIPI_MODERN;
+	}
+
+	return 0;
+}
+
+/*
+ * get loader log level and subsystem mask in cmdline from grub, keep the
+ * build defaults for the ones not given.
+ */
+static void get_log_from_cmdline_option(uint32_t *level, uint32_t *mask)
+{
+	const char *str;
+
+	*level = LOG_LEVEL_DEFAULT;
+	*mask = LOG_SS_ALL;
+
+	str = get_cmdline_value_str(xmon_cmdline_options, "loglevel=");
+	if ((str != NULL) && (str[0] != '\0')) {
+		*level = (uint32_t)strtoul(str, NULL, 10);
+	}
+
+	str = get_cmdline_value_str(xmon_cmdline_options, "logmask=");
+	if ((str != NULL) && (str[0] != '\0')) {
+		*mask = (uint32_t)strtoul(str, NULL, 16);
+	}
+}
+
 static boolean_t setup_startup_env(xmon_desc_t *xmon_desc,
 				   mon_guest_startup_t *primary_guest,
 				   mon_guest_startup_t *secondary_guest_array,
@@ -135,8 +304,14 @@ static boolean_t setup_startup_env(xmon_desc_t *xmon_desc,
 
 	mon_env->secondary_guests_startup_state_array = (uint64_t)(secondary_guest_array);
 
-	/* set debug params */
-	uint16_t io_base = get_io_base_from_cmdline_option();
+	/* set debug params, xmon itself only drives port i/o uarts */
+	loader_serial_config_t uart_cfg;
+	uint16_t io_base = 0;
+
+	get_uart_from_cmdline_option(&uart_cfg);
+	if (uart_cfg.type == LOADER_SERIAL_IO) {
+		io_base = (uint16_t)uart_cfg.base;
+	}
 
 	if (io_base == 0) {
 		mon_env->debug_params.port.type = MON_DEBUG_PORT_NONE;
@@ -189,7 +364,127 @@ static uint32_t setup_env(xmon_desc_t *xd)
 	return XMON_LOADER_SUCCESS;
 }
 
-uint32_t xmon_loader(xmon_desc_t *xd)
+/*
+ * work the APs kicked by startap take on while xmon is loaded, see
+ * ap_work.h. Large segment copies and zeroing are split in chunks of
+ * LOADER_WORK_CHUNK_SIZE, smaller ones are not worth waking the APs.
+ */
+#define LOADER_WORK_CHUNK_SIZE          0x10000
+
+static ap_work_queue_t *loader_work_queue;
+
+typedef struct {
+	uint8_t *dest;
+	const uint8_t *src;
+} loader_copy_args_t;
+
+static void CDECL copy_chunk(uint64_t start, uint64_t end, void *arg)
+{
+	loader_copy_args_t *args = (loader_copy_args_t *)arg;
+
+	mon_memcpy(args->dest + start, args->src + start, end - start);
+}
+
+static void CDECL zero_chunk(uint64_t start, uint64_t end, void *arg)
+{
+	mon_memset((uint8_t *)arg + start, 0, end - start);
+}
+
+static void parallel_copy(void *dest, const void *src, size_t count)
+{
+	loader_copy_args_t args;
+
+	if (count <= LOADER_WORK_CHUNK_SIZE) {
+		mon_memcpy(dest, src, count);
+		return;
+	}
+
+	args.dest = (uint8_t *)dest;
+	args.src = (const uint8_t *)src;
+	ap_work_parallel_for(loader_work_queue, copy_chunk, &args, 0, count,
+		LOADER_WORK_CHUNK_SIZE);
+}
+
+static void parallel_zero(void *dest, size_t count)
+{
+	if (count <= LOADER_WORK_CHUNK_SIZE) {
+		mon_memset(dest, 0, count);
+		return;
+	}
+
+	ap_work_parallel_for(loader_work_queue, zero_chunk, dest, 0, count,
+		LOADER_WORK_CHUNK_SIZE);
+}
+
+/*
+ * take size bytes off the end of the xmon area, page aligned, for what
+ * must outlive the loader: preload frees the loader memory (and so the
+ * heap) once xmon is launched, the runtime memory stays reserved.
+ * returns NULL if the xmon area is too small.
+ */
+static void *alloc_runtime_tail(xmon_desc_t *xd, uint64_t size)
+{
+	uint64_t total_size = xd->xmon.total_size & ~(uint64_t)(PAGE_4KB_SIZE - 1);
+
+	size = MON_PAGE_ALIGN_4K(size);
+	if (size >= total_size) {
+		return NULL;
+	}
+
+	xd->xmon.total_size = total_size - size;
+
+	return (void *)(xd->runtime_mem_addr + xd->runtime_layout.xmon_offset +
+			xd->xmon.total_size);
+}
+
+/*
+ * check-in slots, startup stacks and work queue for the APs woken by
+ * startap, one entry per cpu listed by the ACPI MADT, or per cpu xmon
+ * supports when the boot loader could not tell. The APs enter xmon on
+ * these stacks, so they are taken from the runtime memory, see
+ * alloc_runtime_tail().
+ */
+static uint32_t alloc_ap_tables(xmon_desc_t *xd)
+{
+	init32_struct_t *init32 = &(xd->startap.init32);
+	uint32_t max_aps;
+	uint64_t slots_size;
+	uint64_t stacks_size;
+	uint8_t *ap_tables;
+	void *ap_slots;
+	void *ap_stacks;
+	ap_work_queue_t *work_queue;
+
+	max_aps = init32->i32_num_of_cpus;
+	if (0 == max_aps) {
+		max_aps = MON_MAX_CPU_SUPPORTED;
+	}
+
+	/* slots first, the block is page aligned, the stacks keep the
+	 * queue AP_SLOT_SIZE aligned */
+	slots_size = (uint64_t)max_aps * sizeof(ap_slot_t);
+	stacks_size = (uint64_t)max_aps * STARTUP_AP_STACK_SIZE;
+	ap_tables = alloc_runtime_tail(xd,
+		slots_size + stacks_size + sizeof(ap_work_queue_t));
+	if (NULL == ap_tables) {
+		return XMON_LOADER_RUNTIME_MEM_TOO_SMALL;
+	}
+	ap_slots = ap_tables;
+	ap_stacks = ap_tables + slots_size;
+	work_queue = (ap_work_queue_t *)(ap_tables + slots_size + stacks_size);
+	ap_work_init(work_queue, (ap_slot_t *)ap_slots, max_aps);
+
+	init32->i32_max_aps = max_aps;
+	init32->i32_ap_stack_size = STARTUP_AP_STACK_SIZE;
+	init32->i32_ap_slots = (uint64_t)ap_slots;
+	init32->i32_ap_stacks = (uint64_t)ap_stacks;
+	init32->i32_work_queue = (uint64_t)work_queue;
+	loader_work_queue = work_queue;
+
+	return XMON_LOADER_SUCCESS;
+}
+
+static uint32_t load_and_start_xmon(xmon_desc_t *xd)
 {
 	static init64_struct_t init64;
 	static init32_struct_t init32;
@@ -206,6 +501,7 @@ uint32_t xmon_loader(xmon_desc_t *xd)
 
 	void *p_xmon = NULL;
 	void *p_startap = NULL;
+	uint64_t image_size;
 	void *p_low_mem = (void *)AP_WAKEUP_BOOTSTRAP_CODE_ADDR;
 
 	int info[4] = { 0, 0, 0, 0 };
@@ -217,6 +513,15 @@ uint32_t xmon_loader(xmon_desc_t *xd)
 	uint64_t kentry, mb_info;
 
 	uint32_t ret;
+	mem_stats_t heap_stats;
+	loader_serial_config_t uart_cfg;
+	screen_console_info_t console_info;
+	uint32_t log_level;
+	uint32_t log_mask;
+	boot_trace_header_t *trace = boot_trace_get(xd->boot_trace_addr);
+
+	boot_trace_record(trace, BOOT_TRACE_LOADER_ENTRY, 0, 0);
+	xd->startap.init32.i32_flags = 0;
 
 	if (!protocol_ops_init(xd->initial_state.rax)) {
 		print_string("protocol_ops_init failed\n");
@@ -228,42 +533,31 @@ uint32_t xmon_loader(xmon_desc_t *xd)
 	 * This function should be called after parsing grub cmdline.
 	 * And before init, no log will be print through serial port.
 	 */
-	loader_serial_init(get_io_base_from_cmdline_option());
-
-	/* Init loader heap, run-time space, and idt. */
-	heap_init(xd);
+	get_uart_from_cmdline_option(&uart_cfg);
+	loader_serial_init(&uart_cfg);
 
-	xd->xmon.img_base = get_xmon_img_base(xd);
-	p_xmon = (void *)(xd->xmon_file.addr);
-	image_info_status = get_image_info(p_xmon,
-		xd->xmon_file.size,
-		&(xd->xmon.hdr_info));
-	if ((image_info_status != IMAGE_INFO_OK) ||
-	    (xd->xmon.hdr_info.machine_type != IMAGE_MACHINE_EM64T) ||
-	    (xd->xmon.hdr_info.load_size == 0) ||
-	    (xd->xmon.hdr_info.load_size > xd->xmon.total_size)) {
-		return XMON_LOADER_FAILED_TO_GET_XMON_IMG_INFO;
-	}
+	/* log to the serial port and the consoles the boot loader found */
+	loader_get_console_info(xd, &console_info);
+	screen_init(&console_info);
 
-	/* Load xmon image */
-	ok = load_image(p_xmon,
-		(void *)(xd->xmon.img_base),
-		xd->xmon.hdr_info.load_size,
-		&call_xmon);
-	if (!ok) {
-		return XMON_LOADER_FAILED_TO_LOAD_XMON_IMG;
-	}
+	get_log_from_cmdline_option(&log_level, &log_mask);
+	loader_log_init(log_level, log_mask, print_string, print_value, trace);
 
-	xd->xmon.entry_point = (uint32_t)call_xmon;
+	/* Init loader heap, run-time space, and idt. */
+	heap_init(xd);
+	boot_trace_record(trace, BOOT_TRACE_LOADER_HEAP_INIT, 0, LOADER_HEAP_SIZE);
 
 	/* Load startap image */
 	xd->startap.img_base = get_startap_img_base(xd);
 	xd->startap.total_size = STARTAP_IMG_SIZE;
 
-	p_startap = (void *)(xd->startap_file.addr);
+	if (!get_module_image(&xd->startap_file, &p_startap, &image_size)) {
+		return XMON_LOADER_FAILED_TO_DECOMPRESS_STARTAP;
+	}
 
-	image_info_status = get_image_info((void *)p_startap,
-		xd->startap_file.size,
+	image_info_status = get_planned_image_info((void *)p_startap,
+		image_size,
+		(const load_plan_t *)xd->startap_file.plan_addr,
 		&(xd->startap.hdr_info));
 	if ((image_info_status != IMAGE_INFO_OK) ||
 	    (xd->startap.hdr_info.machine_type != IMAGE_MACHINE_EM64T) ||
@@ -272,43 +566,145 @@ uint32_t xmon_loader(xmon_desc_t *xd)
 		return XMON_LOADER_FAILED_TO_GET_STARTAP_IMG_INFO;
 	}
 
-	ok = load_image((void *)p_startap,
+	ok = load_planned_image((void *)p_startap,
 		(void *)(xd->startap.img_base),
-		xd->startap.hdr_info.load_size, &call_startap);
+		xd->startap.hdr_info.load_size,
+		(const load_plan_t *)xd->startap_file.plan_addr,
+		xd->startap_file.prelink_base, &call_startap);
 
 	if (!ok) {
 		return XMON_LOADER_FAILED_TO_LOAD_STARTAP_IMG;
 	}
 
 	xd->startap.entry_point = call_startap;
+	put_module_image(&xd->startap_file, p_startap);
+	boot_trace_record4(trace, BOOT_TRACE_LOADER_STARTAP_LOADED, 0,
+		xd->startap.hdr_info.load_size, xd->startap.img_base,
+		call_startap, 0);
+
+	/* wake the APs now, they check in while xmon is loaded */
+	/* TODO:
+      actually for 64 boot flow, xmon_loader only need to prepare the xmon_struct,
+      and xmon_entry, for init32, init64 we can remove now, will do it in a cleanup
+      patch later
+    */
+	xd->startap.init32.i32_low_memory_page = (uint32_t)(uint64_t)p_low_mem;
+	xd->startap.init32.i32_num_of_aps = MON_MAX_CPU_SUPPORTED-1;
+	xd->startap.init32.i32_flags = INIT32_APS_KICK |
+		get_sipi_from_cmdline_option();
+	/* lets startap stop waiting once all of them checked in */
+	loader_get_cpu_ids(xd, &(xd->startap.init32.i32_num_of_cpus),
+		&(xd->startap.init32.i32_cpu_ids));
+	/* lets startap calibrate the TSC when CPUID does not tell it */
+	loader_get_pm_timer(xd, &(xd->startap.init32.i32_pm_timer_port),
+		&(xd->startap.init32.i32_pm_timer_bits));
+	ret = alloc_ap_tables(xd);
+	if (XMON_LOADER_SUCCESS != ret) {
+		return ret;
+	}
+	call_startap_entry = (startap_image_entry_point_t)(call_startap);
+	call_startap_entry(&(xd->startap.init32), &(xd->startap.init64), NULL,
+		0, trace);
+	/* the BSP does the work alone when no AP came up */
+	if (xd->startap.init32.i32_flags & INIT32_APS_KICKED) {
+		elf64_set_load_plan_mem_ops(parallel_copy, parallel_zero);
+	}
+
+	xd->xmon.img_base = get_xmon_img_base(xd);
+	if (!get_module_image(&xd->xmon_file, &p_xmon, &image_size)) {
+		return XMON_LOADER_FAILED_TO_DECOMPRESS_XMON;
+	}
+	image_info_status = get_planned_image_info(p_xmon,
+		image_size,
+		(const load_plan_t *)xd->xmon_file.plan_addr,
+		&(xd->xmon.hdr_info));
+	if ((image_info_status != IMAGE_INFO_OK) ||
+	    (xd->xmon.hdr_info.machine_type != IMAGE_MACHINE_EM64T) ||
+	    (xd->xmon.hdr_info.load_size == 0) ||
+	    (xd->xmon.hdr_info.load_size > xd->xmon.total_size)) {
+		return XMON_LOADER_FAILED_TO_GET_XMON_IMG_INFO;
+	}
+
+	/* Load xmon image */
+	ok = load_planned_image(p_xmon,
+		(void *)(xd->xmon.img_base),
+		xd->xmon.hdr_info.load_size,
+		(const load_plan_t *)xd->xmon_file.plan_addr,
+		xd->xmon_file.prelink_base,
+		&call_xmon);
+	/* the APs leave the work queue once startap releases them */
+	elf64_set_load_plan_mem_ops(NULL, NULL);
+	if (!ok) {
+		return XMON_LOADER_FAILED_TO_LOAD_XMON_IMG;
+	}
+
+	xd->xmon.entry_point = (uint32_t)call_xmon;
+	put_module_image(&xd->xmon_file, p_xmon);
+	boot_trace_record4(trace, BOOT_TRACE_LOADER_XMON_LOADED, 0,
+		xd->xmon.hdr_info.load_size, xd->xmon.img_base, call_xmon, 0);
 
 	/* setup xmon/primary/secondary guests startup env */
 	ret = setup_env(xd);
 	if (XMON_LOADER_SUCCESS != ret) {
-		print_string("LOADER: failed to setup environment..\n");
+		LOG_STRING(LOG_LEVEL_ERROR, LOG_SS_LOADER,
+			"LOADER: failed to setup environment..\n");
 		return ret;
 	}
+	boot_trace_record(trace, BOOT_TRACE_LOADER_SETUP_ENV, 0, 0);
 
 	/* hide xmon/startap runtime memories*/
 	if (TRUE != loader_hide_runtime_memory(xd, xd->runtime_mem_addr,
-			XMON_RUNTIME_MEMORY_SIZE)) {
-		print_string("LOADER: failed to hide runtime memory..\n");
+			xd->runtime_mem_size)) {
+		LOG_STRING(LOG_LEVEL_ERROR, LOG_SS_LOADER,
+			"LOADER: failed to hide runtime memory..\n");
 		return XMON_FAILED_TO_HIDE_RUNTIME_MEMORY;
 	}
 
-	/* TODO:
-      actually for 64 boot flow, xmon_loader only need to prepare the xmon_struct,
-      and xmon_entry, for init32, init64 we can remove now, will do it in a cleanup
-      patch later
-    */
-	xd->startap.init32.i32_low_memory_page = (uint32_t)(uint64_t)p_low_mem;
-	xd->startap.init32.i32_num_of_aps = MON_MAX_CPU_SUPPORTED-1;
+	get_memory_stats(&heap_stats);
+	boot_trace_record(trace, BOOT_TRACE_LOADER_HEAP_HIGH_WATER, 0,
+		heap_stats.high_water);
+	boot_trace_record4(trace, BOOT_TRACE_LOADER_HEAP_ALLOCS, 0,
+		heap_stats.alloc_count, heap_stats.free_count, 0, 0);
 
-	call_startap_entry = (startap_image_entry_point_t)(call_startap);
-	call_startap_entry(&(xd->startap.init32), &(xd->startap.init64), &xd->mon_env, (uint64_t)call_xmon);
+	boot_trace_record(trace, BOOT_TRACE_LOADER_CALL_STARTAP, 0, 0);
+
+	/* startap/xmon drive the port themselves, send out what is queued */
+	loader_serial_flush();
+
+	call_startap_entry(&(xd->startap.init32), &(xd->startap.init64), &xd->mon_env,
+		(uint64_t)call_xmon, trace);
 
 	while (1) {
 	}
 }
 
+/* leave the APs kicked by load_and_start_xmon() as the OS expects them */
+static void park_kicked_aps(xmon_desc_t *xd)
+{
+	startap_image_entry_point_t call_startap_entry;
+
+	if (!(xd->startap.init32.i32_flags & INIT32_APS_KICKED)) {
+		return;
+	}
+
+	xd->startap.init32.i32_flags |= INIT32_APS_PARK;
+	call_startap_entry =
+		(startap_image_entry_point_t)(xd->startap.entry_point);
+	call_startap_entry(&(xd->startap.init32), &(xd->startap.init64), NULL,
+		0, boot_trace_get(xd->boot_trace_addr));
+}
+
+uint32_t xmon_loader(xmon_desc_t *xd)
+{
+	uint32_t ret;
+
+	ret = load_and_start_xmon(xd);
+	park_kicked_aps(xd);
+
+	/* only failures get here, do not lose the messages explaining them */
+	loader_serial_flush();
+
+	return ret;
+}
+
 /* End of file */
@@ -23,6 +23,7 @@
 #include "x32_init64.h"
 #include "em64t_defs.h"
 #include "ap_procs_init.h"
+#include "ap_work.h"
 #include "gdt.h"
 /*************************************************************************
  * AP startup algorithm
@@ -30,34 +31,77 @@
  * BSP:
  * 1. Copy ap_start_up_code + GDT to low memory page
  * 2. Clear APs counter
- * 3. Send SIPI to all processors excluding self
- * 4. Wait timeout
+ * 3. Send INIT and the first SIPI to all processors excluding self
+ *    (ap_procs_kick(), the BSP may go on with other work from here)
+ * 4. Send the second SIPI and wait timeout (ap_procs_collect()), both are
+ *    cut short once all the APs listed by the ACPI MADT checked in
  * APs on SIPI receive:
- * 1. Switch to protected mode
- * 2. lock inc APs counter + remember my AP number
- * 3. Loop on wait_lock1 until it changes zero
+ * 1. Switch to protected mode, then to 64-bit mode
+ * 2. lock xadd the check-in ticket, it is my AP number, and store my local
+ *    APIC ID (from CPUID) in my slot of the loader provided ap_slots
+ * 3. Set the stack the loader provided for my AP number, enter "C" code
+ * 4. Wait on my own slot until it is released or parked, meanwhile take
+ *    work from the loader's work queue whenever the doorbell in my slot
+ *    rings (ap_work.h)
  * -------- Stage 2 ----------
  * BSP after timeout:
- * 5. Read number of APs and allocate memory for stacks
- * 6. Save GDT and IDT in global array
- * 7. Clear ready_counter count
- * 8. Set wait_lock1 to 1
- * 9. Loop on ready_counter until it will be equal to number of APs
- * APs on wait_1_lock set
- * 4. Set stack in a right way
- * 5. Set right GDT and IDT
- * 6. Enter "C" code
- * 7. Increment ready_counter
- * 8. Loop on wait_lock2 until it changes from zero
+ * 5. Read number of APs, park the slots of the APs that were not counted
+ * 6. Release its children in the release tree (ap_procs_run())
+ * 7. Wait until they report ready
+ * APs on release:
+ * 5. Release my children in the tree, wait until they report ready
+ * 6. Report ready in my slot, call the user function
+ * The tree has AP_RELEASE_FANOUT children per node, so every slot has a
+ * single writer for each field and no cache line is shared by all the
+ * APs, and the release takes log(N) steps.
  * -------- Stage 3 ----------
- * BSP after ready_counter becomes == APs number
- * 10. Return to user
+ * BSP after its children are ready
+ * 8. Return to user
  * PROBLEM:
  * NMI may crash the system in it comes before AP stack init done
  ***************************************************************************/
 
 #define IA32_DEBUG_IO_PORT   0x80
 #define INITIAL_WAIT_FOR_APS_TIMEOUT_IN_MILIS 750000
+/* INIT-SIPI-SIPI timeouts according to manual, for older cpus */
+#define LEGACY_INIT_TO_SIPI_DELAY_IN_USEC     10000
+#define LEGACY_SIPI_TO_SIPI_DELAY_IN_USEC     200000
+/* cpus with an integrated local APIC that take the SIPI right away: Intel
+ * family 6 and later (but not the Pentium 4, family 0Fh), AMD and Hygon
+ * family 0Fh and later */
+#define MODERN_INIT_TO_SIPI_DELAY_IN_USEC     10
+#define MODERN_SIPI_TO_SIPI_DELAY_IN_USEC     200
+
+/* CPUID.0 vendor, EBX and ECX */
+#define CPUID_VENDOR_INTEL_EBX                0x756E6547 /* "Genu" */
+#define CPUID_VENDOR_INTEL_ECX                0x6C65746E /* "ntel" */
+#define CPUID_VENDOR_AMD_EBX                  0x68747541 /* "Auth" */
+#define CPUID_VENDOR_AMD_ECX                  0x444D4163 /* "cAMD" */
+#define CPUID_VENDOR_HYGON_EBX                0x6F677948 /* "Hygo" */
+#define CPUID_VENDOR_HYGON_ECX                0x656E6975 /* "uine" */
+
+/* x2APIC mode, IA32_APIC_BASE.EXTD, the registers are MSRs then */
+#define LOCAL_APIC_BASE_X2APIC_ENABLE         (1ULL << 10)
+#define X2APIC_ICR_MSR                        0x830
+
+/* TSC calibration */
+#define CPUID_TSC_CRYSTAL_LEAF                0x15
+#define CPUID_PROC_FREQ_LEAF                  0x16
+#define CPUID_EXT_MAX_LEAF                    0x80000000
+#define CPUID_EXT_ADV_PM_LEAF                 0x80000007
+#define CPUID_EXT_ADV_PM_EDX_INVARIANT_TSC    (1 << 8)
+#define ACPI_PM_TIMER_HZ                      3579545
+/* about 1 ms of the PM timer */
+#define PM_TIMER_CALIBRATION_TICKS            3580
+/* gives up on a PM timer that does not tick */
+#define PM_TIMER_MAX_READS                    1000000
+
+/* CPUID.01H:ECX.MONITOR, MONITOR/MWAIT are supported */
+#define CPUID_1_ECX_MONITOR                   (1 << 3)
+
+/* CPUID leaves with the x2APIC ID in EDX, valid when EBX != 0 */
+#define CPUID_V2_EXT_TOPOLOGY_LEAF            0x1F
+#define CPUID_EXT_TOPOLOGY_LEAF               0xB
 
 /*
  * If see errors when compiling, need to check
@@ -106,7 +150,8 @@ void __sgdt(em64t_gdtr_t* gdtr)
 }
 
 #define startap_rdtsc() __rdtsc()
-static uint64_t startap_tsc_ticks_per_msec = 0;
+static uint64_t startap_tsc_hz = 0;
+static uint64_t startap_tsc_flags = 0;  /* BOOT_TRACE_TSC_xxx */
 
 
 /*-------------------- internal types ---------------------------------------*/
@@ -123,13 +168,45 @@ init32_struct_t *gp_init32_data;
 /* stage 1 */
 uint32_t g_aps_counter = 0;
 
-static volatile uint32_t g_ready_counter;
-
 static func_continue_ap_t g_user_func;
 static void *g_any_data_for_user_func;
 
-/* 1 in i position means CPU[i] exists */
-uint8_t ap_presence_array[MON_MAX_CPU_SUPPORTED] = { 0 };
+/* set by ap_procs_kick(), consumed by ap_procs_collect() */
+static boolean_t g_aps_kicked;
+static boolean_t g_aps_broadcast;
+static uint64_t g_first_sipi_tsc;
+
+/* INIT-SIPI-SIPI timing picked by select_startup_protocol(), in usec */
+static uint64_t g_init_to_sipi_delay;
+static uint64_t g_sipi_to_sipi_delay;
+
+/* number of APs listed by the ACPI MADT, (uint32_t)-1 when unknown, the
+ * APs get the full timeout then */
+static uint32_t g_expected_aps;
+
+/* children of each node of the release tree, the BSP is the root (0) and
+ * the children of AP n are AP n * AP_RELEASE_FANOUT + 1 and on */
+#define AP_RELEASE_FANOUT                     4
+
+/* APs wait for the release with MONITOR/MWAIT instead of pause, only
+ * when built with STARTAP_MWAIT, see the Makefile */
+static boolean_t g_ap_mwait;
+
+/* loader work the kicked APs help with until they are released, may be
+ * NULL */
+static ap_work_queue_t *g_work_queue;
+
+/*
+ * AP check-in, see ap_continue_wakeup_code: each AP takes the next ticket,
+ * that is its AP number - 1, and stores its local APIC ID in that entry of
+ * ap_slots. The slots and the stacks are allocated by the loader, sized
+ * for the CPUs of the host.
+ */
+volatile uint32_t ap_check_in_ticket;
+ap_slot_t *ap_slots;
+uint32_t ap_table_size;
+uint64_t ap_stacks_base;
+uint32_t ap_stack_size;
 
 /* Low memory page layout  for ap_start_up_code
 Uncomment the following line to deadloop in AP startup */
@@ -165,51 +242,35 @@ const uint8_t ap_start_up_code[] = {
 	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 57: mov eax,AP_MODE_SWITCH_CODE */
 	0xFF, 0xE0,                     /* 62: jmp eax */
 
-	/* readmsr(0x1B) to get the each loacl_apic_id, and save it into ecx */
-	0xB9, 0x1B, 0x00, 0x00, 0x00,   /* 64: mov ecx, $IA32_MSR_APIC_BASE */
-	0x0F, 0x32,                     /* 69: rdmsr */
-	0x25, 0x00, 0xF0, 0xFF, 0xFF,   /* 71: and %eax, 0xFFFFF000 */
-	0x8B, 0x48, 0x20,               /* 76: mov ecx, dword ptr[eax+0x20] */
-	0xC1, 0xE9, 0x18,               /* 78: shr ecx, 0x18 --save the local_apic_id to ecx!*/
-
-	/* set a scratch stack (size is 16bytes) for each AP, only used for mode switch */
-	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 82: mov eax, $AP_SCRATCH_BASE */
-	0x89, 0xCA,                     /* 87: mov %edx, %ecx */
-	0xC1, 0xE2, 0x04,               /* 89: shl edx, 0x4 */
-	0x01, 0xD0,                     /* 92: add eax, edx */
-	0x89, 0xC4,                     /* 94: mov esp, eax */
-
-	/* begin to do mode switch from 32 protect mode to 64 mode */
+	/* begin to do mode switch from 32 protect mode to 64 mode, without a
+	 * stack: the AP is only identified later, in 64-bit code */
 	/* load the 64bit gdtr */
-	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 96: mov eax, ap_gdtr_x32_for_x64 */
-	0x0F, 0x01, 0x10,               /* 101: lgdt (%eax) */
+	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 64: mov eax, ap_gdtr_x32_for_x64 */
+	0x0F, 0x01, 0x10,               /* 69: lgdt (%eax) */
 	/* load the 64bit cr3 */
-	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 104: mov eax, ap_cr3_x64 */
-	0x0F, 0x22, 0xD8,               /* 109: mov  %cr3, %eax*/
+	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 72: mov eax, ap_cr3_x64 */
+	0x0F, 0x22, 0xD8,               /* 77: mov  %cr3, %eax*/
 	/* set CR4.PAE = 1(enable PAE mode) */
-	0x0F, 0x20, 0xE0,               /* 112: mov %eax, %cr4 */
-	0x0F, 0xBA, 0xE8, 0x05,         /* 115: bts %eax, $0x5*/
-	0x0F, 0x22, 0xE0,               /* 119: mov %cr4,%eax */
+	0x0F, 0x20, 0xE0,               /* 80: mov %eax, %cr4 */
+	0x0F, 0xBA, 0xE8, 0x05,         /* 83: bts %eax, $0x5*/
+	0x0F, 0x22, 0xE0,               /* 87: mov %cr4,%eax */
 	/* set the EFER.LME = 1 (enable the long mode) */
-	0x51,                           /* 122: push %ecx */
-	0xB9, 0x80, 0x00, 0x00, 0xC0,   /* 123: mov ecx, $0xC0000080 */
-	0x0F, 0x32,                     /* 128: rdmsr */
-	0x0F, 0xBA, 0xE8, 0x08,         /* 130: bts  %eax ,$0x8 */
-	0x0F, 0x30,                     /* 134: wrmsr */
-	0x59,                           /* 136: pop %ecx */
+	0xB9, 0x80, 0x00, 0x00, 0xC0,   /* 90: mov ecx, $0xC0000080 */
+	0x0F, 0x32,                     /* 95: rdmsr */
+	0x0F, 0xBA, 0xE8, 0x08,         /* 97: bts  %eax ,$0x8 */
+	0x0F, 0x30,                     /* 101: wrmsr */
 	/* set CR0.PG = 1(enable IA32-e paging) */
-	0x0F, 0x20, 0xC0,               /* 137: mov  %eax, %cr0 */
-	0x0F, 0xBA, 0xE8, 0x1f,         /* 140: bts  %eax, $0x31 */
-	0x0F, 0x22, 0xC0,               /* 144: mov  %cr0, %eax */
+	0x0F, 0x20, 0xC0,               /* 103: mov  %eax, %cr0 */
+	0x0F, 0xBA, 0xE8, 0x1f,         /* 106: bts  %eax, $0x31 */
+	0x0F, 0x22, 0xC0,               /* 110: mov  %cr0, %eax */
 
 	/* jump to 64bit mode[CS:EIP]*/
-	0x31, 0xC0,                     /* 147: xor %eax, %eax */
-	0xB8, 0x00,0x00,0x00,0x00,      /* 149: mov eax, ap_cs_x64*/
-	0x50,                           /* 154: push %eax */
-	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 155: mov eax,AP_CONTINUE_WAKEUP_CODE */
-	0x50,                           /* 160: push %eax */
-	0xCB,                           /* 161: lret */
-	/* 0x00 162: 32 bytes alignment */
+	0xB8, 0x00, 0x00, 0x00, 0x00,   /* 113: mov eax, AP_CONTINUE_FAR_PTR */
+	0xFF, 0x28,                     /* 118: ljmp *(%eax) */
+	/* AP_CONTINUE_FAR_PTR: */
+	0x00, 0x00, 0x00, 0x00,         /* 120: AP_CONTINUE_WAKEUP_CODE */
+	0x00, 0x00,                     /* 124: ap_cs_x64 */
+	/* 0x00 126: */
 };
 
 #ifdef BREAK_IN_AP_STARTUP
@@ -232,20 +293,20 @@ const uint8_t ap_start_up_code[] = {
 
 #define AP_MODE_SWITCH_CODE_IN_CODE_OFFSET      (58 + AP_CODE_START)
 #define AP_MODE_SWITCH_ADDR_OFFSET              (64 + AP_CODE_START)
-#define AP_SCRATCH_BASE_OFFSET                  (83 + AP_CODE_START)
-#define AP_X32_TO_X64_GDTR_OFFSET               (97 + AP_CODE_START)
-#define AP_CR3_X64_OFFSET                       (105 + AP_CODE_START)
-#define AP_CS_X64_OFFSET                        (150 + AP_CODE_START)
-#define AP_CONTINUE_WAKEUP_CODE_IN_CODE_OFFSET  (156 + AP_CODE_START)
+#define AP_X32_TO_X64_GDTR_OFFSET               (65 + AP_CODE_START)
+#define AP_CR3_X64_OFFSET                       (73 + AP_CODE_START)
+#define AP_CONTINUE_FAR_PTR_IN_CODE_OFFSET      (114 + AP_CODE_START)
+#define AP_CONTINUE_WAKEUP_CODE_IN_CODE_OFFSET  (120 + AP_CODE_START)
+#define AP_CS_X64_OFFSET                        (124 + AP_CODE_START)
 
 #define GDTR_OFFSET_IN_PAGE                     ((sizeof(ap_start_up_code) + 7) \
 						 & ~7)
 #define GDT_OFFSET_IN_PAGE                      (GDTR_OFFSET_IN_PAGE + 8)
 
 /*----------------- forward decls -------------------------------------------*/
-void CDECL ap_continue_wakeup_code_C(uint32_t local_apic_id);
+void CDECL ap_continue_wakeup_code_C(uint32_t cpu_id);
 
-static uint8_t bsp_enumerate_aps(void);
+static uint32_t bsp_enumerate_aps(void);
 static void ap_intialize_environment(void);
 static void mp_set_bootstrap_state(mp_bootstrap_state_t new_state);
 
@@ -264,13 +325,14 @@ void setup_low_memory_ap_code(uint64_t temp_low_memory_4K)
 	ia32_gdtr_t gdtr_32;
 	ia32_gdtr_t *new_gdtr_32;
 
-	/*actually is a gdtr for 64mode, but it loaded on the 32 mode!!*/
-	ia32_gdtr_t           ap_gdtr_x32_for_x64;
+	/*actually is a gdtr for 64mode, but it loaded on the 32 mode!!
+	  static: APs load it long after this function returned */
+	static ia32_gdtr_t    ap_gdtr_x32_for_x64;
 	em64t_gdtr_t          gdtr;
 	uint16_t              ap_cs_x64;
 	uint32_t              ap_cr3_x64;
 	uint32_t              mode_switch_code_addr = (uint32_t)(uint64_t)(code_to_patch)+AP_MODE_SWITCH_ADDR_OFFSET;
-	uint32_t              scratch_base = (uint32_t)(uint64_t)(code_to_patch)+0x1000;
+	uint32_t              continue_far_ptr_addr = (uint32_t)(uint64_t)(code_to_patch)+AP_CONTINUE_WAKEUP_CODE_IN_CODE_OFFSET;
 
 	__sgdt(&gdtr);
 	ap_gdtr_x32_for_x64.limit = gdtr.limit;
@@ -332,8 +394,8 @@ void setup_low_memory_ap_code(uint64_t temp_low_memory_4K)
 
 	*((uint32_t *)(code_to_patch + AP_X32_TO_X64_GDTR_OFFSET)) = (uint32_t)(uint64_t)(&ap_gdtr_x32_for_x64);
 	*((uint32_t *)(code_to_patch + AP_CR3_X64_OFFSET)) = ap_cr3_x64;
-	*((uint32_t *)(code_to_patch + AP_CS_X64_OFFSET)) = (uint32_t)ap_cs_x64;
-	*((uint32_t *)(code_to_patch + AP_SCRATCH_BASE_OFFSET)) = scratch_base;
+	*((uint16_t *)(code_to_patch + AP_CS_X64_OFFSET)) = ap_cs_x64;
+	*((uint32_t *)(code_to_patch + AP_CONTINUE_FAR_PTR_IN_CODE_OFFSET)) = continue_far_ptr_addr;
 	*((uint32_t *)(code_to_patch + AP_MODE_SWITCH_CODE_IN_CODE_OFFSET)) = mode_switch_code_addr;
 
 	/* Copy the pre-defined GDT table to its place
@@ -366,18 +428,212 @@ static uint64_t read_msr(uint32_t msr_id)
 	return value;
 }
 
+static void write_msr(uint32_t msr_id, uint64_t value)
+{
+	__asm__ __volatile__ (
+		"wrmsr"
+		:
+		: "c" (msr_id), "a" ((uint32_t)value),
+		  "d" ((uint32_t)(value >> 32))
+		);
+}
 
-/* Initial AP setup in protected mode - should never return */
-/* End of Stage 2 */
-void CDECL ap_continue_wakeup_code_C(uint32_t local_apic_id)
+static void startap_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
 {
-	/* g_ready_counter++; */
 	__asm__ __volatile__ (
-		"lock; incl %0" : : "m" (g_ready_counter)
+		"cpuid"
+		: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+		: "a" (leaf), "c" (subleaf)
 		);
+}
+
+/*---------------------------------------------------------------------
+ * Local APIC ID of this cpu, the same way ap_continue_wakeup_code gets
+ * it: the x2APIC ID of CPUID leaf 0x1F or 0xB, or the 8-bit initial
+ * APIC ID of leaf 1 on older cpus.
+ *---------------------------------------------------------------------*/
+static uint32_t get_local_apic_id(void)
+{
+	uint32_t regs[4];
+	uint32_t max_leaf;
+
+	startap_cpuid(0, 0, regs);
+	max_leaf = regs[0];
+
+	if (max_leaf >= CPUID_V2_EXT_TOPOLOGY_LEAF) {
+		startap_cpuid(CPUID_V2_EXT_TOPOLOGY_LEAF, 0, regs);
+		if (regs[1] != 0) {
+			return regs[3];
+		}
+	}
+
+	if (max_leaf >= CPUID_EXT_TOPOLOGY_LEAF) {
+		startap_cpuid(CPUID_EXT_TOPOLOGY_LEAF, 0, regs);
+		if (regs[1] != 0) {
+			return regs[3];
+		}
+	}
+
+	startap_cpuid(1, 0, regs);
+
+	return regs[1] >> 24;
+}
+
+/*---------------------------------------------------------------------
+ * TRUE once as many APs checked in as the ACPI MADT listed. Always FALSE
+ * when the list is unknown, the caller waits for its timeout then.
+ *---------------------------------------------------------------------*/
+static boolean_t all_expected_aps_present(void)
+{
+	return ap_check_in_ticket >= g_expected_aps;
+}
+
+/*---------------------------------------------------------------------
+ * Whether the APs may wait with MONITOR/MWAIT, see g_ap_mwait
+ *---------------------------------------------------------------------*/
+static boolean_t ap_mwait_supported(void)
+{
+#ifdef STARTAP_MWAIT
+	uint32_t regs[4];
+
+	startap_cpuid(1, 0, regs);
+
+	return (regs[2] & CPUID_1_ECX_MONITOR) != 0;
+#else
+	return FALSE;
+#endif
+}
+
+/* halt an AP that will not be used, until the OS sends it INIT-SIPI */
+static void ap_park(void)
+{
+	while (1) {
+		__asm__ __volatile__ (
+			"cli; hlt"
+			);
+	}
+}
+
+/*---------------------------------------------------------------------
+ * Wait on the slot of this AP until the BSP or the parent AP changes
+ * its release from AP_SLOT_WAIT, and return the new value. Runs the queued
+ * work each time the BSP rings the work doorbell meanwhile.
+ * Nothing else is written to the cache line, so MWAIT only wakes up
+ * for the release or the doorbell.
+ *---------------------------------------------------------------------*/
+static uint32_t ap_wait_for_release(ap_slot_t *slot)
+{
+	uint32_t release;
+	uint32_t work;
+
+	while (1) {
+		/* read before running, a job queued meanwhile rings again */
+		work = slot->work;
+		if (g_work_queue != NULL) {
+			while (ap_work_run_one(g_work_queue)) {
+			}
+		}
+
+		while (((release = slot->release) == AP_SLOT_WAIT) &&
+		       (slot->work == work)) {
+			if (g_ap_mwait) {
+				__asm__ __volatile__ (
+					"monitor"
+					: : "a" (slot), "c" (0), "d" (0)
+					: "memory"
+					);
+				if ((slot->release != AP_SLOT_WAIT) ||
+				    (slot->work != work)) {
+					continue;
+				}
+				__asm__ __volatile__ (
+					"mwait"
+					: : "a" (0), "c" (0)
+					: "memory"
+					);
+			} else {
+				__asm__ __volatile__ (
+					"pause" : : : "memory"
+					);
+			}
+		}
+
+		if (release != AP_SLOT_WAIT) {
+			return release;
+		}
+	}
+}
+
+/* release the children of cpu_id (0 for the BSP) in the release tree */
+static void release_children(uint32_t cpu_id)
+{
+	uint32_t child = cpu_id * AP_RELEASE_FANOUT + 1;
+	uint32_t i;
+
+	for (i = 0; (i < AP_RELEASE_FANOUT) && (child + i <= g_aps_counter);
+	     i++) {
+		ap_slots[child + i - 1].release = AP_SLOT_GO;
+	}
+}
+
+/* wait until the children of cpu_id, and so their subtrees, are ready */
+static void wait_children_ready(uint32_t cpu_id)
+{
+	uint32_t child = cpu_id * AP_RELEASE_FANOUT + 1;
+	uint32_t i;
+
+	for (i = 0; (i < AP_RELEASE_FANOUT) && (child + i <= g_aps_counter);
+	     i++) {
+		while (!ap_slots[child + i - 1].ready) {
+			__asm__ __volatile__ (
+				"pause" : : : "memory"
+				);
+		}
+	}
+}
+
+/*---------------------------------------------------------------------
+ * Park the slots of the APs that checked in after the BSP counted them,
+ * ap_continue_wakeup_code_C() parks the ones that check in later still.
+ * Called after MP_BOOTSTRAP_STATE_APS_ENUMERATED was set.
+ *---------------------------------------------------------------------*/
+static void park_uncounted_aps(void)
+{
+	uint32_t checked_in = ap_check_in_ticket;
+	uint32_t i;
+
+	if (checked_in > ap_table_size) {
+		checked_in = ap_table_size;
+	}
+
+	for (i = g_aps_counter; i < checked_in; i++) {
+		ap_slots[i].release = AP_SLOT_PARK;
+	}
+}
+
+/* Initial AP setup in protected mode - should never return */
+/* End of Stage 2 */
+void CDECL ap_continue_wakeup_code_C(uint32_t cpu_id)
+{
+	ap_slot_t *slot = &ap_slots[cpu_id - 1];
+
+	/* checked in after the BSP counted the APs and parked the slots */
+	if ((MP_BOOTSTRAP_STATE_APS_ENUMERATED == mp_bootstrap_state) &&
+	    (cpu_id > g_aps_counter)) {
+		ap_park();
+	}
+
+	if (ap_wait_for_release(slot) != AP_SLOT_GO) {
+		ap_park();
+	}
+
+	/* pass the release down the tree, and the ready up */
+	release_children(cpu_id);
+	wait_children_ready(cpu_id);
+	slot->ready = 1;
 
 	/* user_func now contains address of the function to be called */
-	g_user_func(local_apic_id, g_any_data_for_user_func);
+	g_user_func(cpu_id, g_any_data_for_user_func);
 }
 
 /*------------------------------------------------------------------- */
@@ -398,6 +654,22 @@ static uint8_t CDECL read_port_8(uint32_t port)
 	return val;
 }
 
+/*------------------------------------------------------------------- */
+/* read 32-bit port */
+/*-------------------------------------------------------------------- */
+static uint32_t read_port_32(uint16_t port)
+{
+	uint32_t val;
+
+	__asm__ __volatile__ (
+		"inl %w1, %0"
+		: "=a" (val)
+		: "Nd" (port)
+		);
+
+	return val;
+}
+
 /******************************************************************************
  *
  *            START: REPLACING STALL() WITH RDTSC()
@@ -407,7 +679,9 @@ static uint8_t CDECL read_port_8(uint32_t port)
 /*================================== startap_stall() =========================*/
 /* Stall (busy loop) for a given time, using the platform's speaker port h/w.
  * Should only be called at initialization, since a guest OS may change the
- * platform setting. */
+ * platform setting.
+ * Each port read is only assumed to take 1 usec, it is the last resort of
+ * startap_calibrate_tsc() */
 void startap_stall(uint32_t stall_usec)
 {
 	uint32_t c = 0;
@@ -416,10 +690,85 @@ void startap_stall(uint32_t stall_usec)
 		read_port_8(IA32_DEBUG_IO_PORT);
 }
 
-/*======================= startap_calibrate_tsc_ticks_per_msec() ============*/
-/* Calibrate the internal variable holding the number of TSC ticks pers second.
- * Should only be called at initialization, as it relies on startap_stall() */
-void startap_calibrate_tsc_ticks_per_msec(void)
+/*---------------------------------------------------------------------
+ * TSC frequency enumerated by CPUID: leaf 0x15 gives the TSC / crystal
+ * ratio and the crystal frequency, when the crystal frequency is not
+ * given the leaf 0x16 base frequency is the TSC frequency. 0 if unknown.
+ *---------------------------------------------------------------------*/
+static uint64_t tsc_hz_from_cpuid(void)
+{
+	uint32_t regs[4];
+	uint32_t max_leaf;
+
+	startap_cpuid(0, 0, regs);
+	max_leaf = regs[0];
+	if (max_leaf < CPUID_TSC_CRYSTAL_LEAF) {
+		return 0;
+	}
+
+	/* EAX: denominator, EBX: numerator, ECX: crystal Hz */
+	startap_cpuid(CPUID_TSC_CRYSTAL_LEAF, 0, regs);
+	if ((regs[0] == 0) || (regs[1] == 0)) {
+		return 0;
+	}
+	if (regs[2] != 0) {
+		return (uint64_t)regs[2] * regs[1] / regs[0];
+	}
+
+	if (max_leaf < CPUID_PROC_FREQ_LEAF) {
+		return 0;
+	}
+
+	/* EAX: base frequency in MHz */
+	startap_cpuid(CPUID_PROC_FREQ_LEAF, 0, regs);
+
+	return (uint64_t)(regs[0] & 0xFFFF) * 1000000;
+}
+
+/*---------------------------------------------------------------------
+ * Measure the TSC frequency against the ACPI PM timer, it runs at a
+ * fixed 3.579545 MHz whatever a port read costs. 0 if the timer does
+ * not tick.
+ *---------------------------------------------------------------------*/
+static uint64_t tsc_hz_from_pm_timer(uint32_t port, uint32_t bits)
+{
+	uint32_t mask = (bits == 32) ? 0xFFFFFFFF : 0xFFFFFF;
+	uint32_t start, now, elapsed = 0;
+	uint64_t start_tsc, end_tsc;
+	uint32_t reads;
+
+	/* start on a tick edge */
+	start = read_port_32((uint16_t)port) & mask;
+	for (reads = 0; reads < PM_TIMER_MAX_READS; reads++) {
+		now = read_port_32((uint16_t)port) & mask;
+		if (now != start) {
+			break;
+		}
+	}
+	start_tsc = startap_rdtsc();
+	start = now;
+
+	for (; reads < PM_TIMER_MAX_READS; reads++) {
+		now = read_port_32((uint16_t)port) & mask;
+		elapsed = (now - start) & mask;
+		if (elapsed >= PM_TIMER_CALIBRATION_TICKS) {
+			break;
+		}
+	}
+	end_tsc = startap_rdtsc();
+
+	if (elapsed < PM_TIMER_CALIBRATION_TICKS) {
+		return 0;
+	}
+
+	return (end_tsc - start_tsc) * ACPI_PM_TIMER_HZ / elapsed;
+}
+
+/*---------------------------------------------------------------------
+ * TSC frequency measured with startap_stall(), only right when a port
+ * 0x80 read takes 1 usec.
+ *---------------------------------------------------------------------*/
+static uint64_t tsc_hz_from_port_80(void)
 {
 	uint64_t start_tsc = 1, end_tsc = 0;
 
@@ -428,37 +777,100 @@ void startap_calibrate_tsc_ticks_per_msec(void)
 		startap_stall(1000); /* 1 ms */
 		end_tsc = startap_rdtsc();
 	}
-	startap_tsc_ticks_per_msec = (end_tsc - start_tsc);
+
+	return (end_tsc - start_tsc) * 1000;
+}
+
+/*======================= startap_calibrate_tsc() ============================*/
+/* Find the TSC frequency, from CPUID when it is enumerated there, else with
+ * the ACPI PM timer when p_init32_data has its port. It is published in
+ * the boot trace header for xmon.
+ * Should only be called at initialization, as it may rely on
+ * startap_stall() */
+static void startap_calibrate_tsc(init32_struct_t *p_init32_data,
+				  boot_trace_header_t *p_trace)
+{
+	uint32_t regs[4];
+
+	if (startap_tsc_hz != 0) {
+		return;
+	}
+
+	startap_tsc_flags = 0;
+	startap_tsc_hz = tsc_hz_from_cpuid();
+	if (startap_tsc_hz != 0) {
+		startap_tsc_flags |= BOOT_TRACE_TSC_FROM_CPUID;
+	} else if ((p_init32_data != NULL) &&
+		   (p_init32_data->i32_pm_timer_port != 0)) {
+		startap_tsc_hz = tsc_hz_from_pm_timer(
+			p_init32_data->i32_pm_timer_port,
+			p_init32_data->i32_pm_timer_bits);
+		if (startap_tsc_hz != 0) {
+			startap_tsc_flags |= BOOT_TRACE_TSC_FROM_PM_TIMER;
+		}
+	}
+	if (startap_tsc_hz == 0) {
+		startap_tsc_hz = tsc_hz_from_port_80();
+	}
+
+	startap_cpuid(CPUID_EXT_MAX_LEAF, 0, regs);
+	if (regs[0] >= CPUID_EXT_ADV_PM_LEAF) {
+		startap_cpuid(CPUID_EXT_ADV_PM_LEAF, 0, regs);
+		if (regs[3] & CPUID_EXT_ADV_PM_EDX_INVARIANT_TSC) {
+			startap_tsc_flags |= BOOT_TRACE_TSC_INVARIANT;
+		}
+	}
+
+	if (p_trace != NULL) {
+		p_trace->tsc_hz = startap_tsc_hz;
+		p_trace->tsc_flags = startap_tsc_flags;
+	}
+	boot_trace_record4(p_trace, BOOT_TRACE_STARTAP_TSC_CALIBRATED, 0,
+		startap_tsc_hz, startap_tsc_flags, 0, 0);
+}
+
+/*======================== startap_usec_to_tsc_ticks() ======================*/
+/* Convert a time to TSC ticks */
+static uint64_t startap_usec_to_tsc_ticks(uint64_t usec)
+{
+	/* Initialize startap_tsc_hz, if ap_procs_kick() did not */
+	if (startap_tsc_hz == 0) {
+		startap_calibrate_tsc(NULL, NULL);
+	}
+
+	return usec * startap_tsc_hz / 1000000;
 }
 
 /*========================== startap_stall_using_tsc() ======================*/
-/* Stall (busy loop) for a given time, using the CPU TSC register.
- * Note that, depending on the CPU and ASCI modes, the stall accuracy may be
- * rough. */
+/* Stall (busy loop) for a given time, using the CPU TSC register. */
 static void startap_stall_using_tsc(uint64_t stall_usec)
 {
-	uint64_t start_tsc = 1, end_tsc = 0;
+	uint64_t end_tsc;
 
-	/* Initialize startap_tsc_ticks_per_msec. Happens at boot time */
-	if (startap_tsc_ticks_per_msec == 0) {
-		startap_calibrate_tsc_ticks_per_msec();
-	}
+	end_tsc = startap_rdtsc() + startap_usec_to_tsc_ticks(stall_usec);
 
-	/* Calculate the start_tsc and end_tsc */
-	/* While loop is to overcome the overflow of 32-bit rdtsc value */
-	while (start_tsc > end_tsc) {
-		end_tsc =
-			startap_rdtsc() +
-			(stall_usec * (startap_tsc_ticks_per_msec >> 10));
-		start_tsc = startap_rdtsc();
+	while (startap_rdtsc() < end_tsc) {
+		__asm__ __volatile__ (
+			"pause"
+			);
 	}
+}
 
-	while (start_tsc < end_tsc) {
+/*========================== startap_wait_for_aps() =========================*/
+/* Stall until all the expected APs checked in or the TSC reaches
+ * deadline_tsc. Returns TRUE if they all did */
+static boolean_t startap_wait_for_aps(uint64_t deadline_tsc)
+{
+	while (startap_rdtsc() < deadline_tsc) {
+		if (all_expected_aps_present()) {
+			return TRUE;
+		}
 		__asm__ __volatile__ (
 			"pause"
 			);
-		start_tsc = startap_rdtsc();
 	}
+
+	return all_expected_aps_present();
 }
 
 /***************************************************************************
@@ -469,18 +881,17 @@ static void startap_stall_using_tsc(uint64_t stall_usec)
 
 /*---------------------------------------------------------------------
 * send IPI
+* In x2APIC mode the ICR is a single MSR with a 32-bit destination, and
+* there is no delivery status to wait for. The xAPIC ICR is written through
+* MMIO, high half first, and is polled until the IPI was accepted.
 *--------------------------------------------------------------------*/
 static
-void send_ipi_to_all_excluding_self(uint32_t vector_number, uint32_t delivery_mode)
+void send_ipi(ia32_icr_low_t icr_low, uint32_t dst)
 {
-	ia32_icr_low_t icr_low = { 0 };
 	ia32_icr_low_t icr_low_status = { 0 };
 	ia32_icr_high_t icr_high = { 0 };
 	uint64_t apic_base = 0;
 
-	icr_low.bits.vector = vector_number;
-	icr_low.bits.delivery_mode = delivery_mode;
-
 	/* level is set to 1 (except for INIT_DEASSERT, which is not supported in
 	 * P3 and P4) */
 	/* trigger mode is set to 0 (except for INIT_DEASSERT, which is not
@@ -488,12 +899,19 @@ void send_ipi_to_all_excluding_self(uint32_t vector_number, uint32_t delivery_mo
 	icr_low.bits.level = 1;
 	icr_low.bits.trigger_mode = 0;
 
-	/* broadcast mode - ALL_EXCLUDING_SELF */
-	icr_low.bits.destination_shorthand =
-		LOCAL_APIC_BROADCAST_MODE_ALL_EXCLUDING_SELF;
+	apic_base = read_msr(IA32_MSR_APIC_BASE);
+
+	if (apic_base & LOCAL_APIC_BASE_X2APIC_ENABLE) {
+		/* x2APIC MSR writes are not serializing, make the startup code
+		 * written to low memory visible before the IPI */
+		__asm__ __volatile__ ("mfence; lfence" : : : "memory");
+		write_msr(X2APIC_ICR_MSR, ((uint64_t)dst << 32) | icr_low.uint32);
+		return;
+	}
+
+	icr_high.bits.destination = (uint8_t)dst;
 
 	/* send */
-	apic_base = read_msr(IA32_MSR_APIC_BASE);
 	apic_base &= LOCAL_APIC_BASE_MSR_MASK;
 
 	do
@@ -510,53 +928,36 @@ void send_ipi_to_all_excluding_self(uint32_t vector_number, uint32_t delivery_mo
 		icr_low_status.uint32 =
 			*(uint32_t *)(apic_base + LOCAL_APIC_ICR_OFFSET);
 	} while (icr_low_status.bits.delivery_status != 0);
-
-	return;
 }
 
 static
-void send_ipi_to_specific_cpu(uint32_t vector_number,
-			      uint32_t delivery_mode, uint8_t dst)
+void send_ipi_to_all_excluding_self(uint32_t vector_number, uint32_t delivery_mode)
 {
 	ia32_icr_low_t icr_low = { 0 };
-	ia32_icr_low_t icr_low_status = { 0 };
-	ia32_icr_high_t icr_high = { 0 };
-	uint64_t apic_base = 0;
 
 	icr_low.bits.vector = vector_number;
 	icr_low.bits.delivery_mode = delivery_mode;
 
-	/* level is set to 1 (except for INIT_DEASSERT, which is not supported in
-	 * P3 and P4) */
-	/* trigger mode is set to 0 (except for INIT_DEASSERT, which is not
-	 * supported in P3 and P4) */
-	icr_low.bits.level = 1;
-	icr_low.bits.trigger_mode = 0;
-
-	/* send to specific cpu */
-	icr_low.bits.destination_shorthand = LOCAL_APIC_BROADCAST_MODE_SPECIFY_CPU;
-	icr_high.bits.destination = dst;
+	/* broadcast mode - ALL_EXCLUDING_SELF */
+	icr_low.bits.destination_shorthand =
+		LOCAL_APIC_BROADCAST_MODE_ALL_EXCLUDING_SELF;
 
-	/* send */
-	apic_base = read_msr(IA32_MSR_APIC_BASE);
-	apic_base &= LOCAL_APIC_BASE_MSR_MASK;
+	send_ipi(icr_low, 0);
+}
 
-	do
-		icr_low_status.uint32 =
-			*(uint32_t *)(apic_base + LOCAL_APIC_ICR_OFFSET);
-	while (icr_low_status.bits.delivery_status != 0);
+static
+void send_ipi_to_specific_cpu(uint32_t vector_number,
+			      uint32_t delivery_mode, uint32_t dst)
+{
+	ia32_icr_low_t icr_low = { 0 };
 
-	*(uint32_t *)(apic_base + LOCAL_APIC_ICR_OFFSET_HIGH) =
-		icr_high.uint32;
-	*(uint32_t *)(apic_base + LOCAL_APIC_ICR_OFFSET) = icr_low.uint32;;
+	icr_low.bits.vector = vector_number;
+	icr_low.bits.delivery_mode = delivery_mode;
 
-	do {
-		startap_stall_using_tsc(10);
-		icr_low_status.uint32 =
-			*(uint32_t *)(apic_base + LOCAL_APIC_ICR_OFFSET);
-	} while (icr_low_status.bits.delivery_status != 0);
+	/* send to specific cpu */
+	icr_low.bits.destination_shorthand = LOCAL_APIC_BROADCAST_MODE_SPECIFY_CPU;
 
-	return;
+	send_ipi(icr_low, dst);
 }
 
 static
@@ -574,82 +975,256 @@ void send_sipi_ipi(void *code_start)
 }
 
 /*----------------------------------------------------------------------------
-* Send INIT IPI - SIPI to all APs in broadcast mode
+* Send INIT IPI - SIPI to all APs in broadcast mode.
+* The second SIPI is sent by send_second_sipi(), g_sipi_to_sipi_delay later
 *---------------------------------------------------------------------------*/
 static
 void send_broadcast_init_sipi(init32_struct_t *p_init32_data)
 {
 	send_init_ipi();
-	/* timeout according to manual - 10 miliseconds */
-	startap_stall_using_tsc(10000);
+	/* 10 miliseconds according to manual, less on modern cpus */
+	startap_stall_using_tsc(g_init_to_sipi_delay);
 	/* SIPI message contains address of the code, shifted right to 12 bits */
-	/* send it twice - according to manual */
 	send_sipi_ipi((void *)(uint64_t)p_init32_data->i32_low_memory_page);
-	/* timeout according to manual - 200 miliseconds */
-	startap_stall_using_tsc(200000);
+}
+
+static
+void send_broadcast_sipi(init32_struct_t *p_init32_data)
+{
 	send_sipi_ipi((void *)(uint64_t)p_init32_data->i32_low_memory_page);
-	/* timeout according to manual - 200 miliseconds */
-	startap_stall_using_tsc(200000);
 }
 
 /*----------------------------------------------------------------------------
-* Send INIT IPI - SIPI to all active APs
+* Send INIT IPI - SIPI to all active APs.
+* The second SIPI is sent by send_second_sipi(), g_sipi_to_sipi_delay later
 *---------------------------------------------------------------------------*/
 static
-void send_targeted_init_sipi(init32_struct_t *p_init32_data,
-			     mon_startup_struct_t *p_startup)
+void send_targeted_init(mon_startup_struct_t *p_startup)
 {
 	int i;
 
 	for (i = 0; i < p_startup->number_of_processors_at_boot_time - 1; i++)
 		send_ipi_to_specific_cpu(0, LOCAL_APIC_DELIVERY_MODE_INIT,
 			p_startup->cpu_local_apic_ids[i + 1]);
-	/* timeout according to manual - 10 miliseconds */
-	startap_stall_using_tsc(10000);
+}
+
+static
+void send_targeted_sipi(init32_struct_t *p_init32_data,
+			mon_startup_struct_t *p_startup)
+{
+	int i;
 
 	/* SIPI message contains address of the code, shifted right to 12 bits */
-	/* send it twice - according to manual */
 	for (i = 0; i < p_startup->number_of_processors_at_boot_time - 1; i++) {
 		send_ipi_to_specific_cpu(
 			((uint32_t)p_init32_data->i32_low_memory_page) >> 12,
 			LOCAL_APIC_DELIVERY_MODE_SIPI,
 			p_startup->cpu_local_apic_ids[i + 1]);
 	}
-	/* timeout according to manual - 200 miliseconds */
-	startap_stall_using_tsc(200000);
-	for (i = 0; i < p_startup->number_of_processors_at_boot_time - 1; i++) {
-		send_ipi_to_specific_cpu(
-			((uint32_t)p_init32_data->i32_low_memory_page) >> 12,
-			LOCAL_APIC_DELIVERY_MODE_SIPI,
-			p_startup->cpu_local_apic_ids[i + 1]);
+}
+
+static
+void send_targeted_init_sipi(init32_struct_t *p_init32_data,
+			     mon_startup_struct_t *p_startup)
+{
+	send_targeted_init(p_startup);
+	/* 10 miliseconds according to manual, less on modern cpus */
+	startap_stall_using_tsc(g_init_to_sipi_delay);
+	send_targeted_sipi(p_init32_data, p_startup);
+}
+
+/*---------------------------------------------------------------------------
+ * TRUE if the AP with this local APIC ID already checked in. An AP that
+ * just took its ticket may not have stored its ID yet, it only gets a
+ * SIPI it ignores then.
+ *---------------------------------------------------------------------------*/
+static boolean_t ap_checked_in(uint32_t apic_id)
+{
+	uint32_t checked_in = ap_check_in_ticket;
+	uint32_t i;
+
+	if (checked_in > ap_table_size) {
+		checked_in = ap_table_size;
+	}
+
+	for (i = 0; i < checked_in; i++) {
+		if (ap_slots[i].apic_id == apic_id) {
+			return TRUE;
+		}
 	}
-	/* timeout according to manual - 200 miliseconds */
-	startap_stall_using_tsc(200000);
+
+	return FALSE;
 }
 
 /*---------------------------------------------------------------------------
- * Start all APs in pre-os launch and only active APs in post-os launch and
- * bring them to protected non-paged mode.
- * Processors are left in the state were they wait for continuation signal
+ * Send the second SIPI, only to the APs that did not check in yet when it
+ * is known which ones to expect: the ACPI MADT list in pre-os launch, the
+ * active cpus in post-os launch. Broadcast otherwise.
+ *---------------------------------------------------------------------------*/
+static
+void send_second_sipi(init32_struct_t *p_init32_data,
+		      mon_startup_struct_t *p_startup)
+{
+	const uint32_t *cpu_ids = (const uint32_t *)p_init32_data->i32_cpu_ids;
+	uint32_t vector = ((uint32_t)p_init32_data->i32_low_memory_page) >> 12;
+	uint32_t bsp_apic_id;
+	uint32_t i;
+
+	if (!g_aps_broadcast) {
+		for (i = 1; i < p_startup->number_of_processors_at_boot_time;
+		     i++) {
+			if (!ap_checked_in(p_startup->cpu_local_apic_ids[i])) {
+				send_ipi_to_specific_cpu(vector,
+					LOCAL_APIC_DELIVERY_MODE_SIPI,
+					p_startup->cpu_local_apic_ids[i]);
+			}
+		}
+		return;
+	}
+
+	if ((cpu_ids == NULL) || (p_init32_data->i32_num_of_cpus == 0)) {
+		send_broadcast_sipi(p_init32_data);
+		return;
+	}
+
+	bsp_apic_id = get_local_apic_id();
+	for (i = 0; i < p_init32_data->i32_num_of_cpus; i++) {
+		if ((cpu_ids[i] != bsp_apic_id) && !ap_checked_in(cpu_ids[i])) {
+			send_ipi_to_specific_cpu(vector,
+				LOCAL_APIC_DELIVERY_MODE_SIPI, cpu_ids[i]);
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------
+ * TRUE on cpus that do not need the manual's INIT-SIPI-SIPI delays, see
+ * MODERN_INIT_TO_SIPI_DELAY_IN_USEC.
+ *---------------------------------------------------------------------------*/
+static boolean_t modern_startup_allowed(void)
+{
+	uint32_t regs[4];
+	uint32_t vendor_ebx, vendor_ecx;
+	uint32_t family;
+
+	startap_cpuid(0, 0, regs);
+	vendor_ebx = regs[1];
+	vendor_ecx = regs[2];
+
+	startap_cpuid(1, 0, regs);
+	family = (regs[0] >> 8) & 0xF;
+	if (family == 0xF) {
+		family += (regs[0] >> 20) & 0xFF;
+	}
+
+	if ((vendor_ebx == CPUID_VENDOR_INTEL_EBX) &&
+	    (vendor_ecx == CPUID_VENDOR_INTEL_ECX)) {
+		return (family >= 6) && (family != 0xF);
+	}
+
+	if (((vendor_ebx == CPUID_VENDOR_AMD_EBX) &&
+	     (vendor_ecx == CPUID_VENDOR_AMD_ECX)) ||
+	    ((vendor_ebx == CPUID_VENDOR_HYGON_EBX) &&
+	     (vendor_ecx == CPUID_VENDOR_HYGON_ECX))) {
+		return family >= 0xF;
+	}
+
+	return FALSE;
+}
+
+/*---------------------------------------------------------------------------
+ * Pick the INIT-SIPI-SIPI timing: the one the loader asked for, else the
+ * short delays on cpus known to allow them and the manual's ones on the
+ * others.
+ *---------------------------------------------------------------------------*/
+static void select_startup_protocol(init32_struct_t *p_init32_data)
+{
+	boolean_t modern;
+
+	if (p_init32_data->i32_flags & INIT32_APS_SIPI_LEGACY) {
+		modern = FALSE;
+	} else if (p_init32_data->i32_flags & INIT32_APS_SIPI_MODERN) {
+		modern = TRUE;
+	} else {
+		modern = modern_startup_allowed();
+	}
+
+	if (modern) {
+		g_init_to_sipi_delay = MODERN_INIT_TO_SIPI_DELAY_IN_USEC;
+		g_sipi_to_sipi_delay = MODERN_SIPI_TO_SIPI_DELAY_IN_USEC;
+	} else {
+		g_init_to_sipi_delay = LEGACY_INIT_TO_SIPI_DELAY_IN_USEC;
+		g_sipi_to_sipi_delay = LEGACY_SIPI_TO_SIPI_DELAY_IN_USEC;
+	}
+}
+
+/*---------------------------------------------------------------------------
+ * Number of APs the ACPI MADT lists, all the CPUs except this one, or
+ * (uint32_t)-1 when the loader got no list.
+ *---------------------------------------------------------------------------*/
+static uint32_t count_expected_aps(init32_struct_t *p_init32_data)
+{
+	const uint32_t *cpu_ids = (const uint32_t *)p_init32_data->i32_cpu_ids;
+	uint32_t bsp_apic_id;
+	uint32_t aps = 0;
+	uint32_t i;
+
+	if ((cpu_ids == NULL) || (p_init32_data->i32_num_of_cpus == 0)) {
+		return (uint32_t)(-1);
+	}
+
+	bsp_apic_id = get_local_apic_id();
+	for (i = 0; i < p_init32_data->i32_num_of_cpus; i++) {
+		if (cpu_ids[i] != bsp_apic_id) {
+			aps++;
+		}
+	}
+
+	return aps;
+}
+
+/*---------------------------------------------------------------------------
+ * Send INIT and the first SIPI to all APs in pre-os launch and only active
+ * APs in post-os launch, and return without waiting for them.
+ * The APs check in while the caller goes on, until ap_procs_collect() is
+ * called. The low memory page and the startap image must stay untouched
+ * until then.
  * Input:
  * p_init32_data - contains pointer to the free low memory page to be used
- * for bootstap. After the return this memory is free
+ * for bootstap
  * p_startup - contains local apic ids of active cpus to be used in post-os
- * launch
+ * launch, NULL for pre-os launch
+ * p_trace - boot trace buffer, may be NULL
  * Return:
- * number of processors that were init (not including BSP)
- * or -1 on errors
+ * 0 or -1 on errors
  *---------------------------------------------------------------------------*/
-uint32_t ap_procs_startup(init32_struct_t *p_init32_data,
-			  mon_startup_struct_t *p_startup)
+uint32_t ap_procs_kick(init32_struct_t *p_init32_data,
+		       mon_startup_struct_t *p_startup,
+		       boot_trace_header_t *p_trace)
 {
 	if (NULL == p_init32_data || 0 == p_init32_data->i32_low_memory_page) {
 		return (uint32_t)(-1);
 	}
 
+	if (0 == p_init32_data->i32_max_aps || 0 == p_init32_data->i32_ap_slots ||
+	    0 == p_init32_data->i32_ap_stacks) {
+		return (uint32_t)(-1);
+	}
+
 	/* -------- Stage 1 ---------- */
 
+	COMPILE_TIME_ASSERT(sizeof(ap_slot_t) == AP_SLOT_SIZE);
+
+	/* before the INIT-SIPI delays, and early enough for xmon */
+	startap_calibrate_tsc(p_init32_data, p_trace);
+
 	ap_intialize_environment();
+	ap_slots = (ap_slot_t *)p_init32_data->i32_ap_slots;
+	ap_table_size = p_init32_data->i32_max_aps;
+	ap_stacks_base = p_init32_data->i32_ap_stacks;
+	ap_stack_size = p_init32_data->i32_ap_stack_size;
+	mon_memset(ap_slots, 0, (uint64_t)ap_table_size * sizeof(ap_slot_t));
+	g_ap_mwait = ap_mwait_supported();
+	g_work_queue = (ap_work_queue_t *)p_init32_data->i32_work_queue;
 
 	/* store in global var, to ease access to it from asm code */
 	gp_init32_data = p_init32_data;
@@ -657,21 +1232,132 @@ uint32_t ap_procs_startup(init32_struct_t *p_init32_data,
 	/* create AP startup code in low memory */
 	setup_low_memory_ap_code((uint64_t)p_init32_data->i32_low_memory_page);
 
-	if (BITMAP_GET(p_startup->flags, MON_STARTUP_POST_OS_LAUNCH_MODE) == 0) {
+	g_expected_aps = count_expected_aps(p_init32_data);
+	select_startup_protocol(p_init32_data);
+
+	g_aps_broadcast = (NULL == p_startup) ||
+			  (BITMAP_GET(p_startup->flags,
+				      MON_STARTUP_POST_OS_LAUNCH_MODE) == 0);
+	if (g_aps_broadcast) {
 		send_broadcast_init_sipi(p_init32_data);
 	} else {
 		send_targeted_init_sipi(p_init32_data, p_startup);
 	}
+	g_first_sipi_tsc = startap_rdtsc();
+	g_aps_kicked = TRUE;
+	boot_trace_record4_at(p_trace, g_first_sipi_tsc,
+		BOOT_TRACE_STARTAP_APS_KICKED, 0, p_init32_data->i32_num_of_cpus,
+		g_init_to_sipi_delay, g_sipi_to_sipi_delay, 0);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------
+ * Finish the INIT-SIPI-SIPI sequence started by ap_procs_kick() and count
+ * the APs that checked in.
+ * Both SIPIs and the wait are timed from the first SIPI, so whatever the BSP
+ * did since the kick is taken off the wait. APs only woken by the second
+ * SIPI still get SIPI_TO_SIPI_DELAY to check in.
+ * When the ACPI MADT told which APs to expect, it returns as soon as they
+ * all checked in, without the second SIPI if the first one was enough, and
+ * sends the second SIPI only to the APs that are not in yet.
+ * Processors are left in the state were they wait for continuation signal
+ * Input:
+ * p_init32_data, p_startup - as given to ap_procs_kick()
+ * p_trace - boot trace buffer, may be NULL
+ * Return:
+ * number of processors that were init (not including BSP)
+ * or -1 on errors
+ *---------------------------------------------------------------------------*/
+uint32_t ap_procs_collect(init32_struct_t *p_init32_data,
+			  mon_startup_struct_t *p_startup,
+			  boot_trace_header_t *p_trace)
+{
+	uint64_t second_sipi_tsc;
+	uint64_t deadline_tsc;
+
+	if (!g_aps_kicked) {
+		return (uint32_t)(-1);
+	}
 
-	/* wait for predefined timeout */
-	startap_stall_using_tsc(INITIAL_WAIT_FOR_APS_TIMEOUT_IN_MILIS);
+	/* send the second SIPI - according to manual, unless all APs are in,
+	 * and only to the ones not in yet */
+	if (!startap_wait_for_aps(g_first_sipi_tsc +
+		    startap_usec_to_tsc_ticks(g_sipi_to_sipi_delay))) {
+		send_second_sipi(p_init32_data, p_startup);
+		second_sipi_tsc = startap_rdtsc();
+		boot_trace_record_at(p_trace, second_sipi_tsc,
+			BOOT_TRACE_STARTAP_INIT_SIPI_SENT, 0, 0);
+
+		/* wait for predefined timeout, the safety net when some
+		 * APs never show up or are not known */
+		deadline_tsc = g_first_sipi_tsc + startap_usec_to_tsc_ticks(
+			2 * g_sipi_to_sipi_delay +
+			INITIAL_WAIT_FOR_APS_TIMEOUT_IN_MILIS);
+		if (deadline_tsc < second_sipi_tsc +
+		    startap_usec_to_tsc_ticks(g_sipi_to_sipi_delay)) {
+			deadline_tsc = second_sipi_tsc +
+				startap_usec_to_tsc_ticks(g_sipi_to_sipi_delay);
+		}
+		startap_wait_for_aps(deadline_tsc);
+	}
+	g_aps_kicked = FALSE;
 
 	/* -------- Stage 2 ---------- */
 	g_aps_counter = bsp_enumerate_aps();
+	/* APs checking in from now on park themselves */
+	mp_set_bootstrap_state(MP_BOOTSTRAP_STATE_APS_ENUMERATED);
+	park_uncounted_aps();
+	boot_trace_record(p_trace, BOOT_TRACE_STARTAP_APS_ENUMERATED, 0,
+		g_aps_counter);
 
 	return g_aps_counter;
 }
 
+/*---------------------------------------------------------------------------
+ * Send the APs kicked by ap_procs_kick() back to wait-for-SIPI, so the OS
+ * can start them as if startap never ran. For loader failures between the
+ * kick and ap_procs_collect().
+ *---------------------------------------------------------------------------*/
+void ap_procs_park(mon_startup_struct_t *p_startup)
+{
+	if (!g_aps_kicked) {
+		return;
+	}
+
+	if (g_aps_broadcast) {
+		send_init_ipi();
+	} else {
+		send_targeted_init(p_startup);
+	}
+	g_aps_kicked = FALSE;
+}
+
+/*---------------------------------------------------------------------------
+ * Start all APs in pre-os launch and only active APs in post-os launch and
+ * bring them to protected non-paged mode, waiting for them in place.
+ * Processors are left in the state were they wait for continuation signal
+ * Input:
+ * p_init32_data - contains pointer to the free low memory page to be used
+ * for bootstap. After the return this memory is free
+ * p_startup - contains local apic ids of active cpus to be used in post-os
+ * launch
+ * p_trace - boot trace buffer, may be NULL
+ * Return:
+ * number of processors that were init (not including BSP)
+ * or -1 on errors
+ *---------------------------------------------------------------------------*/
+uint32_t ap_procs_startup(init32_struct_t *p_init32_data,
+			  mon_startup_struct_t *p_startup,
+			  boot_trace_header_t *p_trace)
+{
+	if (ap_procs_kick(p_init32_data, p_startup, p_trace) != 0) {
+		return (uint32_t)(-1);
+	}
+
+	return ap_procs_collect(p_init32_data, p_startup, p_trace);
+}
+
 /*---------------------------------------------------------------------------
  * Run user specified function on all APs.
  * If user function returns it should return in the protected 32bit mode. In
@@ -687,42 +1373,44 @@ void ap_procs_run(func_continue_ap_t continue_ap_boot_func, void *any_data)
 {
 	g_user_func = continue_ap_boot_func;
 	g_any_data_for_user_func = any_data;
+	/* the APs read them once released */
+	__asm__ __volatile__ ("" : : : "memory");
 
-	/* signal to APs to pass to the next stage */
-	mp_set_bootstrap_state(MP_BOOTSTRAP_STATE_APS_ENUMERATED);
+	/* signal to APs to pass to the next stage, through the release tree */
+	release_children(0);
 	/* wait until all APs will accept this */
-	while (g_ready_counter != g_aps_counter) {
-		__asm__ __volatile__ (
-			"pause"
-			);
-	}
+	wait_children_ready(0);
 }
 
 /*---------------------------------------------------------------------*
 * Function  : bsp_enumerate_aps
-* Purpose   : Walk through ap_presence_array and counts discovered APs.
-*           : In addition modifies array thus it will contain AP IDs,
-*           : and not just 1/0.
+* Purpose   : Counts the APs checked in till now. They are numbered by
+*           : their check-in ticket, the ones beyond the loader table or
+*           : beyond what xmon supports are not counted and stay halted.
 * Return    : Total number of APs, discovered till now.
 * Notes     : Should be called on BSP
 *---------------------------------------------------------------------*/
-uint8_t bsp_enumerate_aps(void)
+uint32_t bsp_enumerate_aps(void)
 {
-	int i;
-	uint8_t ap_num = 0;
+	uint32_t ap_num = ap_check_in_ticket;
 
-	for (i = 1; i < NELEMENTS(ap_presence_array); ++i) {
-		if (0 != ap_presence_array[i]) {
-			ap_presence_array[i] = ++ap_num;
-		}
+	if (ap_num > ap_table_size) {
+		ap_num = ap_table_size;
 	}
+
+	/* xmon per cpu data is sized at build time */
+	if (ap_num > MON_MAX_CPU_SUPPORTED - 1) {
+		ap_num = MON_MAX_CPU_SUPPORTED - 1;
+	}
+
 	return ap_num;
 }
 
 void ap_intialize_environment(void)
 {
 	mp_bootstrap_state = MP_BOOTSTRAP_STATE_INIT;
-	g_ready_counter = 0;
+	ap_check_in_ticket = 0;
+	g_aps_counter = 0;
 	g_user_func = 0;
 	g_any_data_for_user_func = 0;
 }
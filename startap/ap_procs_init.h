@@ -22,6 +22,7 @@
 
 #include "mon_defs.h"
 #include "mon_startup.h"
+#include "boot_trace.h"
 
 extern uint64_t __rdtsc(void);
 
@@ -54,13 +55,41 @@ typedef void (CDECL * func_continue_ap_t)(uint32_t local_apic_id,
  * p_startup - contains local apic ids of active cpus to be used in post-os
  * launch
  *
+ * p_trace - boot trace buffer, may be NULL
+ *
  * Return:
  * number of processors that were init (not including BSP)
  * or -1 on errors
  *
  *---------------------------------------------------------------------------- */
 uint32_t ap_procs_startup(init32_struct_t *p_init32_data,
-			  mon_startup_struct_t *p_startup);
+			  mon_startup_struct_t *p_startup,
+			  boot_trace_header_t *p_trace);
+
+/*----------------------------------------------------------------------------
+ * ap_procs_startup() in two halves, so the BSP can do other work while the
+ * APs wake up.
+ *
+ * ap_procs_kick() sends INIT and the first SIPI and returns at once, the low
+ * memory page must stay untouched until ap_procs_collect(). p_startup may be
+ * NULL for pre-os launch. Returns 0 or -1 on errors.
+ *
+ * ap_procs_collect() sends the second SIPI, waits out what is left of the
+ * timeout and returns the number of APs, or -1 when they were not kicked.
+ *
+ * ap_procs_park() sends kicked APs back to wait-for-SIPI instead, when
+ * there will be no ap_procs_collect().
+ *
+ *---------------------------------------------------------------------------- */
+uint32_t ap_procs_kick(init32_struct_t *p_init32_data,
+		       mon_startup_struct_t *p_startup,
+		       boot_trace_header_t *p_trace);
+
+uint32_t ap_procs_collect(init32_struct_t *p_init32_data,
+			  mon_startup_struct_t *p_startup,
+			  boot_trace_header_t *p_trace);
+
+void ap_procs_park(mon_startup_struct_t *p_startup);
 
 /*----------------------------------------------------------------------------
  * Run user specified function on all APs.
@@ -0,0 +1,200 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#ifndef _AP_WORK_H_
+#define _AP_WORK_H_
+
+#include "x32_init64.h"
+
+/*
+ * AP work queue.
+ *
+ * Lets the loader spread work over the APs startap kicked, while they wait
+ * for the release into xmon. The queue is allocated by the loader and
+ * handed to startap in init32 (i32_work_queue). ap_work_submit() rings the
+ * work doorbell of every check-in slot, the APs then take chunks until the
+ * queue is empty and go back to waiting on their slot.
+ *
+ * A job is a parallel-for over [start, end), handed out in chunks of
+ * chunk_size through a single cursor, (job << 32 | chunk), that is only
+ * ever changed with cmpxchg. Nothing is done with a job before the cursor
+ * was taken, and a job entry is only reused once the cursor went past it
+ * and all its chunks finished, so a worker never acts on a reused entry.
+ *
+ * The BSP takes chunks as well while it waits, the work gets done when
+ * there are no APs. Work functions run on the small AP startup stacks
+ * with interrupts disabled: keep them shallow.
+ */
+#define AP_WORK_QUEUE_JOBS              8
+
+typedef void (CDECL * ap_work_func_t)(uint64_t start, uint64_t end,
+				      void *arg);
+
+typedef struct {
+	ap_work_func_t func;
+	void *arg;
+	uint64_t start;
+	uint64_t end;
+	uint64_t chunk_size;
+	uint32_t chunks;
+	volatile uint32_t pending;      /* chunks not finished yet */
+} ap_work_job_t;
+
+typedef struct {
+	/* next chunk to take, job << 32 | chunk */
+	volatile uint64_t cursor;
+	uint8_t pad[AP_SLOT_SIZE - sizeof(uint64_t)];
+
+	/* written by the BSP only */
+	volatile uint32_t tail;         /* number of jobs queued so far */
+	uint32_t num_slots;
+	ap_slot_t *slots;               /* check-in slots, to ring */
+	ap_work_job_t jobs[AP_WORK_QUEUE_JOBS];
+} ap_work_queue_t;
+
+static inline void ap_work_init(ap_work_queue_t *q, ap_slot_t *slots,
+				uint32_t num_slots)
+{
+	q->cursor = 0;
+	q->tail = 0;
+	q->num_slots = num_slots;
+	q->slots = slots;
+}
+
+static inline boolean_t ap_work_cmpxchg(volatile uint64_t *p, uint64_t old,
+					uint64_t new_value)
+{
+	uint64_t prev;
+
+	__asm__ __volatile__ (
+		"lock; cmpxchgq %2, %1"
+		: "=a" (prev), "+m" (*p)
+		: "r" (new_value), "0" (old)
+		: "memory"
+		);
+
+	return prev == old;
+}
+
+/*
+ * take one step of the queued work: run one chunk, or move the cursor on
+ * to the next job. FALSE when there is nothing queued.
+ */
+static inline boolean_t ap_work_run_one(ap_work_queue_t *q)
+{
+	uint64_t cursor = q->cursor;
+	uint32_t id = (uint32_t)(cursor >> 32);
+	uint32_t chunk = (uint32_t)cursor;
+	ap_work_job_t *job;
+	uint64_t start, end;
+
+	if (id == q->tail) {
+		return FALSE;
+	}
+	/* the job was written before tail */
+	__asm__ __volatile__ ("" : : : "memory");
+
+	job = &q->jobs[id % AP_WORK_QUEUE_JOBS];
+	if (chunk >= job->chunks) {
+		/* all handed out */
+		ap_work_cmpxchg(&q->cursor, cursor, (uint64_t)(id + 1) << 32);
+		return TRUE;
+	}
+
+	if (!ap_work_cmpxchg(&q->cursor, cursor, cursor + 1)) {
+		return TRUE;
+	}
+
+	start = job->start + chunk * job->chunk_size;
+	end = start + job->chunk_size;
+	if (end > job->end) {
+		end = job->end;
+	}
+	job->func(start, end, job->arg);
+
+	__asm__ __volatile__ (
+		"lock; decl %0"
+		: "+m" (job->pending)
+		:
+		: "memory"
+		);
+
+	return TRUE;
+}
+
+/* TRUE once job id was handed out and all its chunks finished */
+static inline boolean_t ap_work_done(ap_work_queue_t *q, uint32_t id)
+{
+	return ((uint32_t)(q->cursor >> 32) > id) &&
+	       (q->jobs[id % AP_WORK_QUEUE_JOBS].pending == 0);
+}
+
+/* BSP: help with the queued work until job id is done */
+static inline void ap_work_wait(ap_work_queue_t *q, uint32_t id)
+{
+	while (!ap_work_done(q, id)) {
+		if (!ap_work_run_one(q)) {
+			__asm__ __volatile__ (
+				"pause" : : : "memory"
+				);
+		}
+	}
+}
+
+/*
+ * BSP: queue func(chunk start, chunk end, arg) over [start, end) in
+ * chunks of chunk_size (not 0) and wake the APs, returns the job to wait
+ * for.
+ */
+static inline uint32_t ap_work_submit(ap_work_queue_t *q, ap_work_func_t func,
+				      void *arg, uint64_t start, uint64_t end,
+				      uint64_t chunk_size)
+{
+	uint32_t id = q->tail;
+	ap_work_job_t *job = &q->jobs[id % AP_WORK_QUEUE_JOBS];
+	uint32_t i;
+
+	/* wait for the job that used the entry before */
+	if (id >= AP_WORK_QUEUE_JOBS) {
+		ap_work_wait(q, id - AP_WORK_QUEUE_JOBS);
+	}
+
+	job->func = func;
+	job->arg = arg;
+	job->start = start;
+	job->end = end;
+	job->chunk_size = chunk_size;
+	job->chunks = (uint32_t)((end - start + chunk_size - 1) / chunk_size);
+	job->pending = job->chunks;
+	__asm__ __volatile__ ("" : : : "memory");
+	q->tail = id + 1;
+
+	for (i = 0; i < q->num_slots; i++) {
+		q->slots[i].work = id + 1;
+	}
+
+	return id;
+}
+
+/* BSP: run func over [start, end) on all the cpus, and wait for it */
+static inline void ap_work_parallel_for(ap_work_queue_t *q,
+					ap_work_func_t func, void *arg,
+					uint64_t start, uint64_t end,
+					uint64_t chunk_size)
+{
+	ap_work_wait(q, ap_work_submit(q, func, arg, start, end, chunk_size));
+}
+
+#endif                          /* _AP_WORK_H_ */
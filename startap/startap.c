@@ -32,17 +32,62 @@ static init64_struct_t *gp_init64;
 /*------------------Forward Declarations for Local Functions------------------*/
 static void CDECL start_application(uint32_t cpu_id,
 				    const application_params_struct_t *params);
+
+/* Handle the INIT32_APS_KICK/PARK calls of startap_main(), which do not go
+ * on to xmon. Returns TRUE when the call was one of them */
+static boolean_t startap_aps_request(init32_struct_t *p_init32,
+				     mon_startup_struct_t *p_startup,
+				     boot_trace_header_t *p_trace)
+{
+	if (NULL == p_init32) {
+		return FALSE;
+	}
+
+	if (p_init32->i32_flags & INIT32_APS_KICK) {
+		p_init32->i32_flags &= ~INIT32_APS_KICK;
+		if (ap_procs_kick(p_init32, p_startup, p_trace) == 0) {
+			p_init32->i32_flags |= INIT32_APS_KICKED;
+		}
+		return TRUE;
+	}
+
+	if (p_init32->i32_flags & INIT32_APS_PARK) {
+		ap_procs_park(p_startup);
+		p_init32->i32_flags &= ~(INIT32_APS_PARK | INIT32_APS_KICKED);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 void CDECL startap_main(init32_struct_t *p_init32, init64_struct_t *p_init64,
-			mon_startup_struct_t *p_startup, uint32_t entry_point)
+			mon_startup_struct_t *p_startup, uint32_t entry_point,
+			boot_trace_header_t *p_trace)
 {
 	uint32_t application_procesors;
 
-	if (NULL != p_init32) {
+	if (startap_aps_request(p_init32, p_startup, p_trace)) {
+		return;
+	}
+
+	boot_trace_record(p_trace, BOOT_TRACE_STARTAP_ENTRY, 0, 0);
+
+	if (NULL != p_init32 && (p_init32->i32_flags & INIT32_APS_KICKED)) {
+		/* APs were woken before xmon was loaded, collect them */
+		p_init32->i32_flags &= ~INIT32_APS_KICKED;
+		application_procesors = ap_procs_collect(p_init32, p_startup,
+			p_trace);
+	} else if (NULL != p_init32) {
 		/* wakeup APs */
-		application_procesors = ap_procs_startup(p_init32, p_startup);
+		application_procesors = ap_procs_startup(p_init32, p_startup,
+			p_trace);
 	} else {
 		application_procesors = 0;
 	}
+	if ((uint32_t)(-1) == application_procesors) {
+		/* the APs could not be started, go on with the BSP alone */
+		application_procesors = 0;
+	}
 #ifdef UNIPROC
 	application_procesors = 0;
 #endif
@@ -57,12 +102,15 @@ void CDECL startap_main(init32_struct_t *p_init32, init64_struct_t *p_init64,
 	application_params.ep = entry_point;
 	application_params.any_data1 = (void *)p_startup;
 	application_params.any_data2 = NULL;
-	application_params.any_data3 = NULL;
+	/* not part of mon_startup_struct_t, see startap_image_entry_point_t */
+	application_params.any_data3 = (void *)p_trace;
 
 	/* first launch application on AP cores */
 	if (application_procesors > 0) {
 		ap_procs_run((func_continue_ap_t)start_application,
 			&application_params);
+		boot_trace_record(p_trace, BOOT_TRACE_STARTAP_APS_RUN, 0,
+			application_procesors);
 	}
 
 	/* and then launch application on BSP */
@@ -75,6 +123,9 @@ static void CDECL start_application
 	xmon_image_entry_point_t xmon_entry;
 	xmon_entry = (xmon_image_entry_point_t)params->ep;
 
+	boot_trace_record((boot_trace_header_t *)params->any_data3,
+		BOOT_TRACE_STARTAP_CALL_XMON_ENTRY, (uint16_t)cpu_id, 0);
+
 	call_xmon_entry(xmon_entry,cpu_id, params->any_data1, params->any_data2,params->any_data3);
 	/*should never return here!*/
 	while(1);
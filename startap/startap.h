@@ -20,6 +20,8 @@
 #include "x32_init64.h"
 #include "ap_procs_init.h"
 #include "mon_startup.h"
+#include "boot_trace.h"
+#include "ap_work.h"
 
 typedef void (CDECL * xmon_image_entry_point_t)(uint32_t local_apic_id,
         void *any_data1,
@@ -31,10 +33,15 @@ void CDECL call_xmon_entry(xmon_image_entry_point_t xmon_entry,
                                   void *any_data2,
                                   void *any_data3);
 
+/* p_trace: boot trace buffer, may be NULL. It is also handed to xmon as
+ * the last (reserved) data argument of its entry point, since
+ * mon_startup_struct_t has no room for it.
+ */
 typedef void (CDECL * startap_image_entry_point_t)(init32_struct_t *p_init32,
 	init64_struct_t *p_init64,
 	mon_startup_struct_t *
 	p_startup,
-	uint64_t entry_point);
+	uint64_t entry_point,
+	boot_trace_header_t *p_trace);
 
 #endif                          /* _STARTAP_H_ */
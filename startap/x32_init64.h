@@ -30,10 +30,51 @@
 typedef struct _INIT32_STRUCT {
 	uint32_t i32_low_memory_page;           /* address of page in low memory, used for AP bootstrap */
 	uint16_t i32_num_of_aps;                /* number of detected APs (Application Processors) */
-	uint16_t i32_pad;
+	uint16_t i32_flags;                     /* INIT32_APS_xxx */
 	uint32_t i32_esp[MAX_CPUS];             /* array of 32-bit SPs (SP - top of the stack) */
+	uint32_t i32_num_of_cpus;               /* enabled CPUs listed by the ACPI MADT, including the BSP, 0 if unknown */
+	uint64_t i32_cpu_ids;                   /* address of their local APIC IDs (uint32_t), 0 if unknown */
+	uint32_t i32_max_aps;                   /* entries of i32_ap_slots and stacks at i32_ap_stacks */
+	uint32_t i32_ap_stack_size;             /* size of each AP stack, 16 bytes aligned */
+	uint64_t i32_ap_slots;                  /* ap_slot_t table, one per AP in check-in order, AP_SLOT_SIZE aligned */
+	uint64_t i32_ap_stacks;                 /* AP stacks, the stack of AP n (1..) ends at n * i32_ap_stack_size */
+	uint32_t i32_pm_timer_port;             /* ACPI PM timer I/O port, 0 if unknown */
+	uint32_t i32_pm_timer_bits;             /* ACPI PM timer width, 24 or 32 */
+	uint64_t i32_work_queue;                /* ap_work_queue_t the kicked APs take work from, 0 if none */
 } init32_struct_t;
 
+/*
+ * i32_flags, lets the loader wake the APs before xmon is loaded:
+ * startap_main() called with INIT32_APS_KICK only sends INIT-SIPI and
+ * returns, setting INIT32_APS_KICKED. The final call then collects the APs
+ * that checked in meanwhile. INIT32_APS_PARK sends kicked APs back to
+ * wait-for-SIPI, for when the loader fails before the final call.
+ */
+#define INIT32_APS_KICK                         0x1
+#define INIT32_APS_KICKED                       0x2
+#define INIT32_APS_PARK                         0x4
+/* INIT-SIPI-SIPI timing, startap picks it from the cpu family by default */
+#define INIT32_APS_SIPI_LEGACY                  0x8
+#define INIT32_APS_SIPI_MODERN                  0x10
+
+/*
+ * per AP check-in slot, a cache line each: an AP only ever waits on its own
+ * slot, and every field has a single writer.
+ */
+#define AP_SLOT_SIZE                            64
+
+typedef struct {
+	volatile uint32_t apic_id;      /* local APIC ID, written by the AP at check-in */
+	volatile uint32_t release;      /* AP_SLOT_xxx, written by the BSP or the parent AP */
+	volatile uint32_t ready;        /* set by the AP once it and its children took the release */
+	volatile uint32_t work;         /* work doorbell, written by the BSP, see ap_work.h */
+	uint32_t pad[(AP_SLOT_SIZE / sizeof(uint32_t)) - 4];
+} ap_slot_t;
+
+#define AP_SLOT_WAIT                            0
+#define AP_SLOT_GO                              1
+#define AP_SLOT_PARK                            2
+
 typedef struct _INIT64_STRUCT {
 	uint16_t i64_cs;                /* 64-bit code segment selector */
 	ia32_gdtr_t i64_gdtr;           /* still in 32-bit format */
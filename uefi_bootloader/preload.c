@@ -23,18 +23,46 @@
 #define HIGH_ADDR                     0x3fffffff
 #define IMAGE_NAME                    L"ikgt_pkg.bin"
 
-#define DEBUG_MSG
+/* the boot header is located at offset 0 of ikgt_pkg.bin (it is the
+ * first thing in starter.bin), so reading the leading pages is enough to
+ * get it before the load-time region is allocated */
+#define HEADER_PROBE_SIZE             (2 * EFI_PAGE_SIZE)
 
-#ifdef DEBUG_MSG
+/*
+ * log levels, copy of common/include/loader_log.h.
+ * Messages above PRELOAD_LOG_LEVEL_MAX are compiled out, the others are
+ * printed up to log_level, set with "loglevel=N" in the load options.
+ */
+#define LOG_LEVEL_NONE                0
+#define LOG_LEVEL_ERROR               1
+#define LOG_LEVEL_WARN                2
+#define LOG_LEVEL_INFO                3
+#define LOG_LEVEL_DEBUG               4
+#define LOG_LEVEL_TRACE               5
 
-#define debug(fmt, ...) do { \
-	Print(fmt, ##__VA_ARGS__); \
-} while(0)
+#ifndef PRELOAD_LOG_LEVEL_MAX
+#define PRELOAD_LOG_LEVEL_MAX         LOG_LEVEL_TRACE
+#endif
 
+#ifdef DEBUG
+#define PRELOAD_LOG_LEVEL_DEFAULT     LOG_LEVEL_DEBUG
 #else
-#define debug(fmt, ...) (void)0
+#define PRELOAD_LOG_LEVEL_DEFAULT     LOG_LEVEL_WARN
 #endif
 
+static UINTN log_level = PRELOAD_LOG_LEVEL_DEFAULT;
+
+#define log_msg(lvl, fmt, ...) do { \
+	if (((lvl) <= PRELOAD_LOG_LEVEL_MAX) && ((lvl) <= log_level)) { \
+		Print(fmt, ##__VA_ARGS__); \
+	} \
+} while(0)
+
+#define error(fmt, ...) log_msg(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define warn(fmt, ...)  log_msg(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define info(fmt, ...)  log_msg(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define debug(fmt, ...) log_msg(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
 /*
 *  ikgt image header
 *  contains addresses at which load-time and run-time memory
@@ -48,22 +76,24 @@ typedef struct {
 
 	/* size of this structure */
 	UINT32  size;
-	UINT32  reserved;
+	UINT32  version;
 
 	/* 32bit entry offset */
 	UINT32  entry32_offset;
 	/* 64bit entry offset */
 	UINT32  entry64_offset;
 
+	/* offset of the file mapping header in the image package */
+	UINT32  file_map_hdr_offset;
 	/* reserved */
-	UINT32  reserved1;
 	UINT32  reserved2;
 
 	/* rt_mem_base is a prefered runtime memory address for bootloader
 	 * to allocate. If failed, the bootloader can allocate any address
 	 * below 1G. */
 	UINT32  rt_mem_base;
-	/* rt_mem_size is sizeof(xmon_runtime_memory_layout_t) */
+	/* rt_mem_size is the size with the default xmon area size, the
+	 * xmon area is sized at boot for BOOT_HDR_SIZING_VERSION headers */
 	UINT32  rt_mem_size;
 
 	/* ldr_mem_base is a prefered loadtime memory address for bootloader
@@ -75,9 +105,29 @@ typedef struct {
 
 	/* size of image package after 0-padding to 4k aligned */
 	UINT32  image_size;
-	/* anything else?*/
+
+	/* BOOT_HDR_SIZING_VERSION fields below */
+
+	/* offsets of the startap, sguest and xmon areas in the runtime
+	 * memory, the xmon area is the last one */
+	UINT32  rt_startap_offset;
+	UINT32  rt_sguest_offset;
+	UINT32  rt_xmon_offset;
+
+	/* xmon area sizing, see xmon_area_size(). xmon_image_size is 0
+	 * if not known, rt_mem_size is used then */
+	UINT32  xmon_image_size;
+	UINT32  xmon_fixed_size;
+	UINT32  xmon_per_cpu_size;
+	UINT32  xmon_per_gb_size;
+	UINT32  xmon_per_view_gb_size;
+	UINT32  xmon_view_count;
+	UINT32  xmon_max_size;
 } ikgt_loader_boot_header_t;
 
+/* first boot header version with the runtime layout and sizing */
+#define BOOT_HDR_SIZING_VERSION       3
+
 /*
  *  Platform info structure to store the EFI memory map and all
  *  other info that needs to be passed to ikgt loader
@@ -91,8 +141,188 @@ typedef struct {
 	uint32_t   load_addr;
 	/* Address of allocated runtime memory region */
 	uint32_t   run_addr;
+	/* Address of the boot trace buffer, 0 if none */
+	uint32_t   trace_addr;
+	/* Size of allocated runtime memory region */
+	uint32_t   run_size;
+	/* EFI memory map descriptor size and version */
+	uint32_t   memmap_desc_size;
+	uint32_t   memmap_desc_version;
+	/* consoles usable by the loaders */
+	uint32_t   console_flags;
+	/* GOP framebuffer, 32 bits per pixel */
+	uint32_t   fb_pixels_per_line;
+	uint64_t   fb_base;
+	uint32_t   fb_width;
+	uint32_t   fb_height;
+	/* local APIC IDs (UINT32) of the enabled cpus, 0 if unknown */
+	uint64_t   cpu_ids_addr;
+	uint32_t   cpu_count;
+	/* ACPI PM timer I/O port and width (24 or 32 bits), 0 if none */
+	uint32_t   pm_timer_port;
+	uint32_t   pm_timer_bits;
 } ikgt_platform_info_t;
 
+#define IKGT_CONSOLE_VGA_TEXT         0x1
+#define IKGT_CONSOLE_GOP              0x2
+
+/* PI MP services protocol, only the processor count is used */
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+	{ 0x3fdda605, 0xa76e, 0x4f46, \
+	{ 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } }
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS)(
+	EFI_MP_SERVICES_PROTOCOL *this,
+	UINTN *number_of_processors,
+	UINTN *number_of_enabled_processors);
+
+struct _EFI_MP_SERVICES_PROTOCOL {
+	EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS get_number_of_processors;
+	/* the other services are not used */
+};
+
+static EFI_GUID mp_services_guid = EFI_MP_SERVICES_PROTOCOL_GUID;
+
+/* ACPI tables, only what is needed to list the cpus from the MADT and
+ * to find the PM timer in the FADT */
+#define ACPI_RSDP_SIGNATURE           "RSD PTR "
+#define ACPI_MADT_SIGNATURE           0x43495041 /* "APIC" */
+#define ACPI_FADT_SIGNATURE           0x50434146 /* "FACP" */
+
+#define ACPI_MADT_LOCAL_APIC          0
+#define ACPI_MADT_LOCAL_X2APIC        9
+#define ACPI_MADT_ENABLED             0x1
+
+typedef struct {
+	CHAR8   signature[8];
+	UINT8   checksum;
+	CHAR8   oem_id[6];
+	UINT8   revision;
+	UINT32  rsdt_addr;
+	/* revision 2 and later */
+	UINT32  length;
+	UINT64  xsdt_addr;
+	UINT8   ext_checksum;
+	UINT8   reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+	UINT32  signature;
+	UINT32  length;
+	UINT8   revision;
+	UINT8   checksum;
+	CHAR8   oem_id[6];
+	CHAR8   oem_table_id[8];
+	UINT32  oem_revision;
+	UINT32  creator_id;
+	UINT32  creator_revision;
+} __attribute__((packed)) acpi_table_header_t;
+
+typedef struct {
+	acpi_table_header_t hdr;
+	UINT32  local_apic_addr;
+	UINT32  flags;
+	/* followed by the interrupt controller structures */
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+	UINT8   type;
+	UINT8   length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+typedef struct {
+	acpi_madt_entry_t hdr;
+	UINT8   processor_id;
+	UINT8   apic_id;
+	UINT32  flags;
+} __attribute__((packed)) acpi_madt_local_apic_t;
+
+typedef struct {
+	acpi_madt_entry_t hdr;
+	UINT16  reserved;
+	UINT32  x2apic_id;
+	UINT32  flags;
+	UINT32  processor_uid;
+} __attribute__((packed)) acpi_madt_local_x2apic_t;
+
+/* FADT flags */
+#define ACPI_FADT_TMR_VAL_EXT         (1 << 8)
+/* generic address structure address spaces */
+#define ACPI_GAS_SYSTEM_IO            1
+
+typedef struct {
+	UINT8   address_space_id;
+	UINT8   register_bit_width;
+	UINT8   register_bit_offset;
+	UINT8   access_size;
+	UINT64  address;
+} __attribute__((packed)) acpi_gas_t;
+
+/* the FADT up to X_PM_TMR_BLK, older revisions are shorter */
+typedef struct {
+	acpi_table_header_t hdr;
+	UINT8   pad_36[76 - 36];
+	UINT32  pm_tmr_blk;
+	UINT8   pad_80[91 - 80];
+	UINT8   pm_tmr_len;
+	UINT8   pad_92[112 - 92];
+	UINT32  flags;
+	UINT8   pad_116[208 - 116];
+	acpi_gas_t x_pm_tmr_blk;
+} __attribute__((packed)) acpi_fadt_t;
+
+static EFI_GUID acpi20_guid = ACPI_20_TABLE_GUID;
+static EFI_GUID acpi_guid = ACPI_TABLE_GUID;
+static EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+
+/*
+ *  Boot timeline trace, must match common/include/boot_trace.h.
+ *  It is allocated here, and the later stages append to it.
+ */
+#define BOOT_TRACE_MAGIC              0x4543415254474B49ULL
+#define BOOT_TRACE_VERSION            2
+#define BOOT_TRACE_SIZE               0x10000
+#define BOOT_TRACE_MAX_ARGS           4
+
+/* the buffer is also published as an EFI configuration table, so the
+ * OS can find it after boot */
+#define IKGT_BOOT_TRACE_GUID \
+	{ 0x24ec2f8e, 0x243a, 0x46c7, \
+	{ 0x9f, 0xcd, 0x05, 0xbd, 0x58, 0x38, 0xe4, 0x33 } }
+
+enum {
+	BOOT_TRACE_PRELOAD_ENTRY = 1,
+	BOOT_TRACE_PRELOAD_IMAGE_READ,
+	BOOT_TRACE_PRELOAD_MEM_ALLOCATED,
+	BOOT_TRACE_PRELOAD_CALL_LOADER,
+	BOOT_TRACE_PRELOAD_RESUME,
+};
+
+typedef struct {
+	UINT64  tsc;
+	UINT16  event;
+	UINT16  cpu;
+	UINT32  reserved;
+	UINT64  args[BOOT_TRACE_MAX_ARGS];
+} boot_trace_record_t;
+
+typedef struct {
+	UINT64  magic;
+	UINT32  version;
+	UINT32  size;
+	UINT32  max_records;
+	volatile UINT32 next;
+	/* set by startap */
+	UINT64  tsc_hz;
+	UINT64  tsc_flags;
+
+	boot_trace_record_t records[0];
+} boot_trace_header_t;
+
+static EFI_GUID boot_trace_guid = IKGT_BOOT_TRACE_GUID;
+
 static uint64_t __readmsr(uint64_t msr_id)
 {
 	uint64_t ret;
@@ -127,6 +357,356 @@ static void __cpuid(uint64_t cpu_info[4], uint64_t info_type)
 }
 #define IA32_MSR_FEATURE_CONTROL        ((uint32_t)0x03A)
 
+static UINT64 __rdtsc(void)
+{
+	UINT32 lo, hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+
+	return ((UINT64)hi << 32) | lo;
+}
+
+/* only the BSP runs here, no need to be atomic */
+static void trace_record_at(boot_trace_header_t *bt, UINT64 tsc,
+			UINT16 event, UINT64 arg)
+{
+	UINT32 idx;
+
+	if (bt == NULL)
+		return;
+
+	idx = bt->next++;
+	if (idx >= bt->max_records)
+		return;
+
+	bt->records[idx].tsc = tsc;
+	bt->records[idx].event = event;
+	bt->records[idx].cpu = 0;
+	/* the buffer is zeroed, the other args stay 0 */
+	bt->records[idx].args[0] = arg;
+}
+
+static void trace_record(boot_trace_header_t *bt, UINT16 event, UINT64 arg)
+{
+	trace_record_at(bt, __rdtsc(), event, arg);
+}
+
+/*
+ * allocate the boot trace buffer as reserved memory below 1G, it is
+ * still needed after the OS boots. Tracing is just skipped on failure.
+ */
+static boot_trace_header_t *trace_alloc(void)
+{
+	EFI_PHYSICAL_ADDRESS addr = HIGH_ADDR;
+	boot_trace_header_t *bt;
+	EFI_STATUS err;
+
+	err = allocate_pages(AllocateMaxAddress,
+			EfiReservedMemoryType,
+			EFI_SIZE_TO_PAGES(BOOT_TRACE_SIZE),
+			&addr);
+	if (EFI_ERROR(err)) {
+		error(L"alloc mem for boot trace has failed\n");
+		return NULL;
+	}
+
+	bt = (boot_trace_header_t *)(UINTN)addr;
+	ZeroMem(bt, BOOT_TRACE_SIZE);
+	bt->magic = BOOT_TRACE_MAGIC;
+	bt->version = BOOT_TRACE_VERSION;
+	bt->size = BOOT_TRACE_SIZE;
+	bt->max_records = (BOOT_TRACE_SIZE - sizeof(boot_trace_header_t)) /
+			sizeof(boot_trace_record_t);
+
+	return bt;
+}
+
+/*
+ * report the GOP framebuffer to the loaders for their logs, only when it
+ * can be written directly with 32 bits per pixel
+ */
+static void get_console_info(ikgt_platform_info_t *platform_info)
+{
+	EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = NULL;
+	EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mode_info;
+	EFI_STATUS err;
+
+	platform_info->console_flags = 0;
+	platform_info->fb_pixels_per_line = 0;
+	platform_info->fb_base = 0;
+	platform_info->fb_width = 0;
+	platform_info->fb_height = 0;
+
+	err = LibLocateProtocol(&gop_guid, (VOID **)&gop);
+	if (EFI_ERROR(err) || gop == NULL || gop->Mode == NULL ||
+	    gop->Mode->Info == NULL)
+		return;
+
+	mode_info = gop->Mode->Info;
+	if ((mode_info->PixelFormat != PixelRedGreenBlueReserved8BitPerColor) &&
+	    (mode_info->PixelFormat != PixelBlueGreenRedReserved8BitPerColor))
+		return;
+
+	platform_info->console_flags = IKGT_CONSOLE_GOP;
+	platform_info->fb_pixels_per_line = mode_info->PixelsPerScanLine;
+	platform_info->fb_base = gop->Mode->FrameBufferBase;
+	platform_info->fb_width = mode_info->HorizontalResolution;
+	platform_info->fb_height = mode_info->VerticalResolution;
+
+	debug(L"GOP framebuffer 0x%lx %dx%d\n", platform_info->fb_base,
+		platform_info->fb_width, platform_info->fb_height);
+}
+
+/* number of enabled cpus, 0 if the firmware does not tell */
+static UINTN get_cpu_count(void)
+{
+	EFI_MP_SERVICES_PROTOCOL *mp = NULL;
+	UINTN cpus = 0;
+	UINTN enabled = 0;
+	EFI_STATUS err;
+
+	err = LibLocateProtocol(&mp_services_guid, (VOID **)&mp);
+	if (EFI_ERROR(err) || mp == NULL)
+		return 0;
+
+	err = uefi_call_wrapper(mp->get_number_of_processors, 3,
+			mp, &cpus, &enabled);
+	if (EFI_ERROR(err))
+		return 0;
+
+	return enabled;
+}
+
+/* find an ACPI table through the XSDT, or the RSDT of an ACPI 1.0 RSDP */
+static acpi_table_header_t *acpi_find_table(UINT32 signature)
+{
+	acpi_rsdp_t *rsdp = NULL;
+	acpi_table_header_t *sdt, *table;
+	UINT8 *entry;
+	UINTN entry_size, count, i;
+	UINT64 addr;
+
+	if (EFI_ERROR(LibGetSystemConfigurationTable(&acpi20_guid,
+				(VOID **)&rsdp)) || rsdp == NULL) {
+		rsdp = NULL;
+		if (EFI_ERROR(LibGetSystemConfigurationTable(&acpi_guid,
+					(VOID **)&rsdp)) || rsdp == NULL)
+			return NULL;
+	}
+
+	if (CompareMem(rsdp->signature, ACPI_RSDP_SIGNATURE,
+			sizeof(rsdp->signature)) != 0)
+		return NULL;
+
+	if (rsdp->revision >= 2 && rsdp->xsdt_addr != 0) {
+		sdt = (acpi_table_header_t *)(UINTN)rsdp->xsdt_addr;
+		entry_size = sizeof(UINT64);
+	} else {
+		sdt = (acpi_table_header_t *)(UINTN)rsdp->rsdt_addr;
+		entry_size = sizeof(UINT32);
+	}
+	if (sdt == NULL || sdt->length < sizeof(acpi_table_header_t))
+		return NULL;
+
+	count = (sdt->length - sizeof(acpi_table_header_t)) / entry_size;
+	entry = (UINT8 *)(sdt + 1);
+	for (i = 0; i < count; i++, entry += entry_size) {
+		if (entry_size == sizeof(UINT64))
+			addr = *(UINT64 *)entry;
+		else
+			addr = *(UINT32 *)entry;
+
+		table = (acpi_table_header_t *)(UINTN)addr;
+		if (table != NULL && table->signature == signature)
+			return table;
+	}
+
+	return NULL;
+}
+
+/*
+ * walk the MADT for the local APIC IDs of the enabled cpus, a cpu listed
+ * twice is stored once. Returns the number of IDs stored in ids, or an
+ * upper bound of it when ids is NULL.
+ */
+static UINT32 madt_get_cpu_ids(acpi_madt_t *madt, UINT32 *ids)
+{
+	acpi_madt_entry_t *entry;
+	UINT8 *p = (UINT8 *)(madt + 1);
+	UINT8 *end = (UINT8 *)madt + madt->hdr.length;
+	UINT32 apic_id, flags;
+	UINT32 count = 0;
+	UINT32 i;
+
+	while (p + sizeof(acpi_madt_entry_t) <= end) {
+		entry = (acpi_madt_entry_t *)p;
+		if (entry->length < sizeof(acpi_madt_entry_t) ||
+			p + entry->length > end)
+			break;
+		p += entry->length;
+
+		if (entry->type == ACPI_MADT_LOCAL_APIC &&
+			entry->length >= sizeof(acpi_madt_local_apic_t)) {
+			apic_id = ((acpi_madt_local_apic_t *)entry)->apic_id;
+			flags = ((acpi_madt_local_apic_t *)entry)->flags;
+		} else if (entry->type == ACPI_MADT_LOCAL_X2APIC &&
+			entry->length >= sizeof(acpi_madt_local_x2apic_t)) {
+			apic_id = ((acpi_madt_local_x2apic_t *)entry)->x2apic_id;
+			flags = ((acpi_madt_local_x2apic_t *)entry)->flags;
+		} else {
+			continue;
+		}
+
+		if (!(flags & ACPI_MADT_ENABLED))
+			continue;
+
+		if (ids != NULL) {
+			for (i = 0; i < count && ids[i] != apic_id; i++)
+				;
+			if (i < count)
+				continue;
+			ids[count] = apic_id;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * list the enabled cpus from the ACPI MADT, so startap knows which APs to
+ * wait for. The list is left empty when there is no MADT, startap waits
+ * its full timeout then. Returns the buffer to free once the loader ran.
+ */
+static UINT32 *get_cpu_ids(ikgt_platform_info_t *platform_info)
+{
+	acpi_madt_t *madt;
+	UINT32 *ids = NULL;
+	UINT32 count;
+	EFI_STATUS err;
+
+	platform_info->cpu_ids_addr = 0;
+	platform_info->cpu_count = 0;
+
+	madt = (acpi_madt_t *)acpi_find_table(ACPI_MADT_SIGNATURE);
+	if (madt == NULL) {
+		warn(L"no ACPI MADT, APs are waited for with a timeout\n");
+		return NULL;
+	}
+
+	count = madt_get_cpu_ids(madt, NULL);
+	if (count == 0)
+		return NULL;
+
+	err = allocate_pool(EfiLoaderData, count * sizeof(UINT32),
+			(void **)&ids);
+	if (EFI_ERROR(err)) {
+		error(L"alloc mem for cpu ids has failed\n");
+		return NULL;
+	}
+
+	platform_info->cpu_count = madt_get_cpu_ids(madt, ids);
+	platform_info->cpu_ids_addr = (UINTN)ids;
+	debug(L"%d cpus listed by the ACPI MADT\n", platform_info->cpu_count);
+
+	return ids;
+}
+
+/*
+ * find the ACPI PM timer in the FADT, startap calibrates the TSC with it
+ * when CPUID does not tell the TSC frequency.
+ */
+static void get_pm_timer(ikgt_platform_info_t *platform_info)
+{
+	acpi_fadt_t *fadt;
+	UINT64 port = 0;
+
+	platform_info->pm_timer_port = 0;
+	platform_info->pm_timer_bits = 0;
+
+	fadt = (acpi_fadt_t *)acpi_find_table(ACPI_FADT_SIGNATURE);
+	/* PM_TMR_BLK and the flags are in every revision */
+	if (fadt == NULL ||
+		fadt->hdr.length < __builtin_offsetof(acpi_fadt_t, pad_116))
+		return;
+
+	if (fadt->hdr.length >= sizeof(acpi_fadt_t) &&
+		fadt->x_pm_tmr_blk.address_space_id == ACPI_GAS_SYSTEM_IO)
+		port = fadt->x_pm_tmr_blk.address;
+	if (port == 0 && fadt->pm_tmr_len == 4)
+		port = fadt->pm_tmr_blk;
+	if (port == 0 || port > 0xFFFF)
+		return;
+
+	platform_info->pm_timer_port = (UINT32)port;
+	platform_info->pm_timer_bits =
+		(fadt->flags & ACPI_FADT_TMR_VAL_EXT) ? 32 : 24;
+	debug(L"ACPI PM timer at port 0x%x\n", platform_info->pm_timer_port);
+}
+
+/* GBs of physical address space covered by memory (not MMIO), 0 if the
+ * memory map is not available */
+static UINT64 get_memory_gbs(void)
+{
+	EFI_MEMORY_DESCRIPTOR *map, *desc;
+	UINTN nr_entries, map_key, desc_size, i;
+	UINT32 desc_ver;
+	UINT64 end, top = 0;
+
+	map = LibMemoryMap(&nr_entries, &map_key, &desc_size, &desc_ver);
+	if (map == NULL)
+		return 0;
+
+	for (i = 0; i < nr_entries; i++) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + i * desc_size);
+		if (desc->Type == EfiMemoryMappedIO ||
+			desc->Type == EfiMemoryMappedIOPortSpace)
+			continue;
+		end = desc->PhysicalStart +
+			(desc->NumberOfPages << EFI_PAGE_SHIFT);
+		if (end > top)
+			top = end;
+	}
+	FreePool(map);
+
+	return (top + (1ULL << 30) - 1) >> 30;
+}
+
+/*
+ * size of the runtime memory: the fixed areas plus the xmon area, which
+ * is sized from the cpu count, the physical memory size and the view
+ * count with the parameters from the boot header
+ */
+static UINT32 get_runtime_size(ikgt_loader_boot_header_t *hdr)
+{
+	UINT64 cpus, gbs, xmon_size;
+
+	if (hdr->version < BOOT_HDR_SIZING_VERSION ||
+		hdr->size < sizeof(ikgt_loader_boot_header_t) ||
+		hdr->xmon_image_size == 0)
+		return hdr->rt_mem_size;
+
+	cpus = get_cpu_count();
+	gbs = get_memory_gbs();
+	if (cpus == 0 || gbs == 0) {
+		warn(L"cpu count or memory size unknown, use the default runtime size\n");
+		return hdr->rt_mem_size;
+	}
+
+	xmon_size = (UINT64)hdr->xmon_image_size + hdr->xmon_fixed_size +
+		cpus * hdr->xmon_per_cpu_size +
+		gbs * (hdr->xmon_per_gb_size +
+			(UINT64)hdr->xmon_view_count * hdr->xmon_per_view_gb_size);
+	if (xmon_size > hdr->xmon_max_size)
+		xmon_size = hdr->xmon_max_size;
+	xmon_size = (UINT64)EFI_SIZE_TO_PAGES(xmon_size) << EFI_PAGE_SHIFT;
+
+	info(L"xmon area: %ld cpus, %ld GB, %d views -> 0x%lx bytes\n",
+		cpus, gbs, hdr->xmon_view_count, xmon_size);
+
+	return hdr->rt_xmon_offset + (UINT32)xmon_size;
+}
+
 static int check_vmx_support(void)
 {
 	uint64_t info[4];
@@ -137,7 +717,7 @@ static int check_vmx_support(void)
 
 	/* CPUID: output in rcx, VT available? */
 	if ((info[2] & 0x00000020) == 0) {
-		debug(L"VT not available\n");
+		error(L"VT not available\n");
 		return -1;
 	}
 
@@ -145,7 +725,7 @@ static int check_vmx_support(void)
 	u = __readmsr(IA32_MSR_FEATURE_CONTROL);
 
 	if (((u & 0x01) != 0) && ((u & 0x04) == 0)) {
-		debug(L"VMX is off!\n");
+		error(L"VMX is off!\n");
 		return -1;
 	}
 	debug(L"VT is available and VMX is ON!\n");
@@ -153,51 +733,79 @@ static int check_vmx_support(void)
 }
 
 
-static EFI_STATUS load_image(EFI_FILE_HANDLE dir,
+static EFI_STATUS open_image(EFI_FILE_HANDLE dir,
 			const CHAR16 *name,
+			EFI_FILE_HANDLE *handle,
+			UINTN *file_size)
+{
+	EFI_STATUS err;
+	EFI_FILE_INFO *info;
+
+	*handle = NULL;
+	err = open_file(dir, handle, (VOID *)name, EFI_FILE_MODE_READ);
+	if (EFI_ERROR(err) || *handle == NULL) {
+		error(L"open file error: %r\n", err);
+		return EFI_ERROR(err) ? err : EFI_NOT_FOUND;
+	}
+
+	info = LibFileInfo(*handle);
+	if (info == NULL) {
+		error(L"get file info failed\n");
+		close_file(*handle);
+		*handle = NULL;
+		return EFI_LOAD_ERROR;
+	}
+	*file_size = info->FileSize;
+	FreePool(info);
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * read the whole file into a temporary buffer, only used for legacy
+ * packages whose boot header is not within the first HEADER_PROBE_SIZE
+ * bytes. The caller must free the buffer with free_pages().
+ */
+static EFI_STATUS load_image(EFI_FILE_HANDLE handle,
+			UINTN file_size,
 			EFI_PHYSICAL_ADDRESS *image_addr,
 			UINT32 *image_size)
 {
 	EFI_STATUS err;
-	EFI_FILE_HANDLE handle = NULL;
-	EFI_FILE_INFO *info;
 	CHAR8 *buf;
-	UINTN buflen;
+	UINTN buflen = file_size;
 	EFI_PHYSICAL_ADDRESS buf_phy_addr = HIGH_ADDR;
 
-	err = open_file(dir, &handle, (VOID *)name, EFI_FILE_MODE_READ);
-	if (EFI_ERROR(err) || handle == NULL) {
-		debug(L"open file error: %r\n", err);
-		goto out;
+	err = uefi_call_wrapper(handle->SetPosition, 2, handle, 0ULL);
+	if (EFI_ERROR(err)) {
+		error(L"rewind file failed: %r\n", err);
+		return err;
 	}
 
 	/* allocate memory used for load ikgt_pkg.bin file into memory */
-	info = LibFileInfo(handle);
-	buflen = info->FileSize+1;
 	err = allocate_pages(
 			AllocateMaxAddress,
 			EfiLoaderData,
 			EFI_SIZE_TO_PAGES(buflen),
 			(EFI_PHYSICAL_ADDRESS *)&buf_phy_addr);
 	if (EFI_ERROR(err) != EFI_SUCCESS) {
-		debug(L"alloc mem has failed\n");
-		goto out;
+		error(L"alloc mem has failed\n");
+		return err;
 	}
 	buf = (UINT8 *)(UINTN)buf_phy_addr;
 
-	err = read_file(handle, buflen, buf);
-	if (EFI_ERROR(err) == EFI_SUCCESS) {
-		buf[buflen] = '\0';
+	err = read_file(handle, &buflen, buf);
+	if (EFI_ERROR(err) == EFI_SUCCESS && buflen == file_size) {
 		*image_addr = buf_phy_addr;
 		*image_size = buflen;
 		debug(L"read file into buffer succeed! file size = %d\n", buflen);
 	} else {
-		debug(L"read file into buffer failed: error=%r\n", err);
-		free_pages(buf_phy_addr, EFI_SIZE_TO_PAGES(buflen));
+		error(L"read file into buffer failed: error=%r\n", err);
+		free_pages(buf_phy_addr, EFI_SIZE_TO_PAGES(file_size));
+		if (EFI_ERROR(err) == EFI_SUCCESS)
+			err = EFI_END_OF_FILE;
 	}
 
-out:
-	close_file(handle);
 	return err;
 }
 
@@ -206,30 +814,71 @@ static ikgt_loader_boot_header_t *find_header(UINTN start_addr, UINT32 size)
 	ikgt_loader_boot_header_t *ikgt_hdr = NULL;
 	UINT64  *magic;
 
-	/* one time scan 8bytes */
-	for (magic = (UINT64 *)start_addr; (UINTN)magic < (UINTN)start_addr+size; magic++) {
-		if (*magic == IKGT_BOOT_HEADER_MAGIC) {
-			debug(L"find the the specified headers\n");
-			ikgt_hdr = (ikgt_loader_boot_header_t *) magic;
-			break;
+	if (size < sizeof(ikgt_loader_boot_header_t))
+		return NULL;
+
+	/* the header is at offset 0 of the package, only legacy
+	 * packages need the scan */
+	if (*(UINT64 *)start_addr == IKGT_BOOT_HEADER_MAGIC) {
+		ikgt_hdr = (ikgt_loader_boot_header_t *)start_addr;
+	} else {
+		/* one time scan 8bytes */
+		for (magic = (UINT64 *)start_addr;
+			(UINTN)magic <= start_addr + size - sizeof(ikgt_loader_boot_header_t);
+			magic++) {
+			if (*magic == IKGT_BOOT_HEADER_MAGIC) {
+				debug(L"find the the specified headers\n");
+				ikgt_hdr = (ikgt_loader_boot_header_t *) magic;
+				break;
+			}
 		}
 	}
 
-	if (*magic != IKGT_BOOT_HEADER_MAGIC)
-		debug(L"cannot find the the sepecified heades\n");
-
-	if (ikgt_hdr != NULL) {
-		debug(L"ikgt_header->magic = 0x%llx\n", ikgt_hdr->magic);
-		debug(L"ikgt_header->size = %d\n", ikgt_hdr->size);
-		debug(L"ikgt_header->entry32_offset = 0x%x\n", ikgt_hdr->entry32_offset);
-		debug(L"ikgt_header->entry64_offset = 0x%x\n", ikgt_hdr->entry64_offset);
-		debug(L"ikgt_header->rt_mem_size = 0x%x\n", ikgt_hdr->rt_mem_size);
-		debug(L"ikgt_header->ldr_mem_size = 0x%x\n", ikgt_hdr->ldr_mem_size);
+	if (ikgt_hdr == NULL) {
+		error(L"cannot find the the sepecified heades\n");
+		return NULL;
 	}
 
+	debug(L"ikgt_header->magic = 0x%llx\n", ikgt_hdr->magic);
+	debug(L"ikgt_header->size = %d\n", ikgt_hdr->size);
+	debug(L"ikgt_header->entry32_offset = 0x%x\n", ikgt_hdr->entry32_offset);
+	debug(L"ikgt_header->entry64_offset = 0x%x\n", ikgt_hdr->entry64_offset);
+	debug(L"ikgt_header->rt_mem_size = 0x%x\n", ikgt_hdr->rt_mem_size);
+	debug(L"ikgt_header->ldr_mem_size = 0x%x\n", ikgt_hdr->ldr_mem_size);
+
 	return ikgt_hdr;
 }
 
+/*
+ * take "loglevel=N" from the load options of the image (the arguments of
+ * the boot entry, a UCS-2 string)
+ */
+static void get_log_level_from_load_options(EFI_LOADED_IMAGE *image)
+{
+	static const CHAR16 opt[] = L"loglevel=";
+	const UINTN opt_len = sizeof(opt) / sizeof(CHAR16) - 1;
+	CHAR16 *options = (CHAR16 *)image->LoadOptions;
+	UINTN len = image->LoadOptionsSize / sizeof(CHAR16);
+	UINTN i, j;
+
+	if (options == NULL) {
+		return;
+	}
+
+	for (i = 0; i + opt_len < len; i++) {
+		for (j = 0; (j < opt_len) && (options[i + j] == opt[j]); j++)
+			;
+
+		if (j == opt_len) {
+			if ((options[i + j] >= L'0') &&
+			    (options[i + j] <= L'0' + LOG_LEVEL_TRACE)) {
+				log_level = options[i + j] - L'0';
+			}
+			return;
+		}
+	}
+}
+
 EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 {
 	EFI_LOADED_IMAGE     *efi_loaded_image = NULL;
@@ -240,100 +889,178 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
 
 	EFI_PHYSICAL_ADDRESS image_addr = HIGH_ADDR;
 	EFI_PHYSICAL_ADDRESS platform_addr = HIGH_ADDR;
+	EFI_PHYSICAL_ADDRESS ldr_addr;
+	EFI_PHYSICAL_ADDRESS rt_addr;
 	UINTN                map_key;
 	UINTN                desc_size;
 	UINT32               desc_ver;
 	UINTN                nr_entries;
 	UINT32               image_size = 0;
+	UINT32               ldr_size;
+	UINT32               rt_size;
 	BOOLEAN              alloc_flag = FALSE;
+	EFI_FILE_HANDLE      image_handle = NULL;
+	UINTN                file_size = 0;
+	UINT8                *probe_buf = NULL;
+	UINTN                probe_len;
+	UINT8                *ldr_buf;
+	UINTN                read_len;
 
 	ikgt_platform_info_t      *platform_info;
 	ikgt_loader_boot_header_t *ikgt_header;
+	boot_trace_header_t       *trace;
+	UINT64                    entry_tsc;
+	BOOLEAN                   loader_called = FALSE;
+	UINT32                    *cpu_ids = NULL;
+
+	entry_tsc = __rdtsc();
 
 	InitializeLib(ImageHandle, SystemTable);
 
 	err = open_protocol(ImageHandle, &efi_loaded_image);
 	if (EFI_ERROR(err) || efi_loaded_image == NULL) {
-		debug(L"Error getting LoadedImageProtocol handle %d", err);
+		error(L"Error getting LoadedImageProtocol handle %d", err);
 		return err;
 	}
 
+	get_log_level_from_load_options(efi_loaded_image);
+
+	trace = trace_alloc();
+	trace_record_at(trace, entry_tsc, BOOT_TRACE_PRELOAD_ENTRY, 0);
+
 	root_dir = LibOpenRoot(efi_loaded_image->DeviceHandle);
 	if (!root_dir) {
-		debug(L"Unable to open root directory %d", err);
+		error(L"Unable to open root directory %d", err);
+		goto out;
+	}
+
+	err = open_image(root_dir, IMAGE_NAME, &image_handle, &file_size);
+	if (EFI_ERROR(err)) {
+		error(L"open image failed\n");
 		goto out;
 	}
+	debug(L"Image Size = %d\n", file_size);
 
-	/* load the ikgt_pkg.bin into memory */
-	err = load_image(root_dir, IMAGE_NAME, &image_addr, &image_size);
+	/* read the leading pages only, the boot header is expected there */
+	err = allocate_pool(EfiLoaderData, HEADER_PROBE_SIZE, (void **)&probe_buf);
 	if (EFI_ERROR(err)) {
-		debug(L"read file failed\n");
+		error(L"alloc mem for header probe has failed\n");
+		goto out;
+	}
+	probe_len = (file_size < HEADER_PROBE_SIZE) ? file_size : HEADER_PROBE_SIZE;
+	err = read_file(image_handle, &probe_len, probe_buf);
+	if (EFI_ERROR(err)) {
+		error(L"read file header failed: error=%r\n", err);
 		goto out;
 	}
-	debug(L"Image Load Addr = %x\n", (UINTN)image_addr);
-	debug(L"Image Size = %d\n", image_size);
 
 	/* find the ikgt's private header */
-	ikgt_header = find_header((UINTN)image_addr, image_size);
+	ikgt_header = find_header((UINTN)probe_buf, probe_len);
 	if (ikgt_header == NULL) {
-		debug(L"get ikgt file header failed\n");
+		/* legacy package: read the whole file and scan it */
+		err = load_image(image_handle, file_size, &image_addr, &image_size);
+		if (EFI_ERROR(err)) {
+			error(L"read file failed\n");
+			goto out;
+		}
+		debug(L"Image Load Addr = %x\n", (UINTN)image_addr);
+
+		ikgt_header = find_header((UINTN)image_addr, image_size);
+		if (ikgt_header == NULL) {
+			error(L"get ikgt file header failed\n");
+			err = EFI_LOAD_ERROR;
+			goto out;
+		}
+	}
+
+	ldr_size = ikgt_header->ldr_mem_size;
+	if (file_size > ldr_size) {
+		error(L"image does not fit in the loadtime memory\n");
+		err = EFI_BUFFER_TOO_SMALL;
 		goto out;
 	}
 
 	/* ldr_mem_base is a prefered loadtime memory address for bootloader
 	* to allocate. If failed, the bootloader can allocate any address
-	* below 1G. */
+	* below 1G. The header fields are 32-bit, allocate into a 64-bit
+	* local and store the result only once it succeeded. */
+	ldr_addr = ikgt_header->ldr_mem_base;
 	err = allocate_pages(
 			AllocateAddress,
 			EfiLoaderData,
-			EFI_SIZE_TO_PAGES(ikgt_header->ldr_mem_size),
-			(EFI_PHYSICAL_ADDRESS *)&ikgt_header->ldr_mem_base);
+			EFI_SIZE_TO_PAGES(ldr_size),
+			&ldr_addr);
 	if (EFI_ERROR(err) != EFI_SUCCESS) {
-		debug(L"allocating loadtime mem at the fixed address failed, ");
-		debug(L"try to allocate it at any address below 1G\n");
-		ikgt_header->ldr_mem_base = HIGH_ADDR;
+		warn(L"allocating loadtime mem at the fixed address failed, ");
+		warn(L"try to allocate it at any address below 1G\n");
+		ldr_addr = HIGH_ADDR;
 		err = allocate_pages(
 			AllocateMaxAddress,
 			EfiLoaderData,
-			EFI_SIZE_TO_PAGES(ikgt_header->ldr_mem_size),
-			(EFI_PHYSICAL_ADDRESS *)&ikgt_header->ldr_mem_base);
+			EFI_SIZE_TO_PAGES(ldr_size),
+			&ldr_addr);
 	}
 	if (EFI_ERROR(err) != EFI_SUCCESS) {
-		debug(L"allocate loadtime memory has failed\n");
+		error(L"allocate loadtime memory has failed\n");
 		goto out;
 	}
+	alloc_flag = TRUE;
+	ikgt_header->ldr_mem_base = (UINT32)ldr_addr;
 
 	/* rt_mem_base is a prefered runtime memory address for bootloader
 	* to allocate. If failed, the bootloader can allocate any address
 	* below 1G. */
+	rt_size = get_runtime_size(ikgt_header);
+	rt_addr = ikgt_header->rt_mem_base;
 	err = allocate_pages(
 			AllocateAddress,
 			EfiReservedMemoryType,
-			EFI_SIZE_TO_PAGES(ikgt_header->rt_mem_size),
-			(EFI_PHYSICAL_ADDRESS *)&ikgt_header->rt_mem_base);
+			EFI_SIZE_TO_PAGES(rt_size),
+			&rt_addr);
 	if (EFI_ERROR(err) != EFI_SUCCESS) {
-		debug(L"allocating runtime mem at the fixed address failed, ");
-		debug(L"try to allocate it at any address below 1G\n");
-		ikgt_header->rt_mem_base = HIGH_ADDR;
+		warn(L"allocating runtime mem at the fixed address failed, ");
+		warn(L"try to allocate it at any address below 1G\n");
+		rt_addr = HIGH_ADDR;
 		err = allocate_pages(
 			AllocateMaxAddress,
 			EfiReservedMemoryType,
-			EFI_SIZE_TO_PAGES(ikgt_header->rt_mem_size),
-			(EFI_PHYSICAL_ADDRESS *)&ikgt_header->rt_mem_base);
+			EFI_SIZE_TO_PAGES(rt_size),
+			&rt_addr);
 	}
 	if (EFI_ERROR(err) != EFI_SUCCESS) {
-		debug(L"allocate runtime memory has failed\n");
+		error(L"allocate runtime memory has failed\n");
 		goto out;
 	}
-	alloc_flag = TRUE;
-	debug(L"allocation of ldr/rt memory for ikgt succeed!\n");
-	debug(L"load-time memory addr = 0x%x\n", ikgt_header->rt_mem_base);
-	debug(L"run-time memory addr = 0x%x\n", ikgt_header->ldr_mem_base);
+	ikgt_header->rt_mem_base = (UINT32)rt_addr;
+	trace_record(trace, BOOT_TRACE_PRELOAD_MEM_ALLOCATED, 0);
+	info(L"allocation of ldr/rt memory for ikgt succeed!\n");
+	debug(L"load-time memory addr = 0x%x\n", ikgt_header->ldr_mem_base);
+	debug(L"run-time memory addr = 0x%x\n", ikgt_header->rt_mem_base);
+
+	if (image_addr != HIGH_ADDR) {
+		/* copy the ikgt_pkg.bin into the load time memory */
+		CopyMem((VOID *)(UINTN)ikgt_header->ldr_mem_base,
+				(VOID *)(UINTN)image_addr,
+				image_size);
+	} else {
+		/* place the leading pages, then stream the rest of ikgt_pkg.bin
+		 * straight into the load time memory */
+		ldr_buf = (UINT8 *)(UINTN)ikgt_header->ldr_mem_base;
+		CopyMem(ldr_buf, probe_buf, probe_len);
 
-	/* copy the ikgt_pkg.bin into the load time memory */
-	CopyMem((VOID *)(UINTN)ikgt_header->ldr_mem_base,
-			(VOID *)(UINTN)image_addr,
-			image_size);
+		read_len = file_size - probe_len;
+		if (read_len) {
+			err = read_file(image_handle, &read_len, ldr_buf + probe_len);
+			if (EFI_ERROR(err) || read_len != file_size - probe_len) {
+				error(L"read file into loadtime memory failed: error=%r\n", err);
+				if (!EFI_ERROR(err))
+					err = EFI_END_OF_FILE;
+				goto out;
+			}
+		}
+		debug(L"read file into loadtime memory succeed!\n");
+	}
+	trace_record(trace, BOOT_TRACE_PRELOAD_IMAGE_READ, file_size);
 
 	/* allocate memory for platform_info structure */
 	err = allocate_pages(
@@ -343,7 +1070,7 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
 			(EFI_PHYSICAL_ADDRESS *)&platform_addr);
 
 	if (EFI_ERROR(err) != EFI_SUCCESS) {
-		debug(L"alloc mem for platform_info has failed\n");
+		error(L"alloc mem for platform_info has failed\n");
 		goto out;
 	}
 	platform_info = (ikgt_platform_info_t *)platform_addr;
@@ -354,8 +1081,15 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
 								&desc_size,
 								&desc_ver);
 	platform_info->memmap_size = desc_size * nr_entries;
+	platform_info->memmap_desc_size = desc_size;
+	platform_info->memmap_desc_version = desc_ver;
 	platform_info->load_addr = ikgt_header->ldr_mem_base;
 	platform_info->run_addr = ikgt_header->rt_mem_base;
+	platform_info->run_size = rt_size;
+	platform_info->trace_addr = (UINT32)(UINTN)trace;
+	get_console_info(platform_info);
+	cpu_ids = get_cpu_ids(platform_info);
+	get_pm_timer(platform_info);
 
 	debug(L"platform_info->memmap_addr = 0x%x\n", platform_info->memmap_addr);
 	debug(L"platform_info->memmap_size = 0x%x\n", platform_info->memmap_size);
@@ -365,29 +1099,54 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
 				+ ikgt_header->entry64_offset);
 
 	debug(L"call ikgt loader entry_addr = 0x%x\n", call_loader);
-	debug(L"loading ikgt...\n");
+	info(L"loading ikgt...\n");
 
 	if (0 != check_vmx_support()) {
-		debug(L"No VTx support. will not load ikgt!\n");
+		error(L"No VTx support. will not load ikgt!\n");
 		goto out;
 	}
 
+	if (trace != NULL) {
+		err = uefi_call_wrapper(BS->InstallConfigurationTable, 2,
+				&boot_trace_guid, trace);
+		if (EFI_ERROR(err)) {
+			error(L"install boot trace table failed: %r\n", err);
+			err = EFI_SUCCESS;
+		}
+	}
+
 	/* call the entry point of ikgt loader */
-	if (call_loader != NULL)
+	if (call_loader != NULL) {
+		trace_record(trace, BOOT_TRACE_PRELOAD_CALL_LOADER, 0);
+		loader_called = TRUE;
 		call_loader(platform_info);
+		trace_record(trace, BOOT_TRACE_PRELOAD_RESUME, 0);
+	}
 
 	check_vmx_support();
 
-	debug(L"loading ikgt done!\n");
+	info(L"loading ikgt done!\n");
 out:
+	if (alloc_flag == TRUE)
+		free_pages(ldr_addr, EFI_SIZE_TO_PAGES(ldr_size));
+	/* must not to free the runtime memory, it's will be used by ikgt at runtime. */
+
+	if (image_handle != NULL)
+		close_file(image_handle);
+	if (probe_buf != NULL)
+		free_pool(probe_buf);
 	if (image_addr != HIGH_ADDR)
 		free_pages(image_addr, EFI_SIZE_TO_PAGES(image_size));
 	if (platform_addr != HIGH_ADDR)
 		free_pages(platform_addr, EFI_SIZE_TO_PAGES(sizeof(ikgt_platform_info_t)));
-
-	if (alloc_flag == TRUE)
-		free_pages(ikgt_header->ldr_mem_base, EFI_SIZE_TO_PAGES(ikgt_header->ldr_mem_size));
-	/* must not to free the runtime memory, it's will be used by ikgt at runtime. */
+	if (cpu_ids != NULL)
+		free_pool(cpu_ids);
+	/* the trace is kept for the OS once the loader has run */
+	if (trace != NULL && loader_called == FALSE) {
+		uefi_call_wrapper(BS->InstallConfigurationTable, 2,
+				&boot_trace_guid, NULL);
+		free_pages((UINTN)trace, EFI_SIZE_TO_PAGES(BOOT_TRACE_SIZE));
+	}
 
 	close_file(root_dir);
 	close_protocol(ImageHandle);
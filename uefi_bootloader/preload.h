@@ -124,11 +124,17 @@ static inline EFI_STATUS open_file(EFI_FILE_HANDLE Dir,
 			Mode, 0ULL);
 }
 
+/**
+ * read_file - Read from the current position of a file
+ * @FileHandle: handle of the file to read from
+ * @buflen: on input, the size of @buf; on output, the number of bytes read
+ * @buf: buffer the file content is read into
+ */
 static inline EFI_STATUS read_file(EFI_FILE_HANDLE FileHandle,
-			UINTN buflen,
+			UINTN *buflen,
 			VOID *buf)
 {
-	return uefi_call_wrapper(FileHandle->Read, 3, FileHandle, &buflen, buf);
+	return uefi_call_wrapper(FileHandle->Read, 3, FileHandle, buflen, buf);
 }
 
 static inline EFI_STATUS close_file(EFI_FILE_HANDLE FileHandle)